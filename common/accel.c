@@ -0,0 +1,1001 @@
+/* accel.c - Native versions of Inform's veneer routines
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Inform 6 compiles a handful of library-independent "veneer"
+ * routines into every game: property lookup for individual
+ * properties, ofclass, bounds-checked array access and so on.  They
+ * are small but called all the time.  Built with -DVENEER_ACCEL, the
+ * code area is walked routine by routine when the story is loaded and
+ * each routine is compared against the byte signatures below.  call()
+ * asks accel_call() about every routine it enters, and a recognised
+ * routine is answered by C code with the same results.  The C
+ * versions only handle the common cases; anything that would end in a
+ * run-time error, a class qualified property or an object that is
+ * itself a class is passed back to the interpreter, which runs the
+ * real routine.
+ *
+ * Setting FROTZ_NO_ACCEL in the environment turns this off.  Setting
+ * FROTZ_ACCEL_VERIFY works out every native result but still runs the
+ * routine, compares the two when it returns, reports any difference
+ * on stderr and stops using the native version of that routine.  On
+ * exit it lists the routines recognised, which is how a new version
+ * of Inform is checked against the signatures; tools/accelcheck.sh
+ * does this for a story and a file of commands.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frotz.h"
+
+#ifdef VENEER_ACCEL
+
+#ifdef TOPS20
+#error "VENEER_ACCEL assumes 16-bit words"
+#endif
+
+#ifndef ACCEL_ROUTINES
+#define ACCEL_ROUTINES	64	/* routines remembered, a power of two */
+#endif
+#define ACCEL_SCAN	96	/* longest routine looked at, instructions */
+#define ACCEL_SPAN	0x4000	/* longest routine walked over, bytes */
+#define ACCEL_RESYNC	64	/* places tried after a gap in the code */
+#define ACCEL_ARGS	4	/* arguments a veneer routine uses */
+#define ACCEL_PENDING	16	/* nested calls being verified */
+#define ACCEL_BOUNDS	8	/* array bounds in an RT__Ch routine */
+
+/* The routines recognised, in the order they are tried */
+enum {
+	A_NONE, A_UNSIGNED_COMPARE, A_RA_PR, A_RL_PR, A_RV_PR, A_OC_CL,
+	A_CP_TAB, A_Z_REGION, A_RT_CHLDB, A_RT_CHLDW, A_KINDS
+};
+
+/*
+ * A signature lists instructions that have to turn up in the given
+ * order, and instructions that must not turn up at all.  Each is
+ * written as the bytes of the instruction from its opcode on, with
+ * "??" for any byte, "UC" and "RA" for the packed address of a routine
+ * that is itself Unsigned__Compare or RA__Pr, "%g" for a global
+ * variable to remember, and "*nn" for 2OP opcode nn in any form.
+ * Alternatives are separated by "|".
+ *
+ */
+typedef struct {
+	const char *name;
+	zbyte min_locals;
+	zbyte max_locals;
+	const char *seq[6];
+	const char *never[4];
+	bool (*run) (const zword *, zword *);
+} veneer_t;
+
+static bool unsigned_compare(const zword *, zword *);
+static bool ra_pr(const zword *, zword *);
+static bool rl_pr(const zword *, zword *);
+static bool rv_pr(const zword *, zword *);
+static bool oc_cl(const zword *, zword *);
+static bool cp_tab(const zword *, zword *);
+static bool z_region(const zword *, zword *);
+static bool rt_chldb(const zword *, zword *);
+static bool rt_chldw(const zword *, zword *);
+
+static const veneer_t veneer[A_KINDS] = {
+	{ NULL, 0, 0, { NULL }, { NULL }, NULL },
+	{ "Unsigned__Compare", 4, 4,
+	  { "c9 8f 01 7f ff 03", "c9 8f 02 7f ff 04" },
+	  { NULL }, unsigned_compare },
+	{ "RA__Pr", 5, 5,
+	  { "c9 8f 02 80 00 00|c7 8f 02 80 00",
+	    "c9 8f 02 40 00 00|c7 8f 02 40 00",
+	    "61 %g 01|61 01 %g" },
+	  { NULL }, ra_pr },
+	{ "RL__Pr", 3, 3,
+	  { "e0 2b RA 01 02 03", "c9 8f 02 c0 00 00" },
+	  { NULL }, rl_pr },
+	{ "RV__Pr", 3, 3,
+	  { "e0 2b RA 01 02 03", "4f 03 00 00" },
+	  { "e1", "e2" }, rv_pr },
+	{ "OC__Cl", 5, 6,
+	  { "52 01 02 04", "6f 04 03 00" },
+	  { NULL }, oc_cl },
+	{ "CP__Tab", 4, 4,
+	  { "30 00 01 03", "49 03 80 00|47 03 80", "49 03 40 00|47 03 40",
+	    "49 03 3f 00" },
+	  { NULL }, cp_tab },
+	{ "Z__Region", 3, 3,
+	  { "42 01 01", "e0 ?? UC" },
+	  { "e1", "e2" }, z_region },
+	{ "RT__ChLDB", 2, 5,
+	  { "e0 ?? UC", "*10" },
+	  { "*0f", "e1", "e2" }, rt_chldb },
+	{ "RT__ChLDW", 2, 5,
+	  { "e0 ?? UC", "*0f" },
+	  { "*10", "e1", "e2" }, rt_chldw }
+};
+
+static struct {
+	zword routine;
+	zbyte kind;
+} accel_seen[ACCEL_ROUTINES];
+static int accel_used = 0;
+
+static zword claimed[A_KINDS];	/* routine recognised as each kind */
+static bool disabled[A_KINDS];	/* gave a wrong answer when verified */
+
+static zbyte self_var;		/* global holding "self" */
+static zword obj_count;		/* objects in the object table */
+static zword bounds[A_KINDS][ACCEL_BOUNDS];
+static int bound_count[A_KINDS];
+
+static struct {
+	zword depth;
+	zbyte kind;
+	zword args[2];
+	zword value;
+} pending[ACCEL_PENDING];
+static int pending_count = 0;
+
+static bool accel_enabled = FALSE;
+static bool accel_verify = FALSE;
+static unsigned long accel_scanned = 0;
+static unsigned long accel_hits = 0;
+static unsigned long accel_checked = 0;
+static unsigned long accel_mismatches = 0;
+
+#define SEEN_HASH(r)	(((r) ^ ((r) >> 9)) & (ACCEL_ROUTINES - 1))
+
+static zbyte routine_kind(zword);
+static zbyte identify(zword);
+static void scan_code(void);
+
+
+/*
+ * accel_init
+ *
+ * Get ready to recognise veneer routines.  Inform's V3 veneer is laid
+ * out differently and V6 has its own object conventions, so only V5,
+ * V7 and V8 stories are looked at.
+ *
+ */
+void accel_init(void)
+{
+	zword prop;
+	int i;
+
+	accel_enabled = FALSE;
+	if (getenv("FROTZ_NO_ACCEL") != NULL)
+		return;
+	if (z_header.version < V5 || z_header.version == V6)
+		return;
+	accel_verify = (getenv("FROTZ_ACCEL_VERIFY") != NULL);
+
+	/* Inform puts the first property table straight after the
+	   object table, which tells how many objects there are */
+	LOW_WORD(z_variant.object_base + z_variant.object_properties, prop)
+	if (prop <= z_variant.object_base)
+		return;
+	obj_count = (prop - z_variant.object_base) / z_variant.object_size;
+
+	for (i = 0; i < ACCEL_ROUTINES; i++)
+		accel_seen[i].routine = 0;
+	for (i = 0; i < A_KINDS; i++) {
+		claimed[i] = 0;
+		disabled[i] = FALSE;
+		bound_count[i] = 0;
+	}
+	accel_used = 0;
+	pending_count = 0;
+	scan_code();
+	accel_enabled = TRUE;
+} /* accel_init */
+
+
+/*
+ * decode
+ *
+ * Take apart the instruction at pc, if it lies in static memory.
+ *
+ */
+static bool decode(long pc, zinsn_t *in)
+{
+	if (pc < z_header.dynamic_size || pc + 24 > story_size)
+		return FALSE;
+	return decode_insn(pc, in);
+} /* decode */
+
+
+/*
+ * hex_digit
+ *
+ * Return the value of a hex digit, or -1.
+ *
+ */
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+} /* hex_digit */
+
+
+/*
+ * match_one
+ *
+ * Compare an instruction with one alternative of a signature entry,
+ * which ends at a '|' or the end of the string.
+ *
+ */
+static bool match_one(const char *s, long pc, const zinsn_t *in,
+		      zbyte *global)
+{
+	long at = pc;
+	zword word;
+
+	if (s[0] == '*')
+		return in->class == C_2OP &&
+			in->num == hex_digit(s[1]) * 16 + hex_digit(s[2]);
+
+	while (*s != 0 && *s != '|') {
+		if (*s == ' ') {
+			s++;
+			continue;
+		}
+		if (at >= in->next)
+			return FALSE;
+		if (s[0] == '?') {
+			at++;
+		} else if (s[0] == '%') {
+			if (zmp[at] < 0x10)
+				return FALSE;
+			*global = zmp[at++];
+		} else if (s[0] == 'U' || s[0] == 'R') {
+			if (at + 2 > in->next)
+				return FALSE;
+			word = ((zword) zmp[at] << 8) | zmp[at + 1];
+			at += 2;
+			if (routine_kind(word) !=
+			    (s[0] == 'U' ? A_UNSIGNED_COMPARE : A_RA_PR))
+				return FALSE;
+		} else if (zmp[at++] !=
+			   hex_digit(s[0]) * 16 + hex_digit(s[1]))
+			return FALSE;
+		s += 2;
+	}
+	return TRUE;
+} /* match_one */
+
+
+/*
+ * match
+ *
+ * Compare an instruction with a signature entry and its alternatives.
+ *
+ */
+static bool match(const char *s, long pc, const zinsn_t *in,
+		  zbyte *global)
+{
+	for (;;) {
+		if (match_one(s, pc, in, global))
+			return TRUE;
+		while (*s != 0 && *s != '|')
+			s++;
+		if (*s == 0)
+			return FALSE;
+		s++;
+	}
+} /* match */
+
+
+/*
+ * match_routine
+ *
+ * Walk a routine up to its last instruction and check it against a
+ * signature.  The routine ends at an instruction that never falls
+ * through once no branch or jump seen so far goes past it.
+ *
+ */
+static bool match_routine(long pc, const veneer_t *v, zbyte *global)
+{
+	zinsn_t in;
+	long reach = pc;
+	int found = 0;
+	int n, i;
+
+	for (n = 0; n < ACCEL_SCAN; n++) {
+		if (!decode(pc, &in))
+			return FALSE;
+		for (i = 0; i < 4 && v->never[i] != NULL; i++)
+			if (match(v->never[i], pc, &in, global))
+				return FALSE;
+		if (found < 6 && v->seq[found] != NULL &&
+		    match(v->seq[found], pc, &in, global))
+			found++;
+		if (in.target > reach)
+			reach = in.target;
+		if ((in.flags & ZI_TERMINAL) && in.next > reach)
+			return found == 6 || v->seq[found] == NULL;
+		pc = in.next;
+	}
+	return FALSE;
+} /* match_routine */
+
+
+/*
+ * find_bounds
+ *
+ * Collect the constants an RT__Ch routine hands to Unsigned__Compare
+ * along with the address.  One constant is the end of readable
+ * memory; otherwise they pair up as the starts and ends of the areas
+ * the game may read.  Anything else leaves the routine to the
+ * interpreter.
+ *
+ */
+static void find_bounds(long pc, zbyte kind)
+{
+	zinsn_t in;
+	long reach = pc;
+	int count = 0;
+	int n;
+
+	for (n = 0; n < ACCEL_SCAN && decode(pc, &in); n++) {
+		if (in.class == C_VAR && in.num == 0x00 && in.argc == 3 &&
+		    in.types[0] == 0 && in.types[2] != 2 &&
+		    routine_kind(in.args[0]) == A_UNSIGNED_COMPARE) {
+			if (count == ACCEL_BOUNDS)
+				break;
+			bounds[kind][count++] = in.args[2];
+		}
+		if (in.target > reach)
+			reach = in.target;
+		if ((in.flags & ZI_TERMINAL) && in.next > reach) {
+			if (count == 1 || !(count & 1))
+				bound_count[kind] = count;
+			return;
+		}
+		pc = in.next;
+	}
+	bound_count[kind] = 0;
+} /* find_bounds */
+
+
+/*
+ * identify
+ *
+ * Return which veneer routine this is, if any.
+ *
+ */
+static zbyte identify(zword routine)
+{
+	zbyte global = 0;
+	zbyte locals;
+	long pc;
+	int kind;
+
+	pc = ((long) routine << z_variant.packed_shift) +
+		z_variant.routine_offset;
+	if (pc < z_header.dynamic_size || pc >= story_size)
+		return A_NONE;
+	locals = zmp[pc];
+
+	for (kind = A_NONE + 1; kind < A_KINDS; kind++) {
+		const veneer_t *v = &veneer[kind];
+
+		if (locals < v->min_locals || locals > v->max_locals)
+			continue;
+		if (claimed[kind] != 0 && claimed[kind] != routine)
+			continue;
+		if (!match_routine(pc + 1, v, &global))
+			continue;
+
+		claimed[kind] = routine;
+		if (kind == A_RA_PR)
+			self_var = global;
+		if (kind == A_RT_CHLDB || kind == A_RT_CHLDW)
+			find_bounds(pc + 1, kind);
+		return kind;
+	}
+	return A_NONE;
+} /* identify */
+
+
+/*
+ * seen_slot
+ *
+ * Return the slot of a routine in accel_seen, or the empty slot where
+ * it would go.
+ *
+ */
+static int seen_slot(zword routine)
+{
+	int h = SEEN_HASH(routine);
+
+	while (accel_seen[h].routine != 0 && accel_seen[h].routine != routine)
+		h = (h + 1) & (ACCEL_ROUTINES - 1);
+	return h;
+} /* seen_slot */
+
+
+/*
+ * routine_kind
+ *
+ * Look up a routine that a signature refers to, identifying it the
+ * first time it comes along.
+ *
+ */
+static zbyte routine_kind(zword routine)
+{
+	int h = seen_slot(routine);
+	zbyte kind;
+
+	if (accel_seen[h].routine == routine)
+		return accel_seen[h].kind;
+	if (routine == 0 || 4 * accel_used >= 3 * ACCEL_ROUTINES)
+		return A_NONE;
+
+	/* Claim the slot first so that a routine calling itself ends */
+	accel_seen[h].routine = routine;
+	accel_seen[h].kind = A_NONE;
+	accel_used++;
+	kind = identify(routine);
+	accel_seen[h].kind = kind;
+	return kind;
+} /* routine_kind */
+
+
+/*
+ * routine_end
+ *
+ * Return where a routine whose first instruction is at pc ends, found
+ * as match_routine() does, or -1 if it does not decode.
+ *
+ */
+static long routine_end(long pc)
+{
+	zinsn_t in;
+	long start = pc;
+	long reach = pc;
+
+	while (pc - start < ACCEL_SPAN) {
+		if (!decode(pc, &in))
+			return -1;
+		if (in.target > reach)
+			reach = in.target;
+		if ((in.flags & ZI_TERMINAL) && in.next > reach)
+			return in.next;
+		pc = in.next;
+	}
+	return -1;
+} /* routine_end */
+
+
+/*
+ * scan_code
+ *
+ * Walk the code area from the start of high memory, one routine
+ * after another, and identify each routine not yet seen.  Inform lays
+ * routines end to end, padded to the packed address boundary, and
+ * puts the veneer after the game's own code, so the walk resyncs at
+ * the next boundary after anything it cannot decode, and gives up
+ * once it has found nothing for a while.
+ *
+ */
+static void scan_code(void)
+{
+	long unit = 1L << z_variant.packed_shift;
+	long pc, end;
+	zword routine;
+	zbyte kind;
+	int misses = 0;
+	int h;
+
+	accel_scanned = 0;
+	pc = z_header.resident_size;
+	if (pc < z_header.dynamic_size)
+		pc = z_header.dynamic_size;
+	pc += (z_variant.routine_offset - pc) & (unit - 1);
+
+	while (pc < story_size && misses < ACCEL_RESYNC) {
+		end = (zmp[pc] <= 15) ? routine_end(pc + 1) : -1;
+		if (end < 0) {
+			misses++;
+			pc += unit;
+			continue;
+		}
+		misses = 0;
+		accel_scanned++;
+
+		/* A signature may already have looked this one up */
+		routine = (zword) ((pc - z_variant.routine_offset)
+			>> z_variant.packed_shift);
+		if (accel_seen[seen_slot(routine)].routine != routine
+		    && (kind = identify(routine)) != A_NONE) {
+			h = seen_slot(routine);
+			if (accel_seen[h].routine == 0
+			    && 4 * accel_used < 3 * ACCEL_ROUTINES) {
+				accel_seen[h].routine = routine;
+				accel_seen[h].kind = kind;
+				accel_used++;
+			}
+		}
+
+		pc = end + ((z_variant.routine_offset - end) & (unit - 1));
+	}
+} /* scan_code */
+
+
+/*
+ * Helpers for the native routines.  They follow the V4+ object and
+ * property layout, which is all accel_init() lets through.
+ *
+ */
+static zword word_at(zword addr)
+{
+	zword value;
+
+	LOW_WORD(addr, value)
+	return value;
+} /* word_at */
+
+
+static zbyte byte_at(zword addr)
+{
+	zbyte value;
+
+	LOW_BYTE(addr, value)
+	return value;
+} /* byte_at */
+
+
+static zword parent_of(zword obj)
+{
+	return word_at(z_variant.object_base + (obj - 1) *
+		       z_variant.object_size + z_variant.object_parent);
+} /* parent_of */
+
+
+/*
+ * prop_addr
+ *
+ * Return the address of a common property of an object, or 0, the
+ * same way get_prop_addr does.
+ *
+ */
+static zword prop_addr(zword obj, zword prop)
+{
+	zword addr;
+	zbyte value = 0;
+	int n;
+
+	addr = word_at(z_variant.object_base + (obj - 1) *
+		       z_variant.object_size + z_variant.object_properties);
+	addr += 1 + 2 * byte_at(addr);
+
+	for (n = 0; n < 64 && addr < story_size; n++) {
+		value = byte_at(addr);
+		if ((value & 0x3f) <= prop)
+			break;
+		if (value & 0x80)
+			addr += 2 + (byte_at(addr + 1) & 0x3f);
+		else
+			addr += (value & 0x40) ? 3 : 2;
+	}
+	if (value == 0 || (value & 0x3f) != prop)
+		return 0;
+	return addr + ((value & 0x80) ? 2 : 1);
+} /* prop_addr */
+
+
+/*
+ * prop_len
+ *
+ * Return the length of the property at the given address, the same
+ * way get_prop_len does.
+ *
+ */
+static zword prop_len(zword addr)
+{
+	zbyte value = byte_at(addr - 1);
+
+	if (!(value & 0x80))
+		return (value >> 6) + 1;
+	value &= 0x3f;
+	return (value == 0) ? 64 : value;
+} /* prop_len */
+
+
+static bool is_object(zword obj)
+{
+	return obj >= 1 && obj <= obj_count;
+} /* is_object */
+
+
+/*
+ * unsigned_compare
+ *
+ * Unsigned__Compare(x, y): 1, 0 or -1 as x is above, equal to or
+ * below y taken as unsigned numbers.
+ *
+ */
+static bool unsigned_compare(const zword *a, zword *result)
+{
+	if (a[0] == a[1])
+		*result = 0;
+	else
+		*result = (a[0] > a[1]) ? 1 : 0xffff;
+	return TRUE;
+} /* unsigned_compare */
+
+
+/*
+ * ra_pr
+ *
+ * RA__Pr(obj, id): the address of a property, common or individual,
+ * or 0 if the object has none.  Private properties only show when
+ * self is the object itself.
+ *
+ */
+static bool ra_pr(const zword *a, zword *result)
+{
+	zword obj = a[0];
+	zword id = a[1];
+	zword table, addr, entry, other;
+	int n;
+
+	if (!is_object(obj) || (id & 0xc000) != 0 || id == 0)
+		return FALSE;
+	if (id < 64) {
+		*result = prop_addr(obj, id);
+		return TRUE;
+	}
+
+	addr = prop_addr(obj, 3);
+	if (addr == 0) {
+		*result = 0;
+		return TRUE;
+	}
+	if (parent_of(obj) == 1 || prop_len(addr) != 2)
+		return FALSE;
+
+	other = 0;
+	if (word_at(z_header.globals + 2 * (self_var - 16)) == obj)
+		other = id | 0x8000;
+
+	table = word_at(addr);
+	for (n = 0; n < 256 && table < story_size - 3; n++) {
+		entry = word_at(table);
+		if (entry == 0) {
+			*result = 0;
+			return TRUE;
+		}
+		if (entry == id || entry == other) {
+			*result = table + 3;
+			return TRUE;
+		}
+		table += byte_at(table + 2) + 3;
+	}
+	return FALSE;
+} /* ra_pr */
+
+
+/*
+ * rl_pr
+ *
+ * RL__Pr(obj, id): the length of a property, or 0 if there is none.
+ *
+ */
+static bool rl_pr(const zword *a, zword *result)
+{
+	zword addr;
+
+	if (a[1] >= 1 && a[1] < 64) {
+		if (!is_object(a[0]))
+			return FALSE;
+		addr = prop_addr(a[0], a[1]);
+		if (addr == 0)
+			return FALSE;
+		*result = prop_len(addr);
+		return TRUE;
+	}
+	if (!ra_pr(a, &addr))
+		return FALSE;
+	*result = (addr == 0) ? 0 : byte_at(addr - 1);
+	return TRUE;
+} /* rl_pr */
+
+
+/*
+ * rv_pr
+ *
+ * RV__Pr(obj, id): the value of a property the object provides.  A
+ * missing property means a default value or an error message, both of
+ * which are left to the routine.
+ *
+ */
+static bool rv_pr(const zword *a, zword *result)
+{
+	zword addr;
+
+	if (!ra_pr(a, &addr) || addr == 0)
+		return FALSE;
+	*result = word_at(addr);
+	return TRUE;
+} /* rv_pr */
+
+
+/*
+ * oc_cl
+ *
+ * OC__Cl(obj, cla): whether an ordinary object belongs to a class,
+ * going by the class list in its property 2.  Metaclasses, classes as
+ * objects, routines and strings are left to the routine.
+ *
+ */
+static bool oc_cl(const zword *a, zword *result)
+{
+	zword obj = a[0];
+	zword cla = a[1];
+	zword addr;
+	int n, i;
+
+	if (obj < 5 || !is_object(obj) || parent_of(obj) == 1)
+		return FALSE;
+	if (cla == 2) {		/* Object */
+		*result = 1;
+		return TRUE;
+	}
+	if (cla < 5 || !is_object(cla) || parent_of(cla) != 1)
+		return FALSE;
+
+	*result = 0;
+	addr = prop_addr(obj, 2);
+	if (addr == 0)
+		return TRUE;
+	n = prop_len(addr) / 2;
+	for (i = 0; i < n; i++) {
+		if (word_at(addr + 2 * i) == cla) {
+			*result = 1;
+			break;
+		}
+	}
+	return TRUE;
+} /* oc_cl */
+
+
+/*
+ * cp_tab
+ *
+ * CP__Tab(x, id): search the property table at x for property id and
+ * return its data address, or 0.  An id of -1 returns the address
+ * just past the end of the table.
+ *
+ */
+static bool cp_tab(const zword *a, zword *result)
+{
+	zword x = a[0];
+	zword id = a[1];
+	zbyte n, l;
+	int count;
+
+	for (count = 0; count < 64; count++) {
+		if (x >= story_size - 2)
+			return FALSE;
+		n = byte_at(x);
+		if (n == 0) {
+			*result = ((short) id < 0) ? x + 1 : 0;
+			return TRUE;
+		}
+		if (n & 0x80) {
+			x++;
+			l = byte_at(x) & 0x3f;
+		} else
+			l = (n & 0x40) ? 2 : 1;
+		x++;
+		if ((n & 0x3f) == id) {
+			*result = x;
+			return TRUE;
+		}
+		x += l;
+	}
+	return FALSE;
+} /* cp_tab */
+
+
+/*
+ * z_region
+ *
+ * Z__Region(addr): 1 for an object number.  Telling routines from
+ * strings depends on constants inside the routine, so it is left to
+ * do that itself.
+ *
+ */
+static bool z_region(const zword *a, zword *result)
+{
+	if (!is_object(a[0]))
+		return FALSE;
+	*result = 1;
+	return TRUE;
+} /* z_region */
+
+
+/*
+ * readable
+ *
+ * Check an address against the bounds found in an RT__Ch routine.
+ *
+ */
+static bool readable(zbyte kind, zword addr, zword size)
+{
+	const zword *b = bounds[kind];
+	int i;
+
+	if (bound_count[kind] == 1)
+		return (long) addr + size <= b[0];
+	for (i = 0; i < bound_count[kind]; i += 2) {
+		if (addr >= b[i] && (long) addr + size <= b[i + 1])
+			return TRUE;
+	}
+	return FALSE;
+} /* readable */
+
+
+/*
+ * rt_chldb, rt_chldw
+ *
+ * RT__ChLDB(base, offset) and RT__ChLDW(base, offset): base->offset
+ * and base-->offset in strict mode.  Anything out of bounds is left
+ * to the routine, which reports it.
+ *
+ */
+static bool rt_chldb(const zword *a, zword *result)
+{
+	zword addr = a[0] + a[1];
+
+	if (!readable(A_RT_CHLDB, addr, 1))
+		return FALSE;
+	*result = byte_at(addr);
+	return TRUE;
+} /* rt_chldb */
+
+
+static bool rt_chldw(const zword *a, zword *result)
+{
+	zword addr = a[0] + 2 * a[1];
+
+	if (!readable(A_RT_CHLDW, addr, 2))
+		return FALSE;
+	*result = word_at(addr);
+	return TRUE;
+} /* rt_chldw */
+
+
+/*
+ * accel_call
+ *
+ * Called by call() before it sets up a new frame.  Answer a veneer
+ * routine natively and return TRUE, or return FALSE to have it run as
+ * usual.  Direct calls always run as usual.
+ *
+ */
+bool accel_call(zword routine, int argc, zword *args, int ct)
+{
+	zword a[ACCEL_ARGS];
+	zword value;
+	zbyte kind;
+	int h, i;
+
+	if (!accel_enabled || ct == 2)
+		return FALSE;
+	h = seen_slot(routine);
+	if (accel_seen[h].routine != routine)
+		return FALSE;
+	kind = accel_seen[h].kind;
+	if (kind == A_NONE || disabled[kind])
+		return FALSE;
+
+	for (i = 0; i < ACCEL_ARGS; i++)
+		a[i] = (i < argc) ? args[i] : 0;
+	if (!veneer[kind].run(a, &value))
+		return FALSE;
+
+	if (accel_verify) {
+		/* Forget checks whose frames were thrown away */
+		while (pending_count > 0 &&
+		       pending[pending_count - 1].depth > frame_count)
+			pending_count--;
+		if (pending_count < ACCEL_PENDING) {
+			pending[pending_count].depth = frame_count + 1;
+			pending[pending_count].kind = kind;
+			pending[pending_count].args[0] = a[0];
+			pending[pending_count].args[1] = a[1];
+			pending[pending_count].value = value;
+			pending_count++;
+		}
+		return FALSE;
+	}
+
+	accel_hits++;
+	if (ct == 0)
+		store(value);
+	return TRUE;
+} /* accel_call */
+
+
+/*
+ * accel_check
+ *
+ * Called by ret() while the frame is still counted.  In verify mode,
+ * compare what the routine returned with the native answer.
+ *
+ */
+void accel_check(zword value)
+{
+	zbyte kind;
+
+	if (pending_count == 0)
+		return;
+	while (pending_count > 0 &&
+	       pending[pending_count - 1].depth > frame_count)
+		pending_count--;
+	if (pending_count == 0 || pending[pending_count - 1].depth != frame_count)
+		return;
+
+	pending_count--;
+	kind = pending[pending_count].kind;
+	accel_checked++;
+	if (pending[pending_count].value == value)
+		return;
+
+	accel_mismatches++;
+	disabled[kind] = TRUE;
+	fprintf(stderr, "Veneer: %s(%u, %u) gives %u natively, %u when run\n",
+		veneer[kind].name, pending[pending_count].args[0],
+		pending[pending_count].args[1],
+		pending[pending_count].value, value);
+} /* accel_check */
+
+
+/*
+ * accel_report
+ *
+ * Tell which routines were recognised, if verifying.
+ *
+ */
+void accel_report(void)
+{
+	int kind;
+
+	if (!accel_verify)
+		return;
+
+	for (kind = A_NONE + 1; kind < A_KINDS; kind++) {
+		if (claimed[kind] != 0)
+			fprintf(stderr, "Veneer: %s at %04x%s\n",
+				veneer[kind].name, claimed[kind],
+				disabled[kind] ? " (disabled)" : "");
+	}
+	fprintf(stderr, "Veneer: %lu routines scanned, %lu calls checked, "
+		"%lu mismatches, %lu answered natively\n", accel_scanned,
+		accel_checked, accel_mismatches, accel_hits);
+} /* accel_report */
+
+#endif /* VENEER_ACCEL */
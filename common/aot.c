@@ -0,0 +1,108 @@
+/* aot.c - Entry points into ahead-of-time translated Z-code
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * An AOT build links in a C file written by zcompile.py, which turns
+ * the basic blocks of one story's routines into C functions.  Each
+ * block works directly on the ordinary machine state (zmp, pcp, sp,
+ * fp), calls the usual opcode handlers for anything complicated and
+ * leaves the PC pointing at the next instruction, so the interpreter
+ * can take over at any block boundary and saves stay plain Quetzal.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "frotz.h"
+
+#ifdef AOT_STORY
+
+#if defined(TOPS20) || defined(THREADED_DISPATCH) || defined(INSN_CACHE)
+#error "AOT_STORY needs the plain interpreter loop"
+#endif
+
+static const aot_entry_t **aot_table = NULL;
+static long aot_mask = 0;
+
+#define AOT_HASH(pc)	(((pc) ^ ((pc) >> 7)) & aot_mask)
+
+
+/*
+ * aot_init
+ *
+ * Build the lookup table for the translated blocks, provided the
+ * loaded story is the one they were translated from.  Otherwise the
+ * story simply runs in the interpreter.
+ *
+ */
+void aot_init(void)
+{
+	long size;
+	int i;
+
+	if (z_header.release != aot_release
+	    || memcmp(z_header.serial, aot_serial, 6) != 0
+	    || z_header.checksum != aot_checksum) {
+		os_warn("Story differs from the translated one; interpreting it");
+		return;
+	}
+
+	for (size = 1; size < 2L * aot_block_count; size <<= 1)
+		;
+	aot_table = malloc(size * sizeof(*aot_table));
+	if (aot_table == NULL)
+		return;
+	memset(aot_table, 0, size * sizeof(*aot_table));
+	aot_mask = size - 1;
+
+	for (i = 0; i < aot_block_count; i++) {
+		long h = AOT_HASH(aot_blocks[i].pc);
+
+		while (aot_table[h] != NULL)
+			h = (h + 1) & aot_mask;
+		aot_table[h] = &aot_blocks[i];
+	}
+} /* aot_init */
+
+
+/*
+ * aot_lookup
+ *
+ * Return the translated block starting at the current PC, if any.
+ *
+ */
+aot_block_t aot_lookup(void)
+{
+	const aot_entry_t *entry;
+	long pc;
+	long h;
+
+	if (aot_table == NULL)
+		return NULL;
+
+	GET_PC(pc)
+	for (h = AOT_HASH(pc); (entry = aot_table[h]) != NULL;
+	     h = (h + 1) & aot_mask) {
+		if (entry->pc == pc)
+			return entry->block;
+	}
+	return NULL;
+} /* aot_lookup */
+
+#endif /* AOT_STORY */
@@ -0,0 +1,225 @@
+/* decode.c - Instruction decoder shared by the code walkers
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * The instruction cache, the code verifier and the veneer scanner all
+ * take instructions apart ahead of running them.  They share this
+ * decoder, so that which opcodes store, branch or end a block is
+ * written down once, for each version, in init_decoder().
+ *
+ * The interpreter proper still reads its operands as it goes and does
+ * not use any of this.
+ *
+ */
+
+#include "frotz.h"
+
+/* Bit n set: opcode n of the class stores, branches, may move the PC
+   or never falls through, for this story's version */
+static zlong stores[5], branches[5], controls[5], terminal[5];
+
+#define BIT(n)		((zlong) 1 << (n))
+#define HAS(set, c, n)	((set)[c] & BIT(n))
+
+
+/*
+ * init_decoder
+ *
+ * Set up the opcode tables for this story's version.
+ *
+ */
+void init_decoder(void)
+{
+	zbyte v = z_header.version;
+	int i;
+
+	stores[C_2OP] = BIT(0x08) | BIT(0x09) | BIT(0x0f) | BIT(0x10) |
+		BIT(0x11) | BIT(0x12) | BIT(0x13) | BIT(0x14) | BIT(0x15) |
+		BIT(0x16) | BIT(0x17) | BIT(0x18) | BIT(0x19);
+	stores[C_1OP] = BIT(0x01) | BIT(0x02) | BIT(0x03) | BIT(0x04) |
+		BIT(0x08) | BIT(0x0e) | (v <= V4 ? BIT(0x0f) : 0);
+	stores[C_0OP] = (v >= V4 ? BIT(0x05) | BIT(0x06) : 0) |
+		(v >= V5 ? BIT(0x09) : 0);
+	stores[C_VAR] = BIT(0x00) | BIT(0x07) | BIT(0x0c) | BIT(0x16) |
+		BIT(0x17) | BIT(0x18) | (v >= V5 ? BIT(0x04) : 0) |
+		(v == V6 ? BIT(0x09) : 0);
+	stores[C_EXT] = BIT(0x00) | BIT(0x01) | BIT(0x02) | BIT(0x03) |
+		BIT(0x04) | BIT(0x09) | BIT(0x0a) | BIT(0x0c) | BIT(0x13);
+
+	branches[C_2OP] = BIT(0x01) | BIT(0x02) | BIT(0x03) | BIT(0x04) |
+		BIT(0x05) | BIT(0x06) | BIT(0x07) | BIT(0x0a);
+	branches[C_1OP] = BIT(0x00) | BIT(0x01) | BIT(0x02);
+	branches[C_0OP] = (v <= V3 ? BIT(0x05) | BIT(0x06) : 0) |
+		BIT(0x0d) | BIT(0x0f);
+	branches[C_VAR] = BIT(0x17) | BIT(0x1f);
+	branches[C_EXT] = BIT(0x06) | BIT(0x18) | BIT(0x1b);
+
+	controls[C_2OP] = BIT(0x19) | BIT(0x1a) | BIT(0x1c);
+	controls[C_1OP] = BIT(0x08) | BIT(0x0b) | BIT(0x0c) |
+		(v >= V5 ? BIT(0x0f) : 0);
+	controls[C_0OP] = BIT(0x00) | BIT(0x01) | BIT(0x03) | BIT(0x05) |
+		BIT(0x06) | BIT(0x07) | BIT(0x08) | BIT(0x0a);
+	controls[C_VAR] = BIT(0x00) | BIT(0x04) | BIT(0x0c) | BIT(0x16) |
+		BIT(0x19) | BIT(0x1a);
+	controls[C_EXT] = BIT(0x00) | BIT(0x01) | BIT(0x0a);
+	for (i = 0; i < 5; i++)
+		controls[i] |= branches[i];
+
+	terminal[C_2OP] = BIT(0x1c);
+	terminal[C_1OP] = BIT(0x0b) | BIT(0x0c);
+	terminal[C_0OP] = BIT(0x00) | BIT(0x01) | BIT(0x03) | BIT(0x07) |
+		BIT(0x08) | BIT(0x0a);
+	terminal[C_VAR] = terminal[C_EXT] = 0;
+} /* init_decoder */
+
+
+/*
+ * decode_types
+ *
+ * Append the operand types of a specifier byte, two bits each.
+ *
+ */
+static int decode_types(zbyte specifier, zbyte *types, int count)
+{
+	int i;
+
+	for (i = 6; i >= 0 && count < 8; i -= 2) {
+		zbyte type = (specifier >> i) & 0x03;
+
+		if (type == 3)
+			break;
+		types[count++] = type;
+	}
+	return count;
+} /* decode_types */
+
+
+/*
+ * decode_insn
+ *
+ * Take apart the instruction at pc. Extended opcodes from 0x1d up are
+ * unknown; they decode without a store or branch and are left to the
+ * caller. Return FALSE if the instruction runs past the end of the
+ * story.
+ *
+ */
+bool decode_insn(long pc, zinsn_t *in)
+{
+	zbyte *p = zmp + pc;
+	zbyte opcode = *p++;
+	int class, num, count, i;
+	long offset = 0;
+
+	count = 0;
+	if (opcode < 0x80) {
+		class = C_2OP;
+		num = opcode & 0x1f;
+		in->types[0] = (opcode & 0x40) ? 2 : 1;
+		in->types[1] = (opcode & 0x20) ? 2 : 1;
+		count = 2;
+	} else if (opcode < 0xb0) {
+		class = C_1OP;
+		num = opcode & 0x0f;
+		in->types[0] = (opcode >> 4) & 0x03;
+		count = 1;
+	} else if (opcode == 0xbe) {
+		class = C_EXT;
+		num = *p++;
+		count = decode_types(*p++, in->types, 0);
+	} else if (opcode < 0xc0) {
+		class = C_0OP;
+		num = opcode - 0xb0;
+	} else {
+		class = (opcode < 0xe0) ? C_2OP : C_VAR;
+		num = opcode & 0x1f;
+		count = decode_types(*p++, in->types, 0);
+		if (opcode == 0xec || opcode == 0xfa)
+			count = decode_types(*p++, in->types, count);
+	}
+
+	in->pc = pc;
+	in->class = class;
+	in->num = num;
+	in->argc = count;
+	in->args[0] = in->args[1] = 0;
+	for (i = 0; i < count; i++) {
+		if (in->types[i] == 0) {
+			in->args[i] = ((zword) p[0] << 8) | p[1];
+			p += 2;
+		} else
+			in->args[i] = *p++;
+	}
+	in->end = p - zmp;
+	in->store = 0;
+	in->flags = 0;
+	in->target = -1;
+
+	if (class == C_EXT && num >= 0x1d) {
+		in->next = in->end;
+		return in->next <= story_size;
+	}
+
+	if (HAS(controls, class, num))
+		in->flags |= ZI_CONTROL;
+	if (HAS(terminal, class, num))
+		in->flags |= ZI_TERMINAL;
+	if (HAS(stores, class, num)) {
+		in->flags |= ZI_STORE;
+		in->store = *p++;
+	}
+	if (HAS(branches, class, num)) {
+		zbyte specifier = *p++;
+
+		in->flags |= ZI_BRANCH;
+		if (specifier & 0x80)
+			in->flags |= ZI_ON_TRUE;
+		offset = specifier & 0x3f;
+		if (!(specifier & 0x40)) {	/* long branch */
+			if (offset & 0x20)
+				offset -= 0x40;
+			offset = offset * 256 + *p++;
+		}
+	}
+	if (class == C_0OP && (num == 0x02 || num == 0x03)) {
+		while (p < zmp + story_size - 1 && !(*p & 0x80))
+			p += 2;
+		p += 2;
+	}
+	in->next = p - zmp;
+
+	if (in->flags & ZI_BRANCH)
+		in->target = (offset == 0 || offset == 1) ?
+			offset : in->next + offset - 2;
+	if (class == C_1OP && num == 0x0c && in->types[0] != 2)
+		in->target = in->end + (short) in->args[0] - 2;
+
+	/* Opcodes whose first operand names a variable or a routine */
+	if ((class == C_2OP && (num == 0x04 || num == 0x05 || num == 0x0d)) ||
+	    (class == C_1OP && (num == 0x05 || num == 0x06 || num == 0x0e)) ||
+	    (class == C_VAR && num == 0x09 && z_header.version != V6))
+		in->flags |= ZI_INDIRECT;
+	if ((class == C_2OP && (num == 0x19 || num == 0x1a)) ||
+	    (class == C_1OP && (num == 0x08 ||
+				(num == 0x0f && z_header.version >= V5))) ||
+	    (class == C_VAR && (num == 0x00 || num == 0x0c ||
+				num == 0x19 || num == 0x1a)))
+		in->flags |= ZI_CALL;
+
+	return in->next <= story_size;
+} /* decode_insn */
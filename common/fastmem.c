@@ -42,8 +42,14 @@ zbyte huge *zmp = NULL;
 zbyte huge *pcp = NULL;
 #else
 zbyte *zmp = NULL;
+#ifndef VM_REGISTERS
 zbyte *pcp = NULL;
 #endif
+#endif
+
+z_variant_t z_variant;
+
+zword global_vars[256];
 
 extern void seed_random (int);
 extern void restart_screen (void);
@@ -57,6 +63,9 @@ extern void script_close (void);
 
 extern zword save_quetzal (FILE *, FILE *);
 extern zword restore_quetzal (FILE *, FILE *);
+extern zword restore_quetzal_mem (const zbyte *, long, FILE *);
+extern long mem_diff (zbyte *, zbyte *, zword, zbyte *);
+extern void mem_undiff (zbyte *, long, zbyte *);
 
 extern void erase_window (zword);
 
@@ -78,21 +87,21 @@ static FILE *story_fp = NULL;
  */
 typedef struct undo_struct undo_t;
 struct undo_struct {
-	undo_t *next;
-	undo_t *prev;
 	long pc;
 	long diff_size;
 	zword frame_count;
 	zword stack_size;
 	zword frame_offset;
-	/* undo diff and stack data follow */
+	/* undo diff, stack data and frame records follow */
 };
 
-static undo_t huge *first_undo = NULL, huge *last_undo = NULL,
-	      huge *curr_undo = NULL;
 static zbyte huge *prev_zmp, *undo_diff;
 
-static int undo_count = 0;
+/*
+ * Pages of dynamic memory written, see MARK_DIRTY.  Pages without
+ * DIRTY_UNDO are the same in zmp and prev_zmp.
+ */
+zbyte dirty_pages[DIRTY_PAGES];
 
 
 #ifdef __WATCOMC__
@@ -258,6 +267,7 @@ void init_setup(void)
 {
 	memset(&f_setup, 0, sizeof(f_setup));
 	f_setup.undo_slots = DEFAULT_UNDO_SLOTS;
+	f_setup.undo_size = DEFAULT_UNDO_SIZE;
 	f_setup.script_cols = 80;
 	f_setup.err_report_mode = ERR_DEFAULT_REPORT_MODE;
 	f_setup.blorb_file = NULL;
@@ -278,6 +288,83 @@ void init_setup(void)
 } /* init_setup */
 
 
+/*
+ * init_variant
+ *
+ * Fix the version-dependent constants used by call(), the text
+ * decoder and the object code, so that none of them has to look at
+ * the version number or the story id again while the story runs.
+ *
+ */
+static void init_variant(void)
+{
+	z_variant_t *v = &z_variant;
+
+	memset(v, 0, sizeof(z_variant));
+
+	if (z_header.version <= V3) {
+		v->family = FAMILY_V1_3;
+		v->packed_shift = 1;
+	} else if (z_header.version <= V5) {
+		v->family = FAMILY_V4_5;
+		v->packed_shift = 2;
+	} else if (z_header.version <= V7) {
+		v->family = FAMILY_V6_7;
+		v->packed_shift = 2;
+		v->routine_offset = (long) z_header.functions_offset << 3;
+		v->string_offset = (long) z_header.strings_offset << 3;
+	} else {
+		v->family = FAMILY_V8;
+		v->packed_shift = 3;
+	}
+
+	v->local_defaults = (z_header.version <= V4);
+
+	if (v->family == FAMILY_V1_3) {
+		/* 31 default properties, 9 byte objects */
+		v->object_size = 9;
+		v->object_base = (zlong) z_header.objects + 62;
+		v->max_object = 255;
+		v->object_parent = 4;
+		v->object_sibling = 5;
+		v->object_child = 6;
+		v->object_properties = 7;
+		v->max_attribute = 31;
+		v->prop_id_mask = 0x1f;
+		v->prop_size_shift = 5;
+		v->prop_long_flag = 0;
+		v->prop_word_mask = 0xe0;
+		v->text_resolution = 2;
+	} else {
+		/* 63 default properties, 14 byte objects */
+		v->object_size = 14;
+		v->object_base = (zlong) z_header.objects + 126;
+		v->max_object = 65535;
+		v->object_parent = 6;
+		v->object_sibling = 8;
+		v->object_child = 10;
+		v->object_properties = 12;
+		v->max_attribute = 47;
+		v->prop_id_mask = 0x3f;
+		v->prop_size_shift = 6;
+		v->prop_long_flag = 0x80;
+		v->prop_word_mask = 0xc0;
+		v->text_resolution = 3;
+	}
+
+	if (z_header.version == V1)
+		v->abbrev_zchars = 0;
+	else if (z_header.version == V2)
+		v->abbrev_zchars = 1;
+	else
+		v->abbrev_zchars = 3;
+	v->shift_lock = (z_header.version <= V2);
+
+	/* Beyond Zork addresses objects it never created */
+	v->lax_objects = (story_id == BEYOND_ZORK);
+} /* init_variant */
+
+
 /*
  * init_memory
  *
@@ -561,6 +648,13 @@ void init_memory(void)
 		op1_opcodes[0x0f] = z_call_n;
 	}
 
+	/* Install handlers for stories with known quirks */
+	if (story_id == SHERLOCK) {
+		var_opcodes[0x0b] = z_set_attr_sherlock;
+		var_opcodes[0x0c] = z_clear_attr_sherlock;
+	}
+	init_variant();
+
 	/* Allocate memory for story data */
 	if ((zmp = (zbyte huge *) zrealloc(zmp, story_size, 64)) == NULL)
 		os_fatal("Out of memory");
@@ -612,9 +706,14 @@ void init_memory(void)
 void init_undo(void)
 {
 	void huge *reserved;
+	long largest;
+	int i;
 
 	reserved = NULL;	/* makes compilers shut up */
 
+	if (f_setup.undo_slots == 0)
+		return;
+
 	if (reserve_mem != 0) {
 		if ((reserved = zmalloc(reserve_mem)) == NULL)
 			return;
@@ -632,12 +731,20 @@ void init_undo(void)
 	undo_diff = malloc(((unsigned long)z_header.dynamic_size * 3) / 2 + 2);
 #endif
 
-	if ((undo_diff != NULL) && (prev_zmp != NULL)) {
+	largest = sizeof (undo_t)
+		+ ((long) z_header.dynamic_size * 3) / 2 + 2
+		+ STACK_SIZE * sizeof (*sp) + FRAME_COUNT * sizeof (*frames);
+
+	if ((undo_diff != NULL) && (prev_zmp != NULL)
+	    && undo_open(f_setup.undo_size, largest)) {
 		memmove (prev_zmp, zmp, z_header.dynamic_size);
+		for (i = 0; i < DIRTY_PAGES; i++)
+			dirty_pages[i] &= ~DIRTY_UNDO;
 	} else {
 		f_setup.undo_slots = 0;
 		if (prev_zmp != NULL) zfree(prev_zmp);
 		if (undo_diff != NULL) zfree(undo_diff);
+		prev_zmp = undo_diff = NULL;
 	}
 
 	if (reserve_mem != 0)
@@ -645,33 +752,6 @@ void init_undo(void)
 } /* init_undo */
 
 
-/*
- * free_undo
- *
- * Free count undo blocks from the beginning of the undo list.
- *
- */
-static void free_undo(int count)
-{
-	undo_t *p;
-
-	if (count > undo_count)
-		count = undo_count;
-	while (count--) {
-		p = first_undo;
-		if (curr_undo == first_undo)
-			curr_undo = curr_undo->next;
-		first_undo = first_undo->next;
-		zfree (p);
-		undo_count--;
-	}
-	if (first_undo)
-		first_undo->prev = NULL;
-	else
-		last_undo = NULL;
-} /* free_undo */
-
-
 /*
  * reset_memory
  *
@@ -685,21 +765,48 @@ void reset_memory(void)
 	story_fp = NULL;
 
 	if (undo_diff) {
-		free_undo(undo_count);
+		undo_close();
 		zfree(undo_diff);
 		zfree(prev_zmp);
 	}
 
 	undo_diff = NULL;
-	undo_count = 0;
 	prev_zmp = NULL;
 
+#ifdef SNAPSHOTS
+	snapshot_reset();
+#endif
+
 	if (zmp)
 		zfree(zmp);
 	zmp = NULL;
 } /* reset_memory */
 
 
+/*
+ * flags_written
+ *
+ * React to the game writing the low byte of the flags register.
+ *
+ */
+static void flags_written(zbyte value)
+{
+	z_header.flags &= ~(SCRIPTING_FLAG | FIXED_FONT_FLAG);
+	z_header.flags |= value & (SCRIPTING_FLAG | FIXED_FONT_FLAG);
+
+#ifndef NO_SCRIPT
+	if (value & SCRIPTING_FLAG) {
+		if (!ostream_script)
+			script_open();
+	} else {
+		if (ostream_script)
+			script_close();
+	}
+#endif		
+	refresh_text_style();
+} /* flags_written */
+
+
 /*
  * storeb
  *
@@ -715,22 +822,21 @@ void storeb(zword addr, zbyte value)
 	if (addr >= z_header.dynamic_size)
 		runtime_error(ERR_STORE_RANGE);
 
-	if (addr == H_FLAGS + 1) {	/* flags register is modified */
-		z_header.flags &= ~(SCRIPTING_FLAG | FIXED_FONT_FLAG);
-		z_header.flags |= value & (SCRIPTING_FLAG | FIXED_FONT_FLAG);
+	if (addr == H_FLAGS + 1)
+		flags_written(value);
+	SET_BYTE(addr, value);
+
+	/* Keep the native copy of the globals in step */
+	if (addr >= z_header.globals && addr < z_header.globals + 480) {
+		zword g = (addr - z_header.globals) / 2;
+		zword g_addr = z_header.globals + 2 * g;
 
-#ifndef NO_SCRIPT
-		if (value & SCRIPTING_FLAG) {
-			if (!ostream_script)
-				script_open();
-		} else {
-			if (ostream_script)
-				script_close();
-		}
-#endif		
-		refresh_text_style();
+		LOW_WORD(g_addr, global_vars[g])
 	}
-	SET_BYTE(addr, value);
+
+	/* Drop property lookups that may have read this byte */
+	if (addr >= prop_watch_low && addr < prop_watch_high)
+		flush_prop_cache();
 } /* storeb */
 
 
@@ -751,6 +857,112 @@ void storew(zword addr, zword value)
 } /* storew */
 
 
+/*
+ * mark_dirty
+ *
+ * Mark the pages of a block of dynamic memory as written.
+ *
+ */
+static void mark_dirty(zword addr, zword count)
+{
+	zlong page;
+
+	if (count == 0)
+		return;
+	for (page = addr >> DIRTY_SHIFT;
+	     page <= ((zlong) addr + count - 1) >> DIRTY_SHIFT; page++)
+		MARK_DIRTY(page << DIRTY_SHIFT)
+} /* mark_dirty */
+
+
+/*
+ * mark_all_dirty
+ *
+ * Mark all of dynamic memory as written, after it has been replaced.
+ *
+ */
+static void mark_all_dirty(void)
+{
+	memset(dirty_pages, DIRTY_ALL, sizeof(dirty_pages));
+} /* mark_all_dirty */
+
+
+/*
+ * block_written
+ *
+ * Do for a block of dynamic memory what storeb does for each byte it
+ * writes, once the block is in place.
+ *
+ */
+static void block_written(zword addr, zword count)
+{
+	zlong end = (zlong) addr + count;
+
+	mark_dirty(addr, count);
+	if (addr <= H_FLAGS + 1 && end > H_FLAGS + 1)
+		flags_written(zmp[H_FLAGS + 1]);
+	if (addr < z_header.globals + 480 && end > z_header.globals)
+		load_globals();
+	if (addr < prop_watch_high && end > prop_watch_low)
+		flush_prop_cache();
+} /* block_written */
+
+
+/*
+ * store_block
+ *
+ * Copy a block of bytes into the dynamic Z-machine memory.  The source
+ * may overlap the destination.  Return FALSE, having written nothing,
+ * if the block does not lie wholly inside dynamic memory; the caller
+ * then stores it byte by byte so the range errors come out as usual.
+ *
+ */
+bool store_block(zword addr, const zbyte *src, zword count)
+{
+	if ((zlong) addr + count > z_header.dynamic_size)
+		return FALSE;
+
+	memmove(zmp + addr, src, count);
+	block_written(addr, count);
+	return TRUE;
+} /* store_block */
+
+
+/*
+ * fill_block
+ *
+ * Set a block of the dynamic Z-machine memory to one value, with the
+ * same range rule as store_block.
+ *
+ */
+bool fill_block(zword addr, zbyte value, zword count)
+{
+	if ((zlong) addr + count > z_header.dynamic_size)
+		return FALSE;
+
+	memset(zmp + addr, value, count);
+	block_written(addr, count);
+	return TRUE;
+} /* fill_block */
+
+
+/*
+ * load_globals
+ *
+ * Refresh the native copy of the global variables after the dynamic
+ * memory has been loaded as a whole.
+ *
+ */
+void load_globals(void)
+{
+	zword addr = z_header.globals;
+	int i;
+
+	for (i = 0; i < 240; i++, addr += 2)
+		LOW_WORD(addr, global_vars[i])
+} /* load_globals */
+
+
 /*
  * z_restart, re-load dynamic area, clear the stack and set the PC.
  *
@@ -771,10 +983,13 @@ void z_restart(void)
 		os_storyfile_seek(story_fp, 0, SEEK_SET);
 		if (fread(zmp, 1, z_header.dynamic_size, story_fp) != z_header.dynamic_size)
 			os_fatal ("Story file read error");
+		mark_all_dirty();
 	} else first_restart = FALSE;
 
 	restart_header();
 	restart_screen();
+	load_globals();
+	flush_prop_cache();
 
 	sp = fp = stack + STACK_SIZE;
 	frame_count = 0;
@@ -827,6 +1042,67 @@ static void get_default_name(char *default_name, size_t length, zword addr)
 } /* get_default_name */
 
 
+/*
+ * finish_restore
+ *
+ * Bring the interpreter into line with what restore_quetzal or
+ * restore_quetzal_mem left in memory, and pass on what it returned.
+ *
+ */
+static zword finish_restore(zword success)
+{
+	/* Even a failed restore may have changed memory */
+	mark_all_dirty();
+	load_globals();
+	flush_prop_cache();
+	if ((short) success > 0) {
+		zbyte old_screen_rows;
+		zbyte old_screen_cols;
+
+#ifdef VERIFY_STORY
+		verify_restored();
+#endif
+
+		/* In V3, reset the upper window. */
+		if (z_header.version == V3)
+			split_window(0);
+
+		LOW_BYTE (H_SCREEN_ROWS, old_screen_rows);
+		LOW_BYTE (H_SCREEN_COLS, old_screen_cols);
+
+		/* Reload cached header fields. */
+		restart_header ();
+
+		/*
+		 * Since QUETZAL files may be saved on
+		 * many different machines, the screen sizes
+		 * may vary a lot. Erasing the status window
+		 * seems to cover up most of the
+		 * resulting badness.
+		 */
+		if (z_header.version > V3 && z_header.version != V6
+		    && (z_header.screen_rows != old_screen_rows
+		    || z_header.screen_cols != old_screen_cols))
+			erase_window (1);
+	}
+	return success;
+} /* finish_restore */
+
+
+/*
+ * restore_game_mem
+ *
+ * Restore a game saved by save_quetzal_mem from size bytes at data,
+ * as z_restore does from a file.  Return 2 if OK, 0 if an error
+ * occurred before any damage was done, -1 on a fatal error.
+ *
+ */
+zword restore_game_mem(const zbyte *data, long size)
+{
+	return finish_restore(restore_quetzal_mem(data, size, story_fp));
+} /* restore_game_mem */
+
+
 /*
  * z_restore, restore [a part of] a Z-machine state from disk
  *
@@ -872,6 +1148,9 @@ void z_restore(void)
 
 		/* Load auxiliary file */
 		success = fread (zmp + zargs[0], 1, zargs[1], gfp);
+		mark_dirty (zargs[0], zargs[1]);
+		load_globals ();
+		flush_prop_cache ();
 
 		/* Close auxiliary file */
 		fclose (gfp);
@@ -892,36 +1171,10 @@ void z_restore(void)
 		/* Open game file */
 		if ((gfp = fopen(new_name, "rb")) == NULL) 
 			goto finished;
-		success = restore_quetzal(gfp, story_fp);
+		success = finish_restore(restore_quetzal(gfp, story_fp));
 		if ((short) success >= 0) {
 			/* Close game file */
 			fclose (gfp);
-			if ((short) success > 0) {
-				zbyte old_screen_rows;
-				zbyte old_screen_cols;
-
-				/* In V3, reset the upper window. */
-				if (z_header.version == V3)
-					split_window(0);
-
-				LOW_BYTE (H_SCREEN_ROWS, old_screen_rows);
-				LOW_BYTE (H_SCREEN_COLS, old_screen_cols);
-
-				/* Reload cached header fields. */
-				restart_header ();
-
-				/*
-				 * Since QUETZAL files may be saved on
-				 * many different machines, the screen sizes
-				 * may vary a lot. Erasing the status window
-				 * seems to cover up most of the
-				 * resulting badness.
-				 */
-				if (z_header.version > V3 && z_header.version != V6
-				    && (z_header.screen_rows != old_screen_rows
-				    || z_header.screen_cols != old_screen_cols))
-					erase_window (1);
-			}
 		} else
 			os_fatal ("Error reading save file");
 	}
@@ -937,85 +1190,6 @@ finished:
 } /* z_restore */
 
 
-/*
- * mem_diff
- *
- * Set diff to a Quetzal-like difference between a and b,
- * copying a to b as we go.  It is assumed that diff points to a
- * buffer which is large enough to hold the diff.
- * mem_size is the number of bytes to compare.
- * Returns the number of bytes copied to diff.
- *
- */
-static long mem_diff(zbyte *a, zbyte *b, zword mem_size, zbyte *diff)
-{
-	unsigned size = mem_size;
-	zbyte *p = diff;
-	unsigned j;
-	zbyte c;
-
-	for (;;) {
-		for (j = 0; size > 0 && (c = *a++ ^ *b++) == 0; j++)
-			size--;
-		if (size == 0) break;
-		size--;
-		if (j > 0x8000) {
-			*p++ = 0;
-			*p++ = 0xff;
-			*p++ = 0xff;
-			j -= 0x8000;
-		}
-		if (j > 0) {
-			*p++ = 0;
-			j--;
-			if (j <= 0x7f) {
-				*p++ = j;
-			} else {
-				*p++ = (j & 0x7f) | 0x80;
-				*p++ = (j & 0x7f80) >> 7;
-			}
-		}
-		*p++ = c;
-		*(b - 1) ^= c;
-	}
-	return p - diff;
-} /* mem_diff */
-
-
-/*
- * mem_undiff
- *
- * Applies a quetzal-like diff to dest
- *
- */
-static void mem_undiff(zbyte *diff, long diff_length, zbyte *dest)
-{
-	zbyte c;
-
-	while (diff_length) {
-		c = *diff++;
-		diff_length--;
-		if (c == 0) {
-			unsigned runlen;
-
-			if (!diff_length)
-				return;  /* Incomplete run */
-			runlen = *diff++;
-			diff_length--;
-			if (runlen & 0x80) {
-				if (!diff_length)
-					return; /* Incomplete extended run */
-				c = *diff++;
-				diff_length--;
-				runlen = (runlen & 0x7f) | (((unsigned) c) << 7);
-			}
-			dest += runlen + 1;
-		} else
-			*dest++ ^= c;
- 	}
-} /* mem_undiff */
-
-
 /*
  * restore_undo
  *
@@ -1024,31 +1198,49 @@ static void mem_undiff(zbyte *diff, long diff_length, zbyte *dest)
  */
 int restore_undo(void)
 {
+	undo_t huge *p;
 	long pc;
+	zlong page;
+	zlong offset;
+	zlong count;
 
 	/* undo feature unavailable */
 	if (f_setup.undo_slots == 0)
 		return -1;
 
 	/* no saved game state */
-	if (curr_undo == NULL)
+	if ((p = (undo_t huge *) undo_top()) == NULL)
 		return 0;
 
-	pc = curr_undo->pc;
+	pc = p->pc;
 
-	/* undo possible */
-	memmove(zmp, prev_zmp, z_header.dynamic_size);
+	/* undo possible; only the dirty pages differ from prev_zmp */
+	for (page = 0; page << DIRTY_SHIFT < z_header.dynamic_size; page++) {
+		if (dirty_pages[page] & DIRTY_UNDO) {
+			offset = (zlong) page << DIRTY_SHIFT;
+			count = z_header.dynamic_size - offset;
+			if (count > 1 << DIRTY_SHIFT)
+				count = 1 << DIRTY_SHIFT;
+			memmove(zmp + offset, prev_zmp + offset, count);
+			dirty_pages[page] = DIRTY_ALL & ~DIRTY_UNDO;
+		}
+	}
 	SET_PC(pc);
-	curr_undo->pc = pc;
-	sp = stack + STACK_SIZE - curr_undo->stack_size;
-	fp = stack + curr_undo->frame_offset;
-	frame_count = curr_undo->frame_count;
-	mem_undiff((zbyte *) (curr_undo + 1), curr_undo->diff_size, prev_zmp);
-	memmove (sp, (zbyte *)(curr_undo + 1) + curr_undo->diff_size,
-		curr_undo->stack_size * sizeof (*sp));
-
-	curr_undo = curr_undo->prev;
+	p->pc = pc;
+	sp = stack + STACK_SIZE - p->stack_size;
+	fp = stack + p->frame_offset;
+	frame_count = p->frame_count;
+	mem_undiff((zbyte *) (p + 1), p->diff_size, prev_zmp);
+	memmove (sp, (zbyte *)(p + 1) + p->diff_size,
+		p->stack_size * sizeof (*sp));
+	memmove (frames, (zbyte *)(p + 1) + p->diff_size
+		+ p->stack_size * sizeof (*sp),
+		frame_count * sizeof (*frames));
+
+	undo_pop();
 	restart_header();
+	load_globals();
+	flush_prop_cache();
 	return 2;
 } /* restore_undo */
 
@@ -1138,12 +1330,10 @@ void z_save(void)
 		success = save_quetzal(gfp, story_fp);
 
 		/* Close game file and check for errors */
-		if (fclose(gfp) == EOF || ferror(story_fp)) {
+		if (fclose(gfp) == EOF || ferror(story_fp) || !success) {
 			print_string("Error writing save file\n");
-			goto finished;
+			success = 0;
 		}
-		/* Success */
-		success = 1;
 	}
 
 finished:
@@ -1174,27 +1364,10 @@ int save_undo(void)
 		return -1;
 
 	/* save undo possible */
-	while (last_undo != curr_undo) {
-		p = last_undo;
-		last_undo = last_undo->prev;
-		free(p);
-		undo_count--;
-	}
-	if (last_undo)
-		last_undo->next = NULL;
-	else
-		first_undo = NULL;
-
-	if (undo_count == f_setup.undo_slots)
-		free_undo(1);
-
 	diff_size = mem_diff(zmp, prev_zmp, z_header.dynamic_size, undo_diff);
 	stack_size = stack + STACK_SIZE - sp;
-	do {
-		p = zmalloc(sizeof (undo_t) + diff_size + stack_size * sizeof (*sp));
-		if (p == NULL)
-			free_undo(1);
-	} while (!p && undo_count);
+	p = (undo_t huge *) undo_push(sizeof (undo_t) + diff_size
+		+ stack_size * sizeof (*sp) + frame_count * sizeof (*frames));
 	if (p == NULL)
 		return -1;
 	pc = p->pc;
@@ -1206,17 +1379,8 @@ int save_undo(void)
 	p->frame_offset = fp - stack;
 	memmove(p + 1, undo_diff, diff_size);
 	memmove((zbyte *)(p + 1) + diff_size, sp, stack_size * sizeof (*sp));
-
-	if (!first_undo) {
-		p->prev = NULL;
-		first_undo = p;
-	} else {
-		last_undo->next = p;
-		p->prev = last_undo;
-	}
-	p->next = NULL;
-	curr_undo = last_undo = p;
-	undo_count++;
+	memmove((zbyte *)(p + 1) + diff_size + stack_size * sizeof (*sp),
+		frames, frame_count * sizeof (*frames));
 	return 1;
 } /* save_undo */
 
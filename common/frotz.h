@@ -193,6 +193,12 @@ typedef struct {
 #ifndef MAX_UNDO_SLOTS
 #define MAX_UNDO_SLOTS 500
 #endif
+#ifndef DEFAULT_UNDO_SIZE
+#define DEFAULT_UNDO_SIZE 65536L
+#endif
+#ifndef UNDO_RAW_BLOCKS
+#define UNDO_RAW_BLOCKS 8
+#endif
 #ifndef MAX_FILE_NAME
 #define MAX_FILE_NAME 80
 #endif
@@ -202,9 +208,15 @@ typedef struct {
 #ifndef INPUT_BUFFER_SIZE
 #define INPUT_BUFFER_SIZE 200
 #endif
+#ifndef INTERRUPT_DEPTH
+#define INTERRUPT_DEPTH 8
+#endif
 #ifndef STACK_SIZE
 #define STACK_SIZE 1024
 #endif
+#ifndef FRAME_COUNT
+#define FRAME_COUNT (STACK_SIZE / 4)
+#endif
 
 extern const char build_timestamp[];
 
@@ -437,12 +449,31 @@ extern const char build_timestamp[];
 #define FILE_SAVE_AUX 6
 #define FILE_NO_PROMPT 7
 
+/*
+ * Dynamic memory is split into pages.  Every write through SET_BYTE,
+ * SET_WORD or the block stores sets all the bits of its page in
+ * dirty_pages, and each user clears its own bit once it has caught
+ * up: save_undo only compares pages marked DIRTY_UNDO with the
+ * previous state (see fastmem.c), snapshots copy pages marked
+ * DIRTY_SNAP (snapshot.c) and the state hash rehashes pages marked
+ * DIRTY_HASH (statehash.c).
+ */
+#define DIRTY_SHIFT 8
+#define DIRTY_PAGES (0x10000 >> DIRTY_SHIFT)
+#define DIRTY_UNDO 0x01
+#define DIRTY_SNAP 0x02
+#define DIRTY_HASH 0x04
+#define DIRTY_ALL  0x07
+extern zbyte dirty_pages[DIRTY_PAGES];
+#define MARK_DIRTY(addr)  \
+	{ dirty_pages[((zword) (addr) >> DIRTY_SHIFT) & (DIRTY_PAGES - 1)] = DIRTY_ALL; }
+
 /*** Data access macros ***/
 #ifdef TOPS20
-#define SET_BYTE(addr,v)  { zmp[addr] = v & 0xff; }
+#define SET_BYTE(addr,v)  { MARK_DIRTY(addr) zmp[addr] = v & 0xff; }
 #define LOW_BYTE(addr,v)  { v = zmp[addr] & 0xff; }
 #else
-#define SET_BYTE(addr,v)  { zmp[addr] = v; }
+#define SET_BYTE(addr,v)  { MARK_DIRTY(addr) zmp[addr] = v; }
 #define LOW_BYTE(addr,v)  { v = zmp[addr]; }
 #endif
 #define CODE_BYTE(v)	  { v = *pcp++;    }
@@ -459,7 +490,7 @@ extern zbyte *zmp;
 #define lo(v)	((zbyte *)&v)[1]
 #define hi(v)	((zbyte *)&v)[0]
 
-#define SET_WORD(addr,v)  { zmp[addr] = hi(v); zmp[addr+1] = lo(v); }
+#define SET_WORD_RAW(addr,v)  { zmp[addr] = hi(v); zmp[addr+1] = lo(v); }
 #define LOW_WORD(addr,v)  { hi(v) = zmp[addr]; lo(v) = zmp[addr+1]; }
 #define HIGH_WORD(addr,v) { hi(v) = zmp[addr]; lo(v) = zmp[addr+1]; }
 #define CODE_WORD(v)      { hi(v) = *pcp++; lo(v) = *pcp++; }
@@ -490,7 +521,7 @@ zword bswap16(zword x);
 /*
  * TODO: make these more efficient (and still correct).
  */
-#define SET_WORD(addr, v)	{ *(zword _huge *)(zmp+(addr))=bswap16(v); }
+#define SET_WORD_RAW(addr, v)	{ *(zword _huge *)(zmp+(addr))=bswap16(v); }
 #define LOW_WORD(addr, v)	{ (v)=bswap16(*(zword _huge *)(zmp+(addr))); }
 #define HIGH_WORD(addr, v)	{ (v)=bswap16(*(zword _huge *)(zmp+(addr))); }
 #define CODE_WORD(v)		{ (v)=bswap16(*(zword _huge *)pcp); pcp+=2; }
@@ -514,7 +545,7 @@ extern zbyte *zmp;
  * struct members.
  *
  */
-#define SET_WORD(addr, v) do {\
+#define SET_WORD_RAW(addr, v) do {\
 	asm les bx,zmp;\
 	asm add bx,addr;\
 	_AX = (v); \
@@ -585,12 +616,45 @@ extern zbyte *zmp;
 /******************************************************************************/
 
 
+/******************************************************************************/
+/* Interpreter registers */
+/******************************************************************************/
+/*
+ * With -DVM_REGISTERS and GCC, the program counter, the stack pointer
+ * and the frame pointer live in callee-saved machine registers for the
+ * whole program instead of in memory, so the opcode handlers don't
+ * reload them on every access. Every file including this header must
+ * be compiled with the same setting.
+ */
+#if defined (VM_REGISTERS) && defined (__GNUC__) && \
+	!defined (AMIGA) && !defined (MSDOS_16BIT)
+#if defined (__m68k__)
+register zbyte *pcp __asm__("a4");
+register zword *sp __asm__("a3");
+register zword *fp __asm__("a2");
+#elif defined (__x86_64__)
+register zbyte *pcp __asm__("r15");
+register zword *sp __asm__("r14");
+register zword *fp __asm__("r13");
+#elif defined (__aarch64__)
+register zbyte *pcp __asm__("x28");
+register zword *sp __asm__("x27");
+register zword *fp __asm__("x26");
+#else
+#undef VM_REGISTERS
+#endif
+#else
+#undef VM_REGISTERS
+#endif
+
 /******************************************************************************/
 /* Macros for neither Amiga nor MSDOS... that is Unix et al. */
 /******************************************************************************/
 #if !defined (AMIGA) && !defined (MSDOS_16BIT)
 
+#ifndef VM_REGISTERS
 extern zbyte *pcp;
+#endif
 extern zbyte *zmp;
 
 #define lo(v)	(v & 0xff)
@@ -601,19 +665,46 @@ extern zbyte *zmp;
 	(zmp[addr+1] & 0xff); }
 #define HIGH_WORD(addr,v) { v = ((zword) ( zmp[addr] & 0xff) << 8) | \
 	(zmp[addr+1] & 0xff); }
+#define SET_WORD_RAW(addr,v)  { zmp[addr] = hi(v); zmp[addr+1] = lo(v); }
+#define CODE_WORD(v)      { v = ((zword) pcp[0] << 8) | pcp[1]; pcp += 2; }
+#elif defined (__GNUC__) && defined (__BYTE_ORDER__) && !defined (__m68k__) \
+	&& !defined (NO_NATIVE_WORDS)
+/*
+ * GCC and Clang know the byte order, so a word is one unaligned 16-bit
+ * access, byte-swapped on little-endian hosts, instead of two byte
+ * loads and a shift.  The 68000 cannot load words from odd addresses
+ * and keeps the byte version below, as does -DNO_NATIVE_WORDS (which
+ * tools/wordbench uses for comparison).
+ */
+#define hi(v)	(v >> 8)
+typedef zword __attribute__ ((aligned (1), may_alias)) zword_unaligned;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BE16(v)	__builtin_bswap16(v)
+#else
+#define BE16(v)	(v)
+#endif
+#define WORD_AT(p)	BE16(*(const zword_unaligned *) (p))
+#define LOW_WORD(addr,v)  { v = WORD_AT(zmp + (addr)); }
+#define HIGH_WORD(addr,v) { v = WORD_AT(zmp + (addr)); }
+#define SET_WORD_RAW(addr,v)  \
+	{ *(zword_unaligned *) (zmp + (addr)) = BE16((zword) (v)); }
+#define CODE_WORD(v)      { v = WORD_AT(pcp); pcp += 2; }
 #else
 #define hi(v)	(v >> 8)
 #define LOW_WORD(addr,v)  { v = ((zword) zmp[addr] << 8) | zmp[addr+1]; }
 #define HIGH_WORD(addr,v) { v = ((zword) zmp[addr] << 8) | zmp[addr+1]; }
+#define SET_WORD_RAW(addr,v)  { zmp[addr] = hi(v); zmp[addr+1] = lo(v); }
+#define CODE_WORD(v)      { v = ((zword) pcp[0] << 8) | pcp[1]; pcp += 2; }
 #endif
 
-#define SET_WORD(addr,v)  { zmp[addr] = hi(v); zmp[addr+1] = lo(v); }
-#define CODE_WORD(v)      { v = ((zword) pcp[0] << 8) | pcp[1]; pcp += 2; }
 #define GET_PC(v)         { v = pcp - zmp; }
 #define SET_PC(v)         { pcp = zmp + v; }
 
 #endif /* !defined (AMIGA) && !defined (MSDOS_16BIT) */
 
+#define SET_WORD(addr,v)  \
+	{ MARK_DIRTY(addr) MARK_DIRTY((addr) + 1) SET_WORD_RAW(addr, v) }
+
 /******************************************************************************/
 /******************************************************************************/
 
@@ -628,10 +719,49 @@ extern enum story story_id;
 extern long story_size;
 
 extern zword stack[STACK_SIZE];
+#ifndef VM_REGISTERS
 extern zword *sp;
 extern zword *fp;
+#endif
 extern zword frame_count;
 
+/*
+ * One record per active routine call, kept apart from the evaluation
+ * stack. The routine's locals still sit on the stack just below its fp.
+ */
+typedef struct {
+	long pc;		/* Return address in the caller */
+	zword *fp;		/* Frame pointer of the caller */
+	zbyte argc;		/* Number of arguments supplied */
+	zbyte type;		/* Call type: 0, 1 or 2, see call() */
+	zbyte count;		/* Number of local variables */
+} frame_t;
+
+extern frame_t frames[FRAME_COUNT];
+
+/*
+ * The global variables in native byte order. Stores go to this copy and
+ * to dynamic memory alike, so memory never lags behind and the copy only
+ * needs reloading (load_globals) when memory is replaced as a whole.
+ * Variable numbers are bytes, hence the cast.
+ */
+extern zword global_vars[256];
+
+#define GET_GLOBAL(n, v)	{ v = global_vars[(zbyte) ((n) - 16)]; }
+#define SET_GLOBAL(n, v)	{\
+	zbyte g_index = (zbyte) ((n) - 16);\
+	zword g_addr = z_header.globals + 2 * g_index;\
+	global_vars[g_index] = (v);\
+	SET_WORD(g_addr, global_vars[g_index])\
+	}
+
+/*
+ * The span of dynamic memory the cached property lookups were built
+ * from (see object.c). A store inside it calls flush_prop_cache.
+ */
+extern zlong prop_watch_low;
+extern zlong prop_watch_high;
+
 extern zword zargs[8];
 extern int zargc;
 
@@ -670,6 +800,93 @@ extern char *zoptarg;
 extern bool spurious_getchar;
 #endif
 
+/*** Instruction decoder shared by the code walkers (decode.c) ***/
+enum { C_2OP, C_1OP, C_0OP, C_VAR, C_EXT };
+
+#define ZI_STORE	0x01	/* has a store variable */
+#define ZI_BRANCH	0x02	/* has a branch */
+#define ZI_ON_TRUE	0x04	/* branch if the condition holds */
+#define ZI_CONTROL	0x08	/* the handler may move the PC */
+#define ZI_TERMINAL	0x10	/* never falls through */
+#define ZI_INDIRECT	0x20	/* first operand names a variable */
+#define ZI_CALL		0x40	/* first operand is the routine called */
+
+typedef struct {
+	long pc;		/* address of the instruction */
+	long end;		/* PC of the store, branch or string bytes */
+	long next;		/* PC of the following instruction */
+	long target;		/* branch or jump target, 0 and 1 return
+				   that value, -1 if none is known */
+	zword args[8];		/* constants, or variable numbers */
+	zbyte types[8];		/* 0 large, 1 small constant, 2 variable */
+	zbyte class;		/* C_* */
+	zbyte num;		/* opcode number within the class */
+	zbyte argc;
+	zbyte store;		/* store variable */
+	zbyte flags;		/* ZI_* */
+} zinsn_t;
+
+void	init_decoder(void);
+bool	decode_insn(long, zinsn_t *);
+
+#ifdef AOT_STORY
+/*** Ahead-of-time translated blocks (aot.c and the zcompile.py output) ***/
+typedef void (*aot_block_t)(void);
+typedef struct {
+	long pc;
+	aot_block_t block;
+} aot_entry_t;
+
+extern const aot_entry_t aot_blocks[];
+extern const int aot_block_count;
+extern const zword aot_release;
+extern const zbyte aot_serial[6];
+extern const zword aot_checksum;
+
+void	aot_init(void);
+aot_block_t aot_lookup(void);
+#endif
+
+/*
+ * -DBLOCK_JIT writes x86-64 machine code, so other hosts build the
+ * plain interpreter from the same flags.
+ */
+#if defined (BLOCK_JIT) && !(defined (__x86_64__) && defined (__GNUC__) \
+	&& defined (__unix__))
+#undef BLOCK_JIT
+#endif
+
+#ifdef BLOCK_JIT
+/*** Hot routines compiled to machine code (jit.c) ***/
+typedef void (*jit_block_t)(void);
+
+void	jit_init(int *);
+jit_block_t jit_lookup(void);
+void	jit_enter(void);
+void	jit_report(void);
+#endif
+
+#ifdef INSN_CACHE
+/*** Pre-decoded instruction tiers (process.c) ***/
+void	insn_report(void);
+#endif
+
+#ifdef VERIFY_STORY
+/*** Load-time code verifier (verify.c) ***/
+void	verify_story(void);
+void	verify_call(zword);
+void	verify_restored(void);
+void	set_trusted_handlers(bool);
+#endif
+
+#ifdef VENEER_ACCEL
+/*** Native Inform veneer routines (accel.c) ***/
+void	accel_init(void);
+bool	accel_call(zword, int, zword *, int);
+void	accel_check(zword);
+void	accel_report(void);
+#endif
+
 /*** Z-machine opcodes ***/
 void 	z_add(void);
 void 	z_and(void);
@@ -681,6 +898,7 @@ void 	z_catch(void);
 void 	z_check_arg_count(void);
 void	z_check_unicode(void);
 void 	z_clear_attr(void);
+void 	z_clear_attr_sherlock(void);
 void 	z_copy_table(void);
 void 	z_dec(void);
 void 	z_dec_chk(void);
@@ -761,6 +979,7 @@ void 	z_save_undo(void);
 void 	z_scan_table(void);
 void 	z_scroll_window(void);
 void 	z_set_attr(void);
+void 	z_set_attr_sherlock(void);
 void 	z_set_font(void);
 void 	z_set_colour(void);
 void 	z_set_cursor(void);
@@ -877,6 +1096,28 @@ void 	branch(bool);
 
 void	storeb(zword, zbyte);
 void	storew(zword, zword);
+bool	store_block(zword, const zbyte *, zword);
+bool	fill_block(zword, zbyte, zword);
+bool	undo_open(long, long);
+void	undo_close(void);
+zbyte huge *undo_push(long);
+zbyte huge *undo_top(void);
+void	undo_pop(void);
+void	undo_usage(int *, long *, long *);
+zword	save_quetzal_mem(zbyte **, long *, FILE *);
+zword	restore_game_mem(const zbyte *, long);
+#ifdef SNAPSHOTS
+bool	snapshot_take(const char *);
+bool	snapshot_restore(const char *);
+long	snapshot_pc(const char *);
+void	snapshot_drop(const char *);
+void	snapshot_reset(void);
+#endif
+#ifdef STATE_HASH
+uint64_t state_hash(void);
+#endif
+void	load_globals(void);
+void	flush_prop_cache(void);
 
 void	end_of_sound(void);
 
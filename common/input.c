@@ -18,16 +18,34 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <string.h>
 #include "frotz.h"
 
 extern int save_undo(void);
 
-extern zchar stream_read_key(zword, zword, bool);
-extern zchar stream_read_input(int, zchar *, zword, zword, bool, bool);
+extern zchar stream_read_key(zword, zword, bool, int);
+extern zchar stream_read_input(int, zchar *, zword, zword, bool, bool, int);
+
+extern void interrupt_call(zword, void (*)(zword));
 
 extern void tokenise_line(zword, zword, zword, bool);
 zword unicode_tolower(zword);
 static bool truncate_question_mark(void);
+static void read_input(int);
+static void resume_read(zword);
+static void read_key(int);
+static void resume_read_char(zword);
+
+/*
+ * The input typed into each read that is waiting for its timeout
+ * routine, innermost last, so that a read in the routine cannot
+ * clobber it. Each is tagged with the frame count of its read.
+ */
+static struct {
+	zchar buffer[INPUT_BUFFER_SIZE];
+	int depth;
+} suspended[INTERRUPT_DEPTH];
+static int suspended_count = 0;
 
 
 /*
@@ -91,7 +109,7 @@ bool read_yes_or_no(const char *s)
 	print_string(s);
 	print_string("? (y/n) >");
 
-	key = stream_read_key(0, 0, FALSE);
+	key = stream_read_key(0, 0, FALSE, -1);
 
 	if (key == 'y' || key == 'Y') {
 		print_string("y\n");
@@ -117,7 +135,7 @@ void read_string (int max, zchar *buffer)
  	buffer[0] = 0;
 
 	do {
-		key = stream_read_input(max, buffer, 0, 0, FALSE, FALSE);
+		key = stream_read_input(max, buffer, 0, 0, FALSE, FALSE, -1);
 	} while (key != ZC_RETURN);
 } /* read_string */
 
@@ -155,7 +173,20 @@ int read_number(void)
  */
 void z_read(void)
 {
-	zchar buffer[INPUT_BUFFER_SIZE];
+	read_input(-1);
+} /* z_read */
+
+
+/*
+ * read_input
+ *
+ * Do the work of z_read. "resumed" is -1 for a new read; otherwise the
+ * read's timeout routine has just returned, true (1) or false (0).
+ *
+ */
+static void read_input(int resumed)
+{
+	static zchar buffer[INPUT_BUFFER_SIZE];
 	zword addr;
 	zchar key;
 	zbyte max, size;
@@ -179,23 +210,36 @@ void z_read(void)
 	if (max >= INPUT_BUFFER_SIZE)
 		max = INPUT_BUFFER_SIZE - 1;
 
-	/* Get initial input size */
-	if (z_header.version >= V5) {
-		addr++;
-		LOW_BYTE(addr, size);
-	} else size = 0;
-
-	/* Copy initial input to local buffer */
-	for (i = 0; i < size; i++) {
-		addr++;
-		LOW_BYTE(addr, c);
-		buffer[i] = translate_from_zscii(c);
-	}
-	buffer[i] = 0;
+	/* A resumed read gets back the input it put aside */
+	if (resumed >= 0) {
+		while (suspended_count > 0
+		       && suspended[suspended_count - 1].depth > frame_count)
+			suspended_count--;
+		if (suspended_count > 0
+		    && suspended[suspended_count - 1].depth == frame_count)
+			memmove(buffer, suspended[--suspended_count].buffer,
+				sizeof(buffer));
+		else
+			buffer[0] = 0;
+	} else {
+		/* Get initial input size */
+		if (z_header.version >= V5) {
+			addr++;
+			LOW_BYTE(addr, size);
+		} else size = 0;
+
+		/* Copy initial input to local buffer */
+		for (i = 0; i < size; i++) {
+			addr++;
+			LOW_BYTE(addr, c);
+			buffer[i] = translate_from_zscii(c);
+		}
+		buffer[i] = 0;
 
-	/* Draw status line for V1 to V3 games */
-	if (z_header.version <= V3)
-		z_show_status();
+		/* Draw status line for V1 to V3 games */
+		if (z_header.version <= V3)
+			z_show_status();
+	}
 
 	/* Read input from current input stream */
 	key = stream_read_input (
@@ -203,7 +247,22 @@ void z_read(void)
 		zargs[2],		/* timeout value   */
 		zargs[3],		/* timeout routine */
 		TRUE,	        	/* enable hot keys */
-		z_header.version == V6);	/* no script in V6 */
+		z_header.version == V6,	/* no script in V6 */
+		resumed);		/* resuming after timeout */
+
+	/* Run the timeout routine; reading carries on when it returns */
+	if (key == ZC_TIME_OUT && resumed <= 0) {
+		while (suspended_count > 0
+		       && suspended[suspended_count - 1].depth >= frame_count)
+			suspended_count--;
+		if (suspended_count == INTERRUPT_DEPTH)
+			runtime_error(ERR_STK_OVF);
+		memmove(suspended[suspended_count].buffer, buffer,
+			sizeof(buffer));
+		suspended[suspended_count++].depth = frame_count;
+		interrupt_call(zargs[3], resume_read);
+		return;
+	}
 
 	if (key == ZC_BAD)
 		return;
@@ -236,7 +295,19 @@ void z_read(void)
 	/* Store key */
 	if (z_header.version >= V5)
 		store(translate_to_zscii (key));
-} /* z_read */
+} /* read_input */
+
+
+/*
+ * resume_read
+ *
+ * Resume a read instruction once its timeout routine has returned.
+ *
+ */
+static void resume_read(zword value)
+{
+	read_input(value != 0);
+} /* resume_read */
 
 
 /*
@@ -250,9 +321,20 @@ void z_read(void)
 
 void z_read_char(void)
 {
-	zchar key;
+	read_key(-1);
+} /* z_read_char */
 
 
+/*
+ * read_key
+ *
+ * Do the work of z_read_char, with "resumed" as for read_input.
+ *
+ */
+static void read_key(int resumed)
+{
+	zchar key;
+
         if (f_setup.err_report_repeat > 0) {
 		runtime_error_repeat(f_setup.err_report_repeat);
 		f_setup.err_report_repeat = 0;
@@ -268,7 +350,14 @@ void z_read_char(void)
 	key = stream_read_key(
 		zargs[1],	/* timeout value   */
 		zargs[2],	/* timeout routine */
-		TRUE);  	/* enable hot keys */
+		TRUE,  		/* enable hot keys */
+		resumed);	/* resuming after timeout */
+
+	/* Run the timeout routine; reading carries on when it returns */
+	if (key == ZC_TIME_OUT && resumed <= 0) {
+		interrupt_call(zargs[2], resume_read_char);
+		return;
+	}
 
 	if (key == ZC_BAD)
 		return;
@@ -282,7 +371,19 @@ void z_read_char(void)
 		store(key);
 	else
 		store(translate_to_zscii (key));
-} /* z_read_char */
+} /* read_key */
+
+
+/*
+ * resume_read_char
+ *
+ * Resume a read_char instruction once its timeout routine has returned.
+ *
+ */
+static void resume_read_char(zword value)
+{
+	read_key(value != 0);
+} /* resume_read_char */
 
 
 /*
@@ -0,0 +1,706 @@
+/* jit.c - Basic-block compiler for x86-64 hosts
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Built with -DBLOCK_JIT on an x86-64 Unix host, call() counts how
+ * often each routine is entered.  Once a routine has been entered
+ * JIT_THRESHOLD times, the basic blocks that can be reached from its
+ * start are taken apart with the shared decoder and turned into
+ * machine code.  The plain interpreter loop looks up every PC it is
+ * about to run and, if a block starts there, calls it instead.
+ *
+ * Arithmetic, table loads, comparisons, jumps and stores into
+ * variables are compiled inline.  Everything else, printing, reading,
+ * saving, calls and the like, is run by calling the usual opcode
+ * handler with zargs filled in and the PC just past the operands, so
+ * the handler reads its store, branch or text bytes as always.  A
+ * block ends at the first instruction that may move the PC.  It also
+ * stops after any handler that sets finished or leaves the PC
+ * somewhere unexpected, which is what z_restore, z_restore_undo and
+ * z_throw do, and hands back to the interpreter with the PC pointing
+ * at the next instruction to run.  Only static memory is compiled, so
+ * the code never goes stale, and saves stay plain Quetzal.
+ *
+ * Setting FROTZ_NO_JIT in the environment turns this off.  Setting
+ * FROTZ_JIT_STATS reports on exit how many instructions ran from
+ * compiled blocks.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frotz.h"
+
+#ifdef BLOCK_JIT
+
+#if defined(THREADED_DISPATCH) || defined(INSN_CACHE) || \
+	defined(AOT_STORY) || defined(OPCODE_PROFILE)
+#error "BLOCK_JIT needs the plain interpreter loop"
+#endif
+
+#include <sys/mman.h>
+
+#ifndef JIT_CODE_SIZE
+#define JIT_CODE_SIZE	0x100000	/* bytes of machine code */
+#endif
+#ifndef JIT_BLOCKS
+#define JIT_BLOCKS	4096	/* blocks looked up, a power of two */
+#endif
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD	32	/* entries before a routine is compiled */
+#endif
+#define JIT_COUNTERS	1024	/* routines counted, a power of two */
+#define JIT_QUEUE	128	/* blocks compiled per routine */
+#define JIT_INSNS	64	/* longest block, instructions */
+#define JIT_ROOM	1024	/* most code one instruction needs */
+
+#define JIT_HASH(pc)	(((pc) ^ ((pc) >> 9)) & (JIT_BLOCKS - 1))
+
+extern void (*op0_opcodes[]) (void);
+extern void (*op1_opcodes[]) (void);
+extern void (*var_opcodes[]) (void);
+
+extern zbyte *zmp;
+
+static struct {
+	long pc;
+	jit_block_t block;
+} jit_table[JIT_BLOCKS];
+
+static struct {
+	long pc;
+	int count;
+} jit_counter[JIT_COUNTERS];
+
+static bool jit_enabled = FALSE;
+static int *jit_finished;
+
+static zbyte *code = NULL;	/* the code buffer */
+static zbyte *emit_p;		/* where the next byte goes */
+static int jit_blocks = 0;
+
+/* Instructions run by the interpreter and from compiled blocks */
+static unsigned long jit_plain = 0;
+static unsigned long jit_native = 0;
+
+/* x86 condition codes; flipping bit 0 negates one */
+enum { CC_E = 0x4, CC_NE = 0x5, CC_L = 0xc, CC_G = 0xf };
+
+
+/*
+ * jit_init
+ *
+ * Get ready to compile hot routines. The main loop's finished flag
+ * is passed in so the compiled code can stop when a handler sets it.
+ *
+ */
+void jit_init(int *finished)
+{
+	int i;
+
+	jit_finished = finished;
+	for (i = 0; i < JIT_BLOCKS; i++)
+		jit_table[i].pc = -1;
+	for (i = 0; i < JIT_COUNTERS; i++)
+		jit_counter[i].pc = -1;
+	jit_blocks = 0;
+
+	jit_enabled = FALSE;
+	if (getenv("FROTZ_NO_JIT") != NULL)
+		return;
+	if (code == NULL) {
+		void *p = mmap(NULL, JIT_CODE_SIZE,
+			PROT_READ | PROT_WRITE | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (p == MAP_FAILED)
+			return;
+		code = p;
+	}
+	emit_p = code;
+	jit_enabled = TRUE;
+} /* jit_init */
+
+
+/*
+ * jit_lookup
+ *
+ * Return the compiled block starting at the PC, or NULL if there is
+ * none and the interpreter runs the instruction.
+ *
+ */
+jit_block_t jit_lookup(void)
+{
+	long pc = pcp - zmp;
+	long h = JIT_HASH(pc);
+
+	if (jit_table[h].pc == pc)
+		return jit_table[h].block;
+	jit_plain++;
+	return NULL;
+} /* jit_lookup */
+
+
+/*
+ * Emitting machine code.  Bytes are written as strings with EMIT, so
+ * each instruction reads the way a disassembler would list it.
+ *
+ */
+#define EMIT(s)	emit((s), sizeof(s) - 1)
+
+static void emit(const char *s, int n)
+{
+	memcpy(emit_p, s, n);
+	emit_p += n;
+} /* emit */
+
+static void emit8(int v)
+{
+	*emit_p++ = (zbyte) v;
+} /* emit8 */
+
+static void emit32(long v)
+{
+	int i;
+
+	for (i = 0; i < 4; i++, v >>= 8)
+		*emit_p++ = (zbyte) v;
+} /* emit32 */
+
+static void emit64(const void *p)
+{
+	unsigned long v = (unsigned long) p;
+	int i;
+
+	for (i = 0; i < 8; i++, v >>= 8)
+		*emit_p++ = (zbyte) v;
+} /* emit64 */
+
+
+/*
+ * emit_jcc
+ *
+ * Emit a conditional jump whose target is filled in by emit_label.
+ *
+ */
+static zbyte *emit_jcc(int cc)
+{
+	emit8(0x0f);
+	emit8(0x80 | cc);
+	emit32(0);
+	return emit_p;
+} /* emit_jcc */
+
+static void emit_label(zbyte *jump)
+{
+	long offset = emit_p - jump;
+	int i;
+
+	for (i = 4; i > 0; i--, offset >>= 8)
+		jump[-i] = (zbyte) offset;
+} /* emit_label */
+
+
+/*
+ * Without -DVM_REGISTERS, the compiled code keeps sp in r14 and fp in
+ * r13 itself, and writes them back around every call to C.  With it,
+ * they are in those registers anyway, and pcp in r15.
+ *
+ */
+static void emit_sync_out(void)
+{
+#ifndef VM_REGISTERS
+	EMIT("\x48\xb8"); emit64(&sp);		/* mov rax, &sp */
+	EMIT("\x4c\x89\x30");			/* mov [rax], r14 */
+#endif
+} /* emit_sync_out */
+
+static void emit_sync_in(void)
+{
+#ifndef VM_REGISTERS
+	EMIT("\x48\xb8"); emit64(&sp);		/* mov rax, &sp */
+	EMIT("\x4c\x8b\x30");			/* mov r14, [rax] */
+	EMIT("\x48\xb8"); emit64(&fp);		/* mov rax, &fp */
+	EMIT("\x4c\x8b\x28");			/* mov r13, [rax] */
+#endif
+} /* emit_sync_in */
+
+static void emit_set_pc(long pc)
+{
+#ifdef VM_REGISTERS
+	EMIT("\x49\xbf"); emit64(zmp + pc);	/* mov r15, zmp + pc */
+#else
+	EMIT("\x48\xb8"); emit64(zmp + pc);	/* mov rax, zmp + pc */
+	EMIT("\x48\xba"); emit64(&pcp);		/* mov rdx, &pcp */
+	EMIT("\x48\x89\x02");			/* mov [rdx], rax */
+#endif
+} /* emit_set_pc */
+
+
+/*
+ * emit_call
+ *
+ * Call a C function, or the one a table slot holds when it is read.
+ *
+ */
+static void emit_call(const void *p, bool slot)
+{
+	emit_sync_out();
+	EMIT("\x48\xb8"); emit64(p);		/* mov rax, p */
+	if (slot)
+		EMIT("\xff\x10");		/* call [rax] */
+	else
+		EMIT("\xff\xd0");		/* call rax */
+	emit_sync_in();
+} /* emit_call */
+
+
+/*
+ * emit_entry, emit_exit
+ *
+ * Set up rbx to point at global_vars, and sp and fp as above; on the
+ * way out count the instructions the block ran and return. Pushing an
+ * odd number of registers keeps the stack 16-byte aligned for calls.
+ *
+ */
+static void emit_entry(void)
+{
+#ifdef VM_REGISTERS
+	EMIT("\x53");				/* push rbx */
+#else
+	EMIT("\x53\x41\x55\x41\x56");		/* push rbx, r13, r14 */
+#endif
+	EMIT("\x48\xbb"); emit64(global_vars);	/* mov rbx, global_vars */
+	emit_sync_in();
+} /* emit_entry */
+
+static void emit_exit(int count)
+{
+	EMIT("\x48\xb8"); emit64(&jit_native);	/* mov rax, &jit_native */
+	EMIT("\x48\x81\x00"); emit32(count);	/* add qword [rax], count */
+	emit_sync_out();
+#ifdef VM_REGISTERS
+	EMIT("\x5b\xc3");			/* pop rbx; ret */
+#else
+	EMIT("\x41\x5e\x41\x5d\x5b\xc3");	/* pop r14, r13, rbx; ret */
+#endif
+} /* emit_exit */
+
+
+/*
+ * emit_operand
+ *
+ * Load operand i into eax (reg 0) or ecx (reg 1), zero-extended.
+ *
+ */
+static void emit_operand(const zinsn_t *in, int i, int reg)
+{
+	zword v = in->args[i];
+
+	if (in->types[i] != 2) {
+		emit8(0xb8 + reg); emit32(v);	/* mov reg, v */
+	} else if (v == 0) {
+		EMIT("\x41\x0f\xb7");		/* movzx reg, [r14] */
+		emit8(0x06 | reg << 3);
+		EMIT("\x49\x83\xc6\x02");	/* add r14, 2 */
+	} else if (v < 16) {
+		EMIT("\x41\x0f\xb7");		/* movzx reg, [r13-2v] */
+		emit8(0x45 | reg << 3);
+		emit8(-2 * v);
+	} else {
+		EMIT("\x0f\xb7");		/* movzx reg, [rbx+g] */
+		emit8(0x83 | reg << 3);
+		emit32(2 * (v - 16));
+	}
+} /* emit_operand */
+
+
+/*
+ * emit_store
+ *
+ * Store ax into a variable, as store() does.
+ *
+ */
+static void emit_store(zbyte variable)
+{
+	zword addr;
+
+	if (variable == 0) {
+		EMIT("\x49\x83\xee\x02");		/* sub r14, 2 */
+		EMIT("\x66\x41\x89\x06");		/* mov [r14], ax */
+	} else if (variable < 16) {
+		EMIT("\x66\x41\x89\x45");		/* mov [r13-2v], ax */
+		emit8(-2 * variable);
+	} else {
+		addr = z_header.globals + 2 * (variable - 16);
+		EMIT("\x66\x89\x83");			/* mov [rbx+g], ax */
+		emit32(2 * (variable - 16));
+		EMIT("\x48\xba");		/* mov rdx, dirty_pages */
+		emit64(dirty_pages);
+		EMIT("\xc6\x82");			/* mov byte [rdx+n], */
+		emit32((addr >> DIRTY_SHIFT) & (DIRTY_PAGES - 1));
+		emit8(DIRTY_ALL);			/* DIRTY_ALL */
+		EMIT("\xc6\x82");
+		emit32(((zword) (addr + 1) >> DIRTY_SHIFT) & (DIRTY_PAGES - 1));
+		emit8(DIRTY_ALL);
+		EMIT("\x66\xc1\xc0\x08");		/* rol ax, 8 */
+		EMIT("\x48\xba");		/* mov rdx, zmp + addr */
+		emit64(zmp + addr);
+		EMIT("\x66\x89\x02");			/* mov [rdx], ax */
+	}
+} /* emit_store */
+
+
+/*
+ * emit_branch
+ *
+ * Finish a block with a branch taken on condition cc: go to the
+ * target, or return 0 or 1, or fall through to the next instruction.
+ *
+ */
+static void emit_branch(const zinsn_t *in, int cc, int count)
+{
+	zbyte *taken;
+
+	if (!(in->flags & ZI_ON_TRUE))
+		cc ^= 1;
+	taken = emit_jcc(cc);
+	emit_set_pc(in->next);
+	emit_exit(count);
+
+	emit_label(taken);
+	if (in->target == 0 || in->target == 1) {
+		emit_set_pc(in->next);
+		EMIT("\xbf"); emit32(in->target);	/* mov edi, target */
+		emit_call(ret, FALSE);
+	} else
+		emit_set_pc(in->target);
+	emit_exit(count);
+} /* emit_branch */
+
+
+/*
+ * emit_load
+ *
+ * Load the word or byte at the address in ax, as loadw and loadb do.
+ *
+ */
+static void emit_load(bool word)
+{
+	EMIT("\x0f\xb7\xc0");			/* movzx eax, ax */
+	EMIT("\x48\xba");			/* mov rdx, zmp */
+	emit64(zmp);
+	if (word) {
+		EMIT("\x0f\xb7\x04\x02");	/* movzx eax, word [rdx+rax] */
+		EMIT("\x66\xc1\xc0\x08");	/* rol ax, 8 */
+	} else
+		EMIT("\x0f\xb6\x04\x02");	/* movzx eax, byte [rdx+rax] */
+} /* emit_load */
+
+
+/* The 2OP opcodes compiled inline, by the handler they stand for */
+static void (*const inline_2op[0x20])(void) = {
+	NULL, z_je, z_jl, z_jg, NULL, NULL, NULL, z_test,
+	z_or, z_and, NULL, NULL, NULL, NULL, NULL, z_loadw,
+	z_loadb, NULL, NULL, NULL, z_add, z_sub, z_mul, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+
+/*
+ * compile_inline
+ *
+ * Compile an instruction without calling its handler, if it is one
+ * of the simple ones and the story has not replaced the handler with
+ * a quirk. Return FALSE to have the handler called instead; otherwise
+ * set *done if the instruction ended the block.
+ *
+ */
+static bool compile_inline(const zinsn_t *in, int count, bool *done)
+{
+	*done = FALSE;
+
+	if (in->class == C_2OP && in->argc == 2) {
+		int cc = -1;
+
+		if (inline_2op[in->num] == NULL ||
+		    var_opcodes[in->num] != inline_2op[in->num])
+			return FALSE;
+
+		emit_operand(in, 0, 0);
+		emit_operand(in, 1, 1);
+		switch (in->num) {
+		case 0x01: cc = CC_E; break;
+		case 0x02: cc = CC_L; break;
+		case 0x03: cc = CC_G; break;
+		case 0x07:
+			EMIT("\x21\xc8");		/* and eax, ecx */
+			cc = CC_E;
+			break;
+		case 0x08: EMIT("\x09\xc8"); break;	/* or eax, ecx */
+		case 0x09: EMIT("\x21\xc8"); break;	/* and eax, ecx */
+		case 0x0f:
+			EMIT("\x8d\x04\x48");	/* lea eax, [rax+rcx*2] */
+			emit_load(TRUE);
+			break;
+		case 0x10:
+			EMIT("\x01\xc8");		/* add eax, ecx */
+			emit_load(FALSE);
+			break;
+		case 0x14: EMIT("\x01\xc8"); break;	/* add eax, ecx */
+		case 0x15: EMIT("\x29\xc8"); break;	/* sub eax, ecx */
+		case 0x16: EMIT("\x0f\xaf\xc1"); break;	/* imul eax, ecx */
+		}
+		if (cc >= 0) {
+			EMIT("\x66\x39\xc8");		/* cmp ax, cx */
+			emit_branch(in, cc, count + 1);
+			*done = TRUE;
+		} else
+			emit_store(in->store);
+		return TRUE;
+	}
+
+	if (in->class == C_1OP) {
+		void (*handler)(void) = op1_opcodes[in->num];
+
+		if (in->num == 0x00 && handler == z_jz) {
+			emit_operand(in, 0, 0);
+			EMIT("\x66\x85\xc0");		/* test ax, ax */
+			emit_branch(in, CC_E, count + 1);
+			*done = TRUE;
+			return TRUE;
+		}
+		if (in->num == 0x0c && handler == z_jump && in->target >= 0) {
+			emit_set_pc(in->target);
+			emit_exit(count + 1);
+			*done = TRUE;
+			return TRUE;
+		}
+		if (((in->num == 0x05 && handler == z_inc) ||
+		     (in->num == 0x06 && handler == z_dec)) &&
+		    in->types[0] != 2 && in->args[0] >= 1 && in->args[0] < 16) {
+			/* add or sub word [r13-2v], 1 */
+			EMIT("\x66\x41\x83");
+			emit8(in->num == 0x05 ? 0x45 : 0x6d);
+			emit8(-2 * in->args[0]);
+			emit8(1);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+} /* compile_inline */
+
+
+/*
+ * compile_handler
+ *
+ * Compile an instruction as a call to its handler. Return TRUE if
+ * the block has to end after it.
+ *
+ */
+static bool compile_handler(const zinsn_t *in, int count)
+{
+	void (**slot)(void);
+	zbyte *skip;
+	int i;
+
+	if (in->class == C_EXT) {
+		/* __extended__ reads the opcode and operands itself */
+		slot = &op0_opcodes[0x0e];
+		emit_set_pc(in->pc + 1);
+	} else {
+		if (in->class == C_2OP)
+			slot = &var_opcodes[in->num];
+		else if (in->class == C_1OP)
+			slot = &op1_opcodes[in->num];
+		else if (in->class == C_0OP)
+			slot = &op0_opcodes[in->num];
+		else
+			slot = &var_opcodes[0x20 + in->num];
+
+		for (i = 0; i < in->argc; i++) {
+			emit_operand(in, i, 0);
+			EMIT("\x48\xba");	/* mov rdx, zargs */
+			emit64(zargs);
+			EMIT("\x66\x89\x42");	/* mov [rdx+2i], ax */
+			emit8(2 * i);
+		}
+		emit_set_pc(in->end);
+	}
+	EMIT("\x48\xba"); emit64(&zargc);	/* mov rdx, &zargc */
+	EMIT("\xc7\x02");			/* mov dword [rdx], argc */
+	emit32(in->class == C_EXT ? 0 : in->argc);
+	emit_call(slot, TRUE);
+
+	if (in->flags & (ZI_CONTROL | ZI_TERMINAL) ||
+	    (in->class == C_EXT && in->num >= 0x1d)) {
+		emit_exit(count + 1);
+		return TRUE;
+	}
+
+	/* Stop if the handler set finished or moved the PC */
+	EMIT("\x48\xb8"); emit64(jit_finished);	/* mov rax, &finished */
+	EMIT("\x83\x38\x00");			/* cmp dword [rax], 0 */
+	skip = emit_jcc(CC_E);
+	emit_exit(count + 1);
+	emit_label(skip);
+
+	EMIT("\x48\xb8");			/* mov rax, zmp + next */
+	emit64(zmp + in->next);
+#ifdef VM_REGISTERS
+	EMIT("\x49\x39\xc7");			/* cmp r15, rax */
+#else
+	EMIT("\x48\xba"); emit64(&pcp);		/* mov rdx, &pcp */
+	EMIT("\x48\x8b\x12");			/* mov rdx, [rdx] */
+	EMIT("\x48\x39\xc2");			/* cmp rdx, rax */
+#endif
+	skip = emit_jcc(CC_E);
+	emit_exit(count + 1);
+	emit_label(skip);
+	return FALSE;
+} /* compile_handler */
+
+
+/*
+ * compile_block
+ *
+ * Compile the basic block starting at pc and enter it in the lookup
+ * table. Add the places it goes on to the queue.
+ *
+ */
+static void compile_block(long pc, long *queue, int *queued)
+{
+	zbyte *start = emit_p;
+	long start_pc = pc;
+	zinsn_t in;
+	bool done = FALSE;
+	int count;
+	long h;
+
+	if (pc < z_header.dynamic_size || pc >= story_size)
+		return;
+	if (emit_p + 2 * JIT_ROOM > code + JIT_CODE_SIZE)
+		return;
+	if (!decode_insn(pc, &in))
+		return;
+
+	emit_entry();
+	for (count = 0; !done; count++) {
+		if (count > 0 && (count == JIT_INSNS ||
+		    emit_p + JIT_ROOM > code + JIT_CODE_SIZE ||
+		    !decode_insn(pc, &in))) {
+			emit_set_pc(pc);
+			emit_exit(count);
+			if (*queued < JIT_QUEUE)
+				queue[(*queued)++] = pc;
+			break;
+		}
+
+		if (!compile_inline(&in, count, &done))
+			done = compile_handler(&in, count);
+		pc = in.next;
+	}
+
+	if (done) {
+		if (in.target > 1 && *queued < JIT_QUEUE)
+			queue[(*queued)++] = in.target;
+		if (!(in.flags & ZI_TERMINAL) &&
+		    !(in.class == C_1OP && in.num == 0x0c) &&
+		    *queued < JIT_QUEUE)
+			queue[(*queued)++] = in.next;
+	}
+
+	h = JIT_HASH(start_pc);
+	jit_table[h].pc = start_pc;
+	jit_table[h].block = (jit_block_t) start;
+	jit_blocks++;
+} /* compile_block */
+
+
+/*
+ * compile_routine
+ *
+ * Compile the blocks that can be reached from the start of a routine
+ * without leaving it, as far as the queue goes.
+ *
+ */
+static void compile_routine(long pc)
+{
+	long queue[JIT_QUEUE];
+	int queued = 0;
+	int i, j;
+
+	queue[queued++] = pc;
+	for (i = 0; i < queued; i++) {
+		pc = queue[i];
+		for (j = 0; j < i; j++)
+			if (queue[j] == pc)
+				break;
+		if (j < i || jit_table[JIT_HASH(pc)].pc == pc)
+			continue;
+		compile_block(pc, queue, &queued);
+	}
+} /* compile_routine */
+
+
+/*
+ * jit_enter
+ *
+ * Count an entry into the routine whose code starts at the PC, and
+ * compile it once it has been entered often enough.
+ *
+ */
+void jit_enter(void)
+{
+	long pc = pcp - zmp;
+	int h = (int) ((pc ^ (pc >> 10)) & (JIT_COUNTERS - 1));
+
+	if (!jit_enabled)
+		return;
+	if (jit_counter[h].pc != pc) {
+		jit_counter[h].pc = pc;
+		jit_counter[h].count = 0;
+	}
+	if (++jit_counter[h].count == JIT_THRESHOLD)
+		compile_routine(pc);
+} /* jit_enter */
+
+
+/*
+ * jit_report
+ *
+ * Tell how much of the story ran from compiled blocks, if asked to.
+ *
+ */
+void jit_report(void)
+{
+	unsigned long total = jit_plain + jit_native;
+
+	if (getenv("FROTZ_JIT_STATS") == NULL || total == 0)
+		return;
+
+	fprintf(stderr, "JIT: %lu of %lu instructions from compiled blocks "
+		"(%lu%%), %d blocks, %ld bytes of code\n", jit_native, total,
+		(unsigned long) (jit_native * 100.0 / total), jit_blocks,
+		(long) (emit_p - code));
+} /* jit_report */
+
+#endif /* BLOCK_JIT */
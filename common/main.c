@@ -36,6 +36,9 @@ extern void init_memory (void);
 extern void init_undo (void);
 extern void reset_screen (void);
 extern void reset_memory (void);
+#ifdef OPCODE_PROFILE
+extern void write_opcode_profile (void);
+#endif
 
 bool need_newline_at_exit = FALSE;
 
@@ -52,9 +55,12 @@ extern z_header_t z_header;
 
 /* Stack data */
 zword stack[STACK_SIZE];
+#ifndef VM_REGISTERS
 zword *sp = 0;
 zword *fp = 0;
+#endif
 zword frame_count = 0;
+frame_t frames[FRAME_COUNT];
 
 /* IO streams */
 bool ostream_screen = TRUE;
@@ -124,6 +130,18 @@ int cdecl main(int argc, char *argv[])
 	init_undo();
 	z_restart();
 	interpret();
+#ifdef OPCODE_PROFILE
+	write_opcode_profile();
+#endif
+#ifdef INSN_CACHE
+	insn_report();
+#endif
+#ifdef BLOCK_JIT
+	jit_report();
+#endif
+#ifdef VENEER_ACCEL
+	accel_report();
+#endif
 	reset_screen();
 	reset_memory();
 	os_reset_screen();
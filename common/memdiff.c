@@ -0,0 +1,208 @@
+/* memdiff.c - XOR and zero-run coding of dynamic memory
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Undo blocks and the Quetzal `CMem' chunk both store dynamic memory
+ * as its XOR with a reference copy: a changed byte is written as is,
+ * and a run of n unchanged bytes as a zero followed by n - 1.  They
+ * differ only in how long a run may be.  Quetzal allows one byte of
+ * length, so runs go up to 0x100; undo blocks take a second byte when
+ * the top bit of the first is set, so runs go up to 0x8000.  A run
+ * at the very end is left out.
+ *
+ * Both encoders look for the next changed byte a machine word at a
+ * time, or sixteen bytes at a time where SSE2 is available, which is
+ * where nearly all the time goes.
+ *
+ */
+
+#include <string.h>
+#include "frotz.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/*
+ * next_change
+ *
+ * Return the offset of the first byte from pos on where a and b
+ * differ, or size if there is none.  If dirty is not NULL, pages it
+ * does not mark DIRTY_UNDO are known to be equal and skipped.  The
+ * SSE2 step starts on a multiple of 16, so it never crosses a page.
+ *
+ */
+static unsigned next_change(const zbyte *a, const zbyte *b, unsigned pos,
+			    unsigned size, const zbyte *dirty)
+{
+	unsigned long x, y;
+
+	while (pos < size) {
+		if (dirty != NULL && (pos & ((1 << DIRTY_SHIFT) - 1)) == 0
+		    && !(dirty[pos >> DIRTY_SHIFT] & DIRTY_UNDO)) {
+			if (size - pos <= 1 << DIRTY_SHIFT)
+				break;
+			pos += 1 << DIRTY_SHIFT;
+			continue;
+		}
+#ifdef __SSE2__
+		if ((pos & 15) == 0 && size - pos >= 16) {
+			__m128i va = _mm_loadu_si128((const __m128i *) (a + pos));
+			__m128i vb = _mm_loadu_si128((const __m128i *) (b + pos));
+			unsigned same = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+
+			if (same == 0xffff) {
+				pos += 16;
+				continue;
+			}
+			return pos + __builtin_ctz(~same);
+		}
+#endif
+		if ((pos & (sizeof(x) - 1)) == 0 && size - pos >= sizeof(x)) {
+			memcpy(&x, a + pos, sizeof(x));
+			memcpy(&y, b + pos, sizeof(y));
+			if (x == y) {
+				pos += sizeof(x);
+				continue;
+			}
+		}
+		if (a[pos] != b[pos])
+			return pos;
+		pos++;
+	}
+	return size;
+} /* next_change */
+
+
+/*
+ * mem_diff
+ *
+ * Set diff to the undo-style difference between a and b, copying a to
+ * b as we go.  Only the pages marked DIRTY_UNDO in dirty_pages are
+ * compared; the marks are cleared afterwards, as a and b then agree.
+ * diff must hold 1.5 * mem_size + 2 bytes.  Return the length of the
+ * diff.
+ *
+ */
+long mem_diff(zbyte *a, zbyte *b, zword mem_size, zbyte *diff)
+{
+	unsigned size = mem_size;
+	unsigned pos = 0;
+	unsigned next;
+	unsigned j;
+	int i;
+	zbyte *p = diff;
+
+	while ((next = next_change(a, b, pos, size, dirty_pages)) < size) {
+		j = next - pos;
+		if (j > 0x8000) {
+			*p++ = 0;
+			*p++ = 0xff;
+			*p++ = 0xff;
+			j -= 0x8000;
+		}
+		if (j > 0) {
+			*p++ = 0;
+			j--;
+			if (j <= 0x7f) {
+				*p++ = j;
+			} else {
+				*p++ = (j & 0x7f) | 0x80;
+				*p++ = (j & 0x7f80) >> 7;
+			}
+		}
+		*p++ = a[next] ^ b[next];
+		b[next] = a[next];
+		pos = next + 1;
+	}
+	for (i = 0; i < DIRTY_PAGES; i++)
+		dirty_pages[i] &= ~DIRTY_UNDO;
+	return p - diff;
+} /* mem_diff */
+
+
+/*
+ * mem_undiff
+ *
+ * Apply an undo-style difference to dest, marking the pages it
+ * changes DIRTY_UNDO in dirty_pages.
+ *
+ */
+void mem_undiff(zbyte *diff, long diff_length, zbyte *dest)
+{
+	zbyte *start = dest;
+	zbyte c;
+
+	while (diff_length) {
+		c = *diff++;
+		diff_length--;
+		if (c == 0) {
+			unsigned runlen;
+
+			if (!diff_length)
+				return;  /* Incomplete run */
+			runlen = *diff++;
+			diff_length--;
+			if (runlen & 0x80) {
+				if (!diff_length)
+					return; /* Incomplete extended run */
+				c = *diff++;
+				diff_length--;
+				runlen = (runlen & 0x7f) | (((unsigned) c) << 7);
+			}
+			dest += runlen + 1;
+		} else {
+			dirty_pages[(dest - start) >> DIRTY_SHIFT] |= DIRTY_UNDO;
+			*dest++ ^= c;
+		}
+ 	}
+} /* mem_undiff */
+
+
+/*
+ * cmem_diff
+ *
+ * Set diff to the contents of a Quetzal `CMem' chunk for memory a
+ * against the original b.  diff must hold 1.5 * mem_size + 2 bytes.
+ * Return the length of the chunk, before any padding.
+ *
+ */
+long cmem_diff(const zbyte *a, const zbyte *b, zword mem_size, zbyte *diff)
+{
+	unsigned size = mem_size;
+	unsigned pos = 0;
+	unsigned next;
+	unsigned j;
+	zbyte *p = diff;
+
+	while ((next = next_change(a, b, pos, size, NULL)) < size) {
+		for (j = next - pos; j > 0x100; j -= 0x100) {
+			*p++ = 0;
+			*p++ = 0xff;
+		}
+		if (j > 0) {
+			*p++ = 0;
+			*p++ = j - 1;
+		}
+		*p++ = a[next] ^ b[next];
+		pos = next + 1;
+	}
+	return p - diff;
+} /* cmem_diff */
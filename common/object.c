@@ -18,24 +18,19 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <string.h>
 #include "frotz.h"
 
 f_setup_t f_setup;
 z_header_t z_header;
 
-#define O1_OBJECTS 255
 #define O1_PARENT 4
 #define O1_SIBLING 5
 #define O1_CHILD 6
-#define O1_PROPERTY_OFFSET 7
-#define O1_SIZE 9
 
-#define O4_OBJECTS 65535
 #define O4_PARENT 6
 #define O4_SIBLING 8
 #define O4_CHILD 10
-#define O4_PROPERTY_OFFSET 12
-#define O4_SIZE 14
 
 
 /*
@@ -63,26 +58,21 @@ static zword object_address(zword obj)
 	bool fatal_error_given = FALSE;
 
 	/* Calculate object address */
-	if (z_header.version <= V3) {
-		if (obj > O1_OBJECTS) { /* Max 255 objects for <= V3 */
+	if (obj > z_variant.max_object) { /* Max 255 objects for <= V3 */
 illegal_obj_addr:
-			print_string("@Attempt to address illegal object ");
-			print_num(obj);
-			print_string(".  This is normally fatal.");
-			reset_window();
-			runtime_error (ERR_ILL_OBJ);
-			fatal_error_given = TRUE;
-		}
-		obj_addr = z_header.objects + ((obj - 1) * O1_SIZE + 62);
-		obj_size = O1_SIZE;
-	} else {
-		obj_addr = z_header.objects + ((obj - 1) * O4_SIZE + 126);
-		obj_size = O4_SIZE;
+		print_string("@Attempt to address illegal object ");
+		print_num(obj);
+		print_string(".  This is normally fatal.");
+		reset_window();
+		runtime_error (ERR_ILL_OBJ);
+		fatal_error_given = TRUE;
 	}
+	obj_size = z_variant.object_size;
+	obj_addr = z_variant.object_base + (obj - 1) * obj_size;
 
 	/* Catch objects that would exist outside of memory limits. */
 	if ((obj_addr + obj_size) >= z_header.dynamic_size) {
-		if (story_id == BEYOND_ZORK) {
+		if (z_variant.lax_objects) {
 			return 0;
 		}
 		/* Avoid an infinite loop when ignoring fatal errors. */
@@ -107,10 +97,7 @@ zword object_name(zword object)
 	obj_addr = object_address(object);
 
 	/* The object name address is found at the start of the properties */
-	if (z_header.version <= V3)
-		obj_addr += O1_PROPERTY_OFFSET;
-	else
-		obj_addr += O4_PROPERTY_OFFSET;
+	obj_addr += z_variant.object_properties;
 	LOW_WORD(obj_addr, name_addr)
 
 	return name_addr;
@@ -156,10 +143,8 @@ static zword next_property(zword prop_addr)
 
 	/* Calculate the length of this property */
 
-	if (z_header.version <= V3)
-		value >>= 5;
-	else if (!(value & 0x80))
-		value >>= 6;
+	if (!(value & z_variant.prop_long_flag))
+		value >>= z_variant.prop_size_shift;
 	else {
 		LOW_BYTE(prop_addr, value)
 		value &= 0x3f;
@@ -171,6 +156,133 @@ static zword next_property(zword prop_addr)
 } /* next_property */
 
 
+/*
+ * Property lookups are cached by object and property number.  An entry
+ * remembers where the scan down the property list stopped and the id
+ * byte found there, whether or not it was the property asked for.
+ * Entries only hold for one generation: storeb() starts a new one when
+ * a write lands in the span of memory the current entries were read
+ * from, i.e. the property pointers in the object table, the name length
+ * bytes and the property size bytes.
+ *
+ */
+#ifndef PROP_CACHE_SIZE
+#define PROP_CACHE_SIZE 512	/* must be a power of two */
+#endif
+
+typedef struct {
+	zword object;
+	zword prop;
+	zword addr;
+	zbyte value;
+	zlong generation;
+} prop_entry_t;
+
+static prop_entry_t prop_cache[PROP_CACHE_SIZE];
+static zlong prop_generation = 1;
+
+zlong prop_watch_low = 0;
+zlong prop_watch_high = 0;
+
+
+/*
+ * flush_prop_cache
+ *
+ * Forget all cached property lookups.
+ *
+ */
+void flush_prop_cache(void)
+{
+	if (++prop_generation == 0) {
+		memset(prop_cache, 0, sizeof(prop_cache));
+		prop_generation = 1;
+	}
+	prop_watch_low = prop_watch_high = 0;
+} /* flush_prop_cache */
+
+
+/*
+ * watch_span
+ *
+ * Add a span of memory a cached lookup depends on to the watched one.
+ *
+ */
+static void watch_span(zlong low, zlong high)
+{
+	if (prop_watch_low == prop_watch_high) {
+		prop_watch_low = low;
+		prop_watch_high = high;
+	} else {
+		if (low < prop_watch_low)
+			prop_watch_low = low;
+		if (high > prop_watch_high)
+			prop_watch_high = high;
+	}
+} /* watch_span */
+
+
+/*
+ * find_property
+ *
+ * Scan down the property list of an object until the id drops to the
+ * given property or below.  Return the address of the size byte where
+ * the scan stopped and the byte itself; the property exists if its id
+ * matches.
+ *
+ */
+static zword find_property(zword obj, zword prop, zbyte *value)
+{
+	prop_entry_t *entry;
+	zlong obj_addr;
+	zword name_addr;
+	zword prop_addr;
+	zbyte mask;
+
+	/* Property id is in bottom five (six) bits */
+	mask = z_variant.prop_id_mask;
+
+	entry = &prop_cache[(obj * 31 + prop) & (PROP_CACHE_SIZE - 1)];
+	if (entry->generation == prop_generation
+	    && entry->object == obj && entry->prop == prop) {
+		*value = entry->value;
+		return entry->addr;
+	}
+
+	/* Load address of first property */
+	prop_addr = first_property(obj);
+
+	/* Scan down the property list */
+	for (;;) {
+		LOW_BYTE(prop_addr, *value)
+		if ((*value & mask) <= prop)
+			break;
+		prop_addr = next_property(prop_addr);
+	}
+
+	/* Only cache objects object_address() takes without complaint */
+	obj_addr = z_variant.object_base + (zlong) (obj - 1) *
+		z_variant.object_size;
+	if (obj == 0 || obj > z_variant.max_object
+	    || obj_addr + z_variant.object_size >= z_header.dynamic_size)
+		return prop_addr;
+
+	obj_addr += z_variant.object_properties;
+	LOW_WORD(obj_addr, name_addr)
+	if (prop_addr < name_addr)	/* ran off the end of memory */
+		return prop_addr;
+	watch_span(obj_addr, obj_addr + 2);
+	watch_span(name_addr, (zlong) prop_addr + 2);
+
+	entry->object = obj;
+	entry->prop = prop;
+	entry->addr = prop_addr;
+	entry->value = *value;
+	entry->generation = prop_generation;
+
+	return prop_addr;
+} /* find_property */
+
+
 /*
  * unlink_object
  *
@@ -276,11 +388,7 @@ void z_clear_attr(void)
 	zword obj_addr;
 	zbyte value;
 
-	if (story_id == SHERLOCK)
-		if (zargs[1] == 48)
-			return;
-
-	if (zargs[1] > ((z_header.version <= V3) ? 31 : 47))
+	if (zargs[1] > z_variant.max_attribute)
 		runtime_error(ERR_ILL_ATTR);
 
 	/* If we are monitoring attribute assignment display a short note */
@@ -309,6 +417,22 @@ void z_clear_attr(void)
 } /* z_clear_attr */
 
 
+/*
+ * z_clear_attr_sherlock, z_clear_attr for "Sherlock".
+ *
+ * Installed by init_memory() instead of z_clear_attr.  The game must
+ * not touch attribute 48, which it uses beyond the V5 limit.
+ *
+ */
+void z_clear_attr_sherlock(void)
+{
+	if (zargs[1] == 48)
+		return;
+
+	z_clear_attr();
+} /* z_clear_attr_sherlock */
+
+
 /*
  * z_jin, branch if the first object is inside the second.
  *
@@ -431,17 +555,15 @@ void z_get_next_prop(void)
 	}
 
 	/* Property id is in bottom five (six) bits */
-	mask = (z_header.version <= V3) ? 0x1f : 0x3f;
+	mask = z_variant.prop_id_mask;
 
-	/* Load address of first property */
-	prop_addr = first_property(zargs[0]);
-
-	if (zargs[1] != 0) {
-		/* Scan down the property list */
-		do {
-			LOW_BYTE(prop_addr, value)
-			prop_addr = next_property(prop_addr);
-		} while ((value & mask) > zargs[1]);
+	if (zargs[1] == 0) {
+		/* Load address of first property */
+		prop_addr = first_property(zargs[0]);
+	} else {
+		/* Find the current property and step past it */
+		prop_addr = find_property(zargs[0], zargs[1], &value);
+		prop_addr = next_property(prop_addr);
 
 		/* Exit if the property does not exist */
 		if ((value & mask) != zargs[1])
@@ -525,24 +647,15 @@ void z_get_prop(void)
 	}
 
 	/* Property id is in bottom five (six) bits */
-	mask = (z_header.version <= V3) ? 0x1f : 0x3f;
+	mask = z_variant.prop_id_mask;
 
-	/* Load address of first property */
-	prop_addr = first_property(zargs[0]);
-
-	/* Scan down the property list */
-	for (;;) {
-		LOW_BYTE(prop_addr, value)
-		if ((value & mask) <= zargs[1])
-			break;
-		prop_addr = next_property(prop_addr);
-	}
+	/* Find the property, or where it would be */
+	prop_addr = find_property(zargs[0], zargs[1], &value);
 
 	if ((value & mask) == zargs[1]) { 	/* property found */
 		/* Load property (byte or word sized) */
 		prop_addr++;
-		if ((z_header.version <= V3 && !(value & 0xe0)) ||
-		    (z_header.version >= V4 && !(value & 0xc0))) {
+		if (!(value & z_variant.prop_word_mask)) {
 			LOW_BYTE(prop_addr, bprop_val)
 			wprop_val = bprop_val;
 		} else
@@ -577,22 +690,14 @@ void z_get_prop_addr(void)
 	}
 
 	/* Property id is in bottom five (six) bits */
-	mask = (z_header.version <= V3) ? 0x1f : 0x3f;
-
-	/* Load address of first property */
-	prop_addr = first_property(zargs[0]);
+	mask = z_variant.prop_id_mask;
 
-	/* Scan down the property list */
-	for (;;) {
-		LOW_BYTE(prop_addr, value)
-		if ((value & mask) <= zargs[1])
-			break;
-		prop_addr = next_property(prop_addr);
-	}
+	/* Find the property, or where it would be */
+	prop_addr = find_property(zargs[0], zargs[1], &value);
 
 	/* Calculate the property address or return zero */
 	if ((value & mask) == zargs[1]) {
-		if (z_header.version >= V4 && (value & 0x80))
+		if (value & z_variant.prop_long_flag)
 			prop_addr++;
 		store ((zword) (prop_addr + 1));
 	} else
@@ -621,10 +726,8 @@ void z_get_prop_len(void)
 	LOW_BYTE(addr, value)
 
 	/* Calculate length of property */
-	if (z_header.version <= V3)
-		value = (value >> 5) + 1;
-	else if (!(value & 0x80))
-		value = (value >> 6) + 1;
+	if (!(value & z_variant.prop_long_flag))
+		value = (value >> z_variant.prop_size_shift) + 1;
 	else {
 		value &= 0x3f;
 		if (value == 0) value = 64;	/* demanded by Spec 1.0 */
@@ -756,7 +859,7 @@ void z_insert_obj(void)
 void z_put_prop(void)
 {
 	zword prop_addr;
-	zword value;
+	zbyte value;
 	zbyte mask;
 
 	if (zargs[0] == 0) {
@@ -765,28 +868,22 @@ void z_put_prop(void)
 	}
 
 	/* Property id is in bottom five or six bits */
-	mask = (z_header.version <= V3) ? 0x1f : 0x3f;
+	mask = z_variant.prop_id_mask;
 
-	/* Load address of first property */
-	prop_addr = first_property(zargs[0]);
-
-	/* Scan down the property list */
-	for (;;) {
-		LOW_BYTE(prop_addr, value)
-		if ((value & mask) <= zargs[1])
-			break;
-		prop_addr = next_property (prop_addr);
-	}
+	/* Find the property, or where it would be */
+	prop_addr = find_property(zargs[0], zargs[1], &value);
 
 	/* Exit if the property does not exist */
-	if ((value & mask) != zargs[1])
+	if ((value & mask) != zargs[1]) {
 		runtime_error(ERR_NO_PROP);
+		/* Carrying on may overwrite a size byte */
+		flush_prop_cache();
+	}
 
 	/* Store the new property value (byte or word sized) */
 	prop_addr++;
 
-	if ((z_header.version <= V3 && !(value & 0xe0)) ||
-	    (z_header.version >= V4 && !(value & 0xc0))) {
+	if (!(value & z_variant.prop_word_mask)) {
 		zbyte v = zargs[2];
 		SET_BYTE(prop_addr, v)
 	} else {
@@ -829,11 +926,7 @@ void z_set_attr(void)
     zword obj_addr;
     zbyte value;
 
-	if (story_id == SHERLOCK)
-		if (zargs[1] == 48)
-			return;
-
-	if (zargs[1] > ((z_header.version <= V3) ? 31 : 47))
+	if (zargs[1] > z_variant.max_attribute)
 		runtime_error(ERR_ILL_ATTR);
 
 	/* If we are monitoring attribute assignment display a short note */
@@ -865,6 +958,22 @@ void z_set_attr(void)
 } /* z_set_attr */
 
 
+/*
+ * z_set_attr_sherlock, z_set_attr for "Sherlock".
+ *
+ * Installed by init_memory() instead of z_set_attr; see
+ * z_clear_attr_sherlock.
+ *
+ */
+void z_set_attr_sherlock(void)
+{
+	if (zargs[1] == 48)
+		return;
+
+	z_set_attr();
+} /* z_set_attr_sherlock */
+
+
 /*
  * z_test_attr, branch if an object attribute is set.
  *
@@ -877,7 +986,7 @@ void z_test_attr(void)
 	zword obj_addr;
 	zbyte value;
 
-	if (zargs[1] > ((z_header.version <= V3) ? 31 : 47))
+	if (zargs[1] > z_variant.max_attribute)
 		runtime_error(ERR_ILL_ATTR);
 
 	/* If we are monitoring attribute testing display a short note */
@@ -18,19 +18,116 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <stdlib.h>
 #include "frotz.h"
 
 #ifdef DJGPP
 #include "djfrotz.h"
 #endif
 
+/*
+ * The instruction cache has a loop of its own, which takes the place
+ * of the threaded loop when both are asked for.
+ *
+ */
+#if defined(INSN_CACHE) && defined(THREADED_DISPATCH)
+#undef THREADED_DISPATCH
+#endif
+
+/*
+ * Superinstructions. The threaded loop can run some frequent opcode
+ * pairs as one unit; FUSION_SET selects which ones. Build with
+ * -DOPCODE_PROFILE to collect the opcode pair histogram that tells
+ * which pairs are worth fusing for a given set of stories, or with
+ * -DNO_FUSION to compare against the unfused loop.
+ *
+ */
+#define FUSE_LOADW_BRANCH	0x01	/* loadw -> sp; jz sp / je sp,x */
+#define FUSE_LOADB_BRANCH	0x02	/* loadb -> sp; jz sp / je sp,x */
+#define FUSE_GET_PROP_JZ	0x04	/* get_prop -> sp; jz sp */
+#define FUSE_RET_POPPED		0x08	/* return into call -> sp; ret_popped */
+#define FUSE_LOADB_STOREB	0x10	/* loadb -> sp; storeb */
+
+#if defined(THREADED_DISPATCH) && !defined(INSN_CACHE) && !defined(NO_FUSION) && !defined(TOPS20)
+#ifndef FUSION_SET
+#define FUSION_SET (FUSE_LOADW_BRANCH | FUSE_LOADB_BRANCH | FUSE_GET_PROP_JZ | \
+		FUSE_RET_POPPED | FUSE_LOADB_STOREB)
+#endif
+#else
+#undef FUSION_SET
+#define FUSION_SET 0
+#endif
+
+#if defined(OPCODE_PROFILE) && (defined(THREADED_DISPATCH) || defined(INSN_CACHE))
+#error "OPCODE_PROFILE needs the plain interpreter loop"
+#endif
+
 zword zargs[8];
 int zargc;
 
+/* Set to stop the main loop, for good or to start interrupt routines */
 static int finished = 0;
 
+#define FINISHED_INTERRUPT	1
+#define FINISHED_QUIT		2
+#define FINISHED_RETURN		3	/* from a nested interrupt routine */
+
+/*
+ * Interrupt routines started by interrupt_call() or interrupt_run(),
+ * oldest first. Those still waiting for the current instruction to
+ * finish are on top and have depth 0; each of the others runs in the
+ * frame at its depth.
+ *
+ */
+typedef struct {
+	zword routine;
+	void (*resume) (zword);
+	zword zargs[8];
+	int zargc;
+	zword depth;
+	bool nested;		/* run by interrupt_run() */
+} interrupt_t;
+
+static interrupt_t interrupts[INTERRUPT_DEPTH];
+static int interrupt_count = 0;
+int interrupts_pending = 0;
+
+void call(zword, int, zword *, int);
+static void interpret_loop(void);
+static void end_interrupt(zword);
+
+/*
+ * Routine headers seen by call(), keyed by packed address. Only
+ * headers in static memory are kept, so nothing ever goes stale.
+ * Build with -DROUTINE_CACHE_SIZE=0 to go without.
+ *
+ */
+#ifndef ROUTINE_CACHE_SIZE
+#define ROUTINE_CACHE_SIZE 128	/* a power of two */
+#endif
+
+#if ROUTINE_CACHE_SIZE
+typedef struct {
+	zword routine;		/* packed address */
+	zbyte count;		/* number of locals */
+	long pc;		/* first instruction, 0 if unused */
+	zword defaults[15];	/* initial values of the locals */
+} routine_t;
+
+static routine_t routine_cache[ROUTINE_CACHE_SIZE];
+#endif
+
 static void __extended__(void);
 static void __illegal__(void);
+#ifdef INSN_CACHE
+static void init_insn_cache(void);
+static void hot_enter(void);
+#else
+static void init_op2_fast(void);
+#endif
+#ifdef THREADED_DISPATCH
+static void init_op_forms(void);
+#endif
 
 void (*op0_opcodes[0x10])(void) = {
 	z_rtrue,
@@ -170,98 +267,1450 @@ void (*ext_opcodes[0x1d])(void) = {
 };
 
 
-#ifndef NO_SCRIPT
-extern void script_open (bool);
-#endif
+#ifndef NO_SCRIPT
+extern void script_open (bool);
+#endif
+
+#ifdef OPCODE_PROFILE
+/*
+ * Opcode pair histogram. Opcodes are counted by their number within
+ * each operand count class (so all forms of loadw count as 2OP:15).
+ *
+ */
+#define PROF_2OP 0x00
+#define PROF_1OP 0x20
+#define PROF_0OP 0x30
+#define PROF_VAR 0x40
+#define PROF_EXT 0x60
+#define PROF_KEYS 0x80
+
+static unsigned long pair_count[PROF_KEYS][PROF_KEYS];
+static int last_key = -1;
+
+
+/*
+ * count_opcode
+ *
+ * Count the instruction about to be executed against the previous one.
+ *
+ */
+static void count_opcode(zbyte opcode)
+{
+	int key;
+
+	if (opcode < 0x80)
+		key = PROF_2OP + (opcode & 0x1f);
+	else if (opcode < 0xb0)
+		key = PROF_1OP + (opcode & 0x0f);
+	else if (opcode == 0xbe && z_header.version >= V5)
+		key = PROF_EXT + ((*pcp < 0x1f) ? *pcp : 0x1f);
+	else if (opcode < 0xc0)
+		key = PROF_0OP + (opcode - 0xb0);
+	else if (opcode < 0xe0)
+		key = PROF_2OP + (opcode & 0x1f);
+	else
+		key = PROF_VAR + (opcode - 0xe0);
+
+	if (last_key >= 0)
+		pair_count[last_key][key]++;
+	last_key = key;
+} /* count_opcode */
+
+
+/*
+ * opcode_name
+ *
+ * Give the Standard's name for an opcode key, such as "2OP:15".
+ *
+ */
+static const char *opcode_name(int key)
+{
+	static char name[2][10];
+	static int which = 0;
+	const char *class;
+	int base;
+
+	if (key >= PROF_EXT) {
+		class = "EXT"; base = PROF_EXT;
+	} else if (key >= PROF_VAR) {
+		class = "VAR"; base = PROF_VAR;
+	} else if (key >= PROF_0OP) {
+		class = "0OP"; base = PROF_0OP;
+	} else if (key >= PROF_1OP) {
+		class = "1OP"; base = PROF_1OP;
+	} else {
+		class = "2OP"; base = PROF_2OP;
+	}
+	which ^= 1;
+	sprintf(name[which], "%s:%d", class, key - base);
+	return name[which];
+} /* opcode_name */
+
+
+/*
+ * write_opcode_profile
+ *
+ * Print the most frequent opcode pairs and the superinstruction set
+ * they suggest for FUSION_SET.
+ *
+ */
+void write_opcode_profile(void)
+{
+	static const int returns[] = {
+		PROF_0OP + 0, PROF_0OP + 1, PROF_0OP + 3, PROF_0OP + 8,
+		PROF_1OP + 11
+	};
+	unsigned long total = 0;
+	unsigned long fused[5];
+	unsigned long best;
+	int shown, i, j, bi, bj;
+	int suggest = 0;
+
+	for (i = 0; i < PROF_KEYS; i++)
+		for (j = 0; j < PROF_KEYS; j++)
+			total += pair_count[i][j];
+	if (total == 0)
+		return;
+
+	fused[0] = pair_count[PROF_2OP + 15][PROF_1OP + 0] +
+		pair_count[PROF_2OP + 15][PROF_2OP + 1];
+	fused[1] = pair_count[PROF_2OP + 16][PROF_1OP + 0] +
+		pair_count[PROF_2OP + 16][PROF_2OP + 1];
+	fused[2] = pair_count[PROF_2OP + 17][PROF_1OP + 0];
+	fused[3] = 0;
+	for (i = 0; i < (int) (sizeof(returns) / sizeof(returns[0])); i++)
+		fused[3] += pair_count[returns[i]][PROF_0OP + 8];
+	fused[4] = pair_count[PROF_2OP + 16][PROF_VAR + 2];
+
+	fprintf(stderr, "Opcode pairs executed: %lu\n", total);
+	for (shown = 0; shown < 32; shown++) {
+		best = 0;
+		bi = bj = 0;
+		for (i = 0; i < PROF_KEYS; i++) {
+			for (j = 0; j < PROF_KEYS; j++) {
+				if (pair_count[i][j] > best) {
+					best = pair_count[i][j];
+					bi = i;
+					bj = j;
+				}
+			}
+		}
+		if (best == 0)
+			break;
+		fprintf(stderr, "%10lu  %-7s %s\n", best,
+			opcode_name(bi), opcode_name(bj));
+		pair_count[bi][bj] = 0;
+	}
+
+	/* Suggest every superinstruction covering 0.1% of all pairs */
+	for (i = 0; i < 5; i++) {
+		fprintf(stderr, "Fusion 0x%02x covers %lu pairs\n", 1 << i, fused[i]);
+		if (fused[i] * 1000 >= total)
+			suggest |= 1 << i;
+	}
+	fprintf(stderr, "Suggested: -DFUSION_SET=0x%02x\n", suggest);
+} /* write_opcode_profile */
+#endif /* OPCODE_PROFILE */
+
+/*
+ * init_process
+ *
+ * Initialize process variables.
+ *
+ */
+void init_process(void)
+{
+	finished = 0;
+	init_decoder();
+#ifdef INSN_CACHE
+	init_insn_cache();
+#else
+	init_op2_fast();
+#endif
+#ifdef THREADED_DISPATCH
+	init_op_forms();
+#endif
+#ifdef AOT_STORY
+	aot_init();
+#endif
+#ifdef BLOCK_JIT
+	jit_init(&finished);
+#endif
+#ifdef VENEER_ACCEL
+	accel_init();
+#endif
+#ifdef VERIFY_STORY
+	verify_story();
+#endif
+} /* init_process */
+
+
+/*
+ * fetch_variable
+ *
+ * Read the value of a variable operand.
+ *
+ */
+static zword fetch_variable(zbyte variable)
+{
+	zword value;
+
+	if (variable == 0)
+		value = *sp++;
+	else if (variable < 16)
+		value = *(fp - variable);
+	else {
+		GET_GLOBAL(variable, value)
+	}
+	return value;
+} /* fetch_variable */
+
+
+/*
+ * load_operand
+ *
+ * Load an operand, either a variable or a constant.
+ *
+ */
+static void load_operand(zbyte type)
+{
+	zword value;
+
+	if (type & 2) {		/* variable */
+		zbyte variable;
+
+		CODE_BYTE(variable)
+		value = fetch_variable(variable);
+	} else if (type & 1) {	/* small constant */
+		zbyte bvalue;
+
+		CODE_BYTE(bvalue)
+		value = bvalue;
+	} else
+		CODE_WORD(value)	/* large constant */
+	zargs[zargc++] = value;
+} /* load_operand */
+
+
+/*
+ * Fast 2OP handlers.  A long-form 2OP instruction always has exactly
+ * two operands, so the commonest ones take them in a small struct
+ * passed by value, which travels in a register, rather than through
+ * zargs and zargc in memory.  Entries left NULL go the usual way.
+ * The cache loop carries these opcodes out from its records instead.
+ *
+ */
+#ifndef INSN_CACHE
+typedef struct {
+	zword a;
+	zword b;
+} zop2_t;
+
+static void (*op2_fast[0x20])(zop2_t);
+
+#ifndef TOPS20
+static void op2_je(zop2_t op)
+{
+	branch(op.a == op.b);
+} /* op2_je */
+
+static void op2_jl(zop2_t op)
+{
+	branch((short) op.a < (short) op.b);
+} /* op2_jl */
+
+static void op2_jg(zop2_t op)
+{
+	branch((short) op.a > (short) op.b);
+} /* op2_jg */
+
+static void op2_test(zop2_t op)
+{
+	branch((op.a & op.b) == op.b);
+} /* op2_test */
+
+static void op2_or(zop2_t op)
+{
+	store((zword) (op.a | op.b));
+} /* op2_or */
+
+static void op2_and(zop2_t op)
+{
+	store((zword) (op.a & op.b));
+} /* op2_and */
+
+static void op2_loadw(zop2_t op)
+{
+	zword addr = op.a + 2 * op.b;
+	zword value;
+
+	LOW_WORD(addr, value)
+	store(value);
+} /* op2_loadw */
+
+static void op2_loadb(zop2_t op)
+{
+	zword addr = op.a + op.b;
+	zbyte value;
+
+	LOW_BYTE(addr, value)
+	store(value);
+} /* op2_loadb */
+
+static void op2_add(zop2_t op)
+{
+	store((zword) ((short) op.a + (short) op.b));
+} /* op2_add */
+
+static void op2_sub(zop2_t op)
+{
+	store((zword) ((short) op.a - (short) op.b));
+} /* op2_sub */
+#endif /* TOPS20 */
+
+
+/*
+ * init_op2_fast
+ *
+ * Fill in the fast 2OP handlers.  An opcode whose handler in
+ * var_opcodes was replaced by a story quirk keeps the replacement.
+ *
+ */
+static void init_op2_fast(void)
+{
+#ifndef TOPS20
+	static const struct {
+		zbyte opcode;
+		void (*plain)(void);
+		void (*fast)(zop2_t);
+	} hot[] = {
+		{ 0x01, z_je, op2_je },
+		{ 0x02, z_jl, op2_jl },
+		{ 0x03, z_jg, op2_jg },
+		{ 0x07, z_test, op2_test },
+		{ 0x08, z_or, op2_or },
+		{ 0x09, z_and, op2_and },
+		{ 0x0f, z_loadw, op2_loadw },
+		{ 0x10, z_loadb, op2_loadb },
+		{ 0x14, z_add, op2_add },
+		{ 0x15, z_sub, op2_sub }
+	};
+	int i;
+
+	for (i = 0; i < (int) (sizeof(hot) / sizeof(hot[0])); i++)
+		if (var_opcodes[hot[i].opcode] == hot[i].plain)
+			op2_fast[hot[i].opcode] = hot[i].fast;
+#endif
+} /* init_op2_fast */
+
+
+/*
+ * run_2op
+ *
+ * Run a long-form 2OP instruction whose operands have been fetched.
+ *
+ */
+static void run_2op(zbyte opcode, zword a, zword b)
+{
+	void (*fast)(zop2_t) = op2_fast[opcode & 0x1f];
+	zop2_t op;
+
+	if (fast != NULL) {
+		op.a = a;
+		op.b = b;
+		fast(op);
+	} else {
+		zargs[0] = a;
+		zargs[1] = b;
+		zargc = 2;
+		var_opcodes[opcode & 0x1f] ();
+	}
+} /* run_2op */
+#endif /* INSN_CACHE */
+
+
+/*
+ * load_all_operands
+ *
+ * Given the operand specifier byte, load all (up to four) operands
+ * for a VAR or EXT opcode.
+ *
+ */
+static void load_all_operands(zbyte specifier)
+{
+	int i;
+
+	for (i = 6; i >= 0; i -= 2) {
+		zbyte type = (specifier >> i) & 0x03;
+
+		if (type == 3)
+			break;
+		load_operand(type);
+	}
+} /* load_all_operands */
+
+
+#ifdef THREADED_DISPATCH
+/*
+ * Instruction forms, indexed by the opcode byte. Each form knows how
+ * to fetch its own operands, so the threaded loop can go straight
+ * from one instruction to the next without the generic decoder.
+ *
+ */
+enum {
+	F_2OP_SS,	/* 2OP, small constant, small constant */
+	F_2OP_SV,	/* 2OP, small constant, variable */
+	F_2OP_VS,	/* 2OP, variable, small constant */
+	F_2OP_VV,	/* 2OP, variable, variable */
+	F_1OP_L,	/* 1OP, large constant */
+	F_1OP_S,	/* 1OP, small constant */
+	F_1OP_V,	/* 1OP, variable */
+	F_0OP,		/* 0OP */
+	F_VAR,		/* VAR, one specifier byte */
+	F_VAR8,		/* VAR, two specifier bytes (call_vs2, call_vn2) */
+	F_LOADW,	/* 2OP loadw, any operand types (fused) */
+	F_LOADB,	/* 2OP loadb, any operand types (fused) */
+	F_GET_PROP	/* 2OP get_prop, any operand types (fused) */
+};
+
+static zbyte op_form[0x100];
+
+
+/*
+ * init_op_forms
+ *
+ * Fill in the opcode to instruction form table.
+ *
+ */
+static void init_op_forms(void)
+{
+	int i;
+
+	for (i = 0; i < 0x100; i++) {
+		if (i < 0x80)
+			op_form[i] = F_2OP_SS + (i >> 5);
+		else if (i < 0xb0)
+			op_form[i] = F_1OP_L + ((i >> 4) & 3);
+		else if (i < 0xc0)
+			op_form[i] = F_0OP;
+		else
+			op_form[i] = F_VAR;
+	}
+	op_form[0xec] = F_VAR8;
+	op_form[0xfa] = F_VAR8;
+
+	for (i = 0; i < 0x80; i += 0x20) {
+		if (FUSION_SET & FUSE_LOADW_BRANCH)
+			op_form[i + 0x0f] = F_LOADW;
+		if (FUSION_SET & (FUSE_LOADB_BRANCH | FUSE_LOADB_STOREB))
+			op_form[i + 0x10] = F_LOADB;
+		if (FUSION_SET & FUSE_GET_PROP_JZ)
+			op_form[i + 0x11] = F_GET_PROP;
+	}
+} /* init_op_forms */
+
+
+/*
+ * fetch_2op_operands
+ *
+ * Load both operands of a long form 2OP instruction.
+ *
+ */
+static void fetch_2op_operands(zbyte opcode)
+{
+	zbyte b;
+
+	CODE_BYTE(b)
+	zargs[0] = (opcode & 0x40) ? fetch_variable(b) : b;
+	CODE_BYTE(b)
+	zargs[1] = (opcode & 0x20) ? fetch_variable(b) : b;
+	zargc = 2;
+} /* fetch_2op_operands */
+
+
+/*
+ * fuse_stack_branch
+ *
+ * Called with the PC on the store byte of an instruction whose result
+ * is value. If the result goes to the stack and the next instruction
+ * is "jz sp" or "je sp,x", run both at once without pushing and
+ * popping the value, and return TRUE. Otherwise do nothing.
+ *
+ */
+static bool fuse_stack_branch(zword value)
+{
+	zbyte b;
+
+	if (pcp[0] != 0 || pcp[2] != 0)
+		return FALSE;
+
+	switch (pcp[1]) {
+	case 0xa0:	/* jz sp */
+		pcp += 3;
+		zargs[0] = value;
+		zargc = 1;
+		op1_opcodes[0x00] ();
+		return TRUE;
+	case 0x41:	/* je sp,small */
+	case 0x61:	/* je sp,var */
+		b = pcp[1];
+		pcp += 3;
+		zargs[0] = value;
+		zargs[1] = (b & 0x20) ? fetch_variable(*pcp++) : *pcp++;
+		zargc = 2;
+		var_opcodes[0x01] ();
+		return TRUE;
+	}
+	return FALSE;
+} /* fuse_stack_branch */
+
+
+#if defined(DJGPP) && !defined(NO_SOUND)
+#define CHECK_END_OF_SOUND() { if (end_of_sound_flag) end_of_sound(); }
+#else
+#define CHECK_END_OF_SOUND()
+#endif
+
+/*
+ * With GCC the end of every form jumps directly through the label
+ * table for the next opcode; other compilers go round a switch.
+ *
+ */
+#ifdef __GNUC__
+#define FORM(f)		L_##f:
+#define DISPATCH()	{ CODE_BYTE(opcode) goto *form_labels[op_form[opcode]]; }
+#else
+#define FORM(f)		case f:
+#define DISPATCH()	goto next_opcode;
+#endif
+
+#define NEXT() {\
+	CHECK_END_OF_SOUND()\
+	os_tick();\
+	if (finished != 0)\
+		return;\
+	DISPATCH()\
+	}
+
+
+/*
+ * interpret_threaded
+ *
+ * Threaded version of the main loop. Semantics are identical to the
+ * plain loop in interpret().
+ *
+ */
+static void interpret_threaded(void)
+{
+	zbyte opcode;
+	zbyte b;
+	zword a;
+#ifdef __GNUC__
+	static void *const form_labels[] = {
+		&&L_F_2OP_SS, &&L_F_2OP_SV, &&L_F_2OP_VS, &&L_F_2OP_VV,
+		&&L_F_1OP_L, &&L_F_1OP_S, &&L_F_1OP_V,
+		&&L_F_0OP, &&L_F_VAR, &&L_F_VAR8,
+		&&L_F_LOADW, &&L_F_LOADB, &&L_F_GET_PROP
+	};
+
+	DISPATCH()
+#else
+next_opcode:
+	CODE_BYTE(opcode)
+	switch (op_form[opcode]) {
+#endif
+	FORM(F_2OP_SS)
+		CODE_BYTE(b) a = b;
+		CODE_BYTE(b)
+		run_2op(opcode, a, b);
+		NEXT()
+	FORM(F_2OP_SV)
+		CODE_BYTE(b) a = b;
+		CODE_BYTE(b)
+		run_2op(opcode, a, fetch_variable(b));
+		NEXT()
+	FORM(F_2OP_VS)
+		CODE_BYTE(b) a = fetch_variable(b);
+		CODE_BYTE(b)
+		run_2op(opcode, a, b);
+		NEXT()
+	FORM(F_2OP_VV)
+		CODE_BYTE(b) a = fetch_variable(b);
+		CODE_BYTE(b)
+		run_2op(opcode, a, fetch_variable(b));
+		NEXT()
+	FORM(F_1OP_L)
+		CODE_WORD(zargs[0])
+		zargc = 1;
+		op1_opcodes[opcode & 0x0f] ();
+		NEXT()
+	FORM(F_1OP_S)
+		CODE_BYTE(b) zargs[0] = b;
+		zargc = 1;
+		op1_opcodes[opcode & 0x0f] ();
+		NEXT()
+	FORM(F_1OP_V)
+		CODE_BYTE(b) zargs[0] = fetch_variable(b);
+		zargc = 1;
+		op1_opcodes[opcode & 0x0f] ();
+		NEXT()
+	FORM(F_0OP)
+		zargc = 0;
+		op0_opcodes[opcode - 0xb0] ();
+		NEXT()
+	FORM(F_VAR)
+		zargc = 0;
+		CODE_BYTE(b)
+		load_all_operands(b);
+		var_opcodes[opcode - 0xc0] ();
+		NEXT()
+	FORM(F_VAR8)
+		{
+			zbyte specifier2;
+
+			zargc = 0;
+			CODE_BYTE(b)
+			CODE_BYTE(specifier2)
+			load_all_operands(b);
+			load_all_operands(specifier2);
+		}
+		var_opcodes[opcode - 0xc0] ();
+		NEXT()
+	FORM(F_LOADW)
+		fetch_2op_operands(opcode);
+		{
+			zword addr = zargs[0] + 2 * zargs[1];
+			zword value;
+
+			LOW_WORD(addr, value)
+			if (!fuse_stack_branch(value))
+				store(value);
+		}
+		NEXT()
+	FORM(F_LOADB)
+		fetch_2op_operands(opcode);
+		{
+			zword addr = zargs[0] + zargs[1];
+			zbyte value;
+
+			LOW_BYTE(addr, value)
+			if ((FUSION_SET & FUSE_LOADB_STOREB) &&
+			    pcp[0] == 0 && pcp[1] == 0xe2) {
+				zbyte specifier;
+
+				*--sp = value;
+				pcp += 2;
+				CODE_BYTE(specifier)
+				zargc = 0;
+				load_all_operands(specifier);
+				var_opcodes[0x22] ();
+			} else if (!(FUSION_SET & FUSE_LOADB_BRANCH) ||
+			    !fuse_stack_branch(value))
+				store(value);
+		}
+		NEXT()
+	FORM(F_GET_PROP)
+		fetch_2op_operands(opcode);
+		if (pcp[0] == 0 && pcp[1] == 0xa0 && pcp[2] == 0) {
+			z_get_prop();	/* pushes, PC now on the jz */
+			pcp += 2;
+			zargs[0] = *sp++;
+			zargc = 1;
+			op1_opcodes[0x00] ();
+		} else
+			z_get_prop();
+		NEXT()
+#ifndef __GNUC__
+	}
+#endif
+} /* interpret_threaded */
+
+#undef FORM
+#undef DISPATCH
+#undef NEXT
+#endif /* THREADED_DISPATCH */
+
+
+#ifdef INSN_CACHE
+/*
+ * Pre-decoded instructions. Code in static memory cannot change, so
+ * each instruction there is decoded once into a record holding its
+ * operands, store variable and branch target; afterwards it runs
+ * straight from the record. Common arithmetic, memory and control
+ * opcodes are carried out directly; the rest go to the usual handlers
+ * with the PC just past the operands, where they expect it.
+ *
+ * Records come in two tiers. Cold records sit in a direct-mapped
+ * cache and are looked up one instruction at a time. call() counts
+ * how often each routine is entered, and the loop counts backward
+ * jumps to each loop head; once either has been entered
+ * INSN_HOT_THRESHOLD times, the basic blocks reachable from it are
+ * decoded into a pool that is never evicted. The loop then runs a whole block
+ * from the pool without a lookup between its instructions. Every
+ * block leaves the PC at the next instruction, so restore, throw and
+ * the like simply end the block.
+ *
+ * Setting FROTZ_NO_HOT in the environment keeps every routine cold,
+ * and FROTZ_INSN_STATS reports at exit how many instructions ran
+ * from hot blocks.
+ *
+ */
+#ifndef INSN_CACHE_SIZE
+#define INSN_CACHE_SIZE 2048	/* must be a power of two */
+#endif
+#ifndef INSN_HOT_THRESHOLD
+#define INSN_HOT_THRESHOLD 32	/* routine entries before a routine is hot */
+#endif
+#ifndef INSN_HOT_SIZE
+#define INSN_HOT_SIZE	4096	/* records in the hot pool */
+#endif
+#ifndef INSN_HOT_BLOCKS
+#define INSN_HOT_BLOCKS	2048	/* block table size, a power of two */
+#endif
+#define HOT_COUNTERS	256	/* routine entry counters */
+#define HOT_BLOCK_LEN	64	/* longest straight-line block */
+#define HOT_WORK	64	/* pending block starts per routine */
+
+/* What to do with an instruction */
+enum {
+	I_HANDLER, I_ADD, I_SUB, I_MUL, I_AND, I_OR, I_LOADW, I_LOADB,
+	I_STOREW, I_STOREB, I_JE, I_JL, I_JG, I_JZ, I_TEST, I_INC, I_DEC,
+	I_INC_CHK, I_DEC_CHK, I_LOAD, I_STORE, I_PUSH, I_PULL, I_POP,
+	I_JUMP, I_RET, I_RTRUE, I_RFALSE, I_RET_POPPED, I_CALL_S, I_CALL_N
+};
+
+#define IF_ON_TRUE	0x01	/* branch if the condition holds */
+#define IF_CONTROL	0x02	/* the handler may move the PC */
+#define IF_LAST		0x04	/* last instruction of its block */
+#define IF_TERMINAL	0x08	/* never falls through */
+#define IF_ZARGS	0x10	/* needs its operands in zargs */
+
+typedef struct {
+	long pc;		/* address of the instruction, 0 if unused */
+	long end;		/* PC of the store, branch or string bytes */
+	long next;		/* PC of the following instruction */
+	long target;		/* branch target; 0 and 1 return that value */
+	void (*handler)(void);
+	zword args[8];		/* constants, or variable numbers */
+	zbyte op;		/* I_* */
+	zbyte argc;
+	zbyte vars;		/* bit n set when operand n is a variable */
+	zbyte store;		/* store variable */
+	zbyte flags;		/* IF_* */
+} insn_t;
+
+static insn_t insn_cache[INSN_CACHE_SIZE];
+
+#define INSN_HASH(pc) ((unsigned) ((pc) ^ ((pc) >> 11)) & (INSN_CACHE_SIZE - 1))
+
+static insn_t *hot_insns = NULL;
+static int hot_used = 0;
+
+static long hot_block_pc[INSN_HOT_BLOCKS];
+static int hot_block_first[INSN_HOT_BLOCKS];
+static int hot_blocks = 0;
+
+static struct {
+	long pc;
+	zword count;
+} hot_counter[HOT_COUNTERS];
+
+static long hot_work[HOT_WORK];
+static int hot_pending;
+
+static bool hot_enabled = FALSE;
+static unsigned long insn_executed = 0;
+static unsigned long cold_executed = 0;
+
+#define BLOCK_HASH(pc)	(((pc) ^ ((pc) >> 7)) & (INSN_HOT_BLOCKS - 1))
+
+
+/*
+ * init_insn_cache
+ *
+ * Empty both tiers.
+ *
+ */
+static void init_insn_cache(void)
+{
+	int i;
+
+	for (i = 0; i < INSN_CACHE_SIZE; i++)
+		insn_cache[i].pc = 0;
+	for (i = 0; i < INSN_HOT_BLOCKS; i++)
+		hot_block_pc[i] = -1;
+	for (i = 0; i < HOT_COUNTERS; i++)
+		hot_counter[i].pc = -1;
+	hot_used = hot_blocks = 0;
+
+	if (getenv("FROTZ_NO_HOT") != NULL)
+		return;
+	if (hot_insns == NULL)
+		hot_insns = malloc(INSN_HOT_SIZE * sizeof(insn_t));
+	hot_enabled = (hot_insns != NULL);
+} /* init_insn_cache */
+
+
+/*
+ * decode_record
+ *
+ * Decode the instruction at pc into a record. The record can always
+ * be run; return FALSE if it must not go into a hot block all the
+ * same, because the instruction is illegal or leaves static memory.
+ *
+ */
+static bool decode_record(long pc, insn_t *in)
+{
+	zinsn_t z;
+	int class, num, count, i;
+	bool hot;
+
+	hot = decode_insn(pc, &z);
+	class = z.class;
+	num = z.num;
+	count = z.argc;
+
+	in->pc = pc;
+	in->end = z.end;
+	in->next = z.next;
+	in->target = z.target;
+	in->argc = count;
+	in->store = z.store;
+	in->vars = 0;
+	in->args[0] = in->args[1] = 0;
+	for (i = 0; i < count; i++) {
+		in->args[i] = z.args[i];
+		if (z.types[i] == 2)
+			in->vars |= 1 << i;
+	}
+
+	/* Unknown extended opcodes do nothing, as in __extended__ */
+	if (class == C_EXT && num >= 0x1d) {
+		in->handler = z_nop;
+		in->op = I_HANDLER;
+		in->flags = 0;
+		return FALSE;
+	}
+
+	in->flags = 0;
+	if (z.flags & ZI_ON_TRUE)
+		in->flags |= IF_ON_TRUE;
+	if (z.flags & ZI_CONTROL)
+		in->flags |= IF_CONTROL;
+	if (z.flags & ZI_TERMINAL)
+		in->flags |= IF_TERMINAL;
+
+	/* Choose how to run it */
+	in->op = I_HANDLER;
+	switch (class) {
+	case C_2OP:
+		in->handler = var_opcodes[num];
+		switch (num) {
+		case 0x01: in->op = I_JE; break;
+		case 0x02: in->op = I_JL; break;
+		case 0x03: in->op = I_JG; break;
+		case 0x04: in->op = I_DEC_CHK; break;
+		case 0x05: in->op = I_INC_CHK; break;
+		case 0x07: in->op = I_TEST; break;
+		case 0x08: in->op = I_OR; break;
+		case 0x09: in->op = I_AND; break;
+		case 0x0d: in->op = I_STORE; break;
+		case 0x0f: in->op = I_LOADW; break;
+		case 0x10: in->op = I_LOADB; break;
+		case 0x14: in->op = I_ADD; break;
+		case 0x15: in->op = I_SUB; break;
+		case 0x16: in->op = I_MUL; break;
+		case 0x19: in->op = I_CALL_S; break;
+		case 0x1a: in->op = I_CALL_N; break;
+		}
+		if (in->op != I_JE && count != 2)
+			in->op = I_HANDLER;
+		break;
+	case C_1OP:
+		in->handler = op1_opcodes[num];
+		switch (num) {
+		case 0x00: in->op = I_JZ; break;
+		case 0x05: in->op = I_INC; break;
+		case 0x06: in->op = I_DEC; break;
+		case 0x08: in->op = I_CALL_S; break;
+		case 0x0b: in->op = I_RET; break;
+		case 0x0e: in->op = I_LOAD; break;
+		case 0x0c:
+			if (in->vars)
+				break;
+			in->op = I_JUMP;
+			break;
+		case 0x0f:
+			if (z_header.version >= V5)
+				in->op = I_CALL_N;
+			break;
+		}
+		break;
+	case C_0OP:
+		in->handler = op0_opcodes[num];
+		switch (num) {
+		case 0x00: in->op = I_RTRUE; break;
+		case 0x01: in->op = I_RFALSE; break;
+		case 0x08: in->op = I_RET_POPPED; break;
+		case 0x09:
+			if (z_header.version <= V4)
+				in->op = I_POP;
+			break;
+		}
+		break;
+	case C_VAR:
+		in->handler = var_opcodes[0x20 + num];
+		switch (num) {
+		case 0x00: case 0x0c: in->op = I_CALL_S; break;
+		case 0x19: case 0x1a: in->op = I_CALL_N; break;
+		case 0x01: if (count == 3) in->op = I_STOREW; break;
+		case 0x02: if (count == 3) in->op = I_STOREB; break;
+		case 0x08: if (count == 1) in->op = I_PUSH; break;
+		case 0x09:
+			if (count == 1 && z_header.version != V6)
+				in->op = I_PULL;
+			break;
+		}
+		break;
+	default:
+		in->handler = ext_opcodes[num];
+		break;
+	}
+
+	/* Opcodes naming a variable need it as a constant */
+	switch (in->op) {
+	case I_INC: case I_DEC: case I_INC_CHK: case I_DEC_CHK:
+	case I_LOAD: case I_STORE: case I_PULL:
+		if (in->vars & 1)
+			in->op = I_HANDLER;
+		break;
+	case I_CALL_S: case I_CALL_N:
+		if ((in->vars & 1) || count == 0)
+			in->op = I_HANDLER;
+		break;
+	}
+
+	/* Leave anything odd to the handler, and out of hot blocks */
+	if (in->handler == __illegal__)
+		hot = FALSE;
+	if (in->target > 1 && (in->target < z_header.dynamic_size ||
+				in->target >= story_size))
+		hot = FALSE;
+	if (!hot)
+		in->op = I_HANDLER;
+	if (count > 2 || in->op == I_HANDLER || in->op == I_CALL_S ||
+	    in->op == I_CALL_N || in->op == I_STOREW || in->op == I_STOREB)
+		in->flags |= IF_ZARGS;
+	return hot;
+} /* decode_record */
+
+
+/*
+ * queue_block
+ *
+ * Remember a block start still to be decoded into the hot pool.
+ *
+ */
+static void queue_block(long pc)
+{
+	if (hot_pending < HOT_WORK)
+		hot_work[hot_pending++] = pc;
+} /* queue_block */
+
+
+/*
+ * decode_block
+ *
+ * Decode the straight-line code starting at pc into the hot pool and
+ * enter it into the block table.
+ *
+ */
+static void decode_block(long start)
+{
+	long h = BLOCK_HASH(start);
+	long pc = start;
+	int first = hot_used;
+	insn_t *in = NULL;
+
+	while (hot_block_pc[h] != -1) {
+		if (hot_block_pc[h] == start)
+			return;
+		h = (h + 1) & (INSN_HOT_BLOCKS - 1);
+	}
+	if (hot_blocks >= INSN_HOT_BLOCKS / 2)
+		return;
+
+	while (hot_used < INSN_HOT_SIZE && hot_used - first < HOT_BLOCK_LEN) {
+		/* Longest instruction without an inline string */
+		if (pc < z_header.dynamic_size || pc + 24 > story_size)
+			break;
+		in = &hot_insns[hot_used];
+		if (!decode_record(pc, in))
+			break;
+		hot_used++;
+		if (in->target > 1)
+			queue_block(in->target);
+		if (in->flags & IF_CONTROL)
+			break;
+		pc = in->next;
+	}
+	if (hot_used == first)
+		return;
+
+	in = &hot_insns[hot_used - 1];
+	in->flags |= IF_LAST;
+	if (!(in->flags & IF_TERMINAL))
+		queue_block(in->next);
+
+	hot_block_pc[h] = start;
+	hot_block_first[h] = first;
+	hot_blocks++;
+} /* decode_block */
+
+
+/*
+ * hot_count
+ *
+ * Count an entry to the code at pc, the start of a routine or the
+ * head of a loop, and decode it into the hot pool once it has become
+ * hot.
+ *
+ */
+static void hot_count(long pc)
+{
+	int i;
+
+	i = (int) ((pc ^ (pc >> 8)) & (HOT_COUNTERS - 1));
+	if (hot_counter[i].pc != pc) {
+		hot_counter[i].pc = pc;
+		hot_counter[i].count = 0;
+	}
+	if (++hot_counter[i].count != INSN_HOT_THRESHOLD)
+		return;
+
+	hot_pending = 0;
+	queue_block(pc);
+	while (hot_pending > 0)
+		decode_block(hot_work[--hot_pending]);
+} /* hot_count */
+
+
+/*
+ * hot_enter
+ *
+ * Called by call() with the PC at the first instruction of a routine.
+ *
+ */
+static void hot_enter(void)
+{
+	long pc;
+
+	if (hot_enabled) {
+		GET_PC(pc)
+		hot_count(pc);
+	}
+} /* hot_enter */
+
+
+/*
+ * hot_block
+ *
+ * Return the first record of the hot block starting at pc, or NULL.
+ *
+ */
+static const insn_t *hot_block(long pc)
+{
+	long h;
+
+	for (h = BLOCK_HASH(pc); hot_block_pc[h] != pc;
+	     h = (h + 1) & (INSN_HOT_BLOCKS - 1)) {
+		if (hot_block_pc[h] == -1)
+			return NULL;
+	}
+	return &hot_insns[hot_block_first[h]];
+} /* hot_block */
+
+
+/*
+ * get_var
+ *
+ * Read a variable, popping the stack for variable 0.
+ *
+ */
+static zword get_var(zbyte variable)
+{
+	zword value;
+
+	if (variable == 0)
+		return *sp++;
+	if (variable < 16)
+		return *(fp - variable);
+	GET_GLOBAL(variable, value)
+	return value;
+} /* get_var */
+
+
+/*
+ * set_var
+ *
+ * Write a variable as store() does, pushing for variable 0.
+ *
+ */
+static void set_var(zbyte variable, zword value)
+{
+	if (variable == 0)
+		*--sp = value;
+	else if (variable < 16)
+		*(fp - variable) = value;
+	else
+		SET_GLOBAL(variable, value)
+} /* set_var */
+
 
 /*
- * init_process
+ * var_ref
  *
- * Initialize process variables.
+ * Return the stack slot of a local variable or of the top of stack,
+ * or NULL for a global. This is how inc, dec, load, store and pull
+ * see variable 0: in place, without pushing or popping.
  *
  */
-void init_process(void)
+static zword *var_ref(zbyte variable)
 {
-	finished = 0;
-} /* init_process */
+	if (variable == 0)
+		return sp;
+	if (variable < 16)
+		return fp - variable;
+	return NULL;
+} /* var_ref */
 
 
 /*
- * load_operand
+ * adjust_var
  *
- * Load an operand, either a variable or a constant.
+ * Add delta to a variable in place and return its new value.
  *
  */
-static void load_operand(zbyte type)
+static zword adjust_var(zbyte variable, int delta)
 {
+	zword *ref = var_ref(variable);
 	zword value;
 
-	if (type & 2) {		/* variable */
-		zbyte variable;
+	if (ref != NULL)
+		return *ref += delta;
+	GET_GLOBAL(variable, value)
+	value += delta;
+	SET_GLOBAL(variable, value)
+	return value;
+} /* adjust_var */
 
-		CODE_BYTE(variable)
-		if (variable == 0)
-			value = *sp++;
-		else if (variable < 16)
-			value = *(fp - variable);
-		else {
-			zword addr = z_header.globals + 2 * (variable - 16);
-			LOW_WORD(addr, value)
-		}
-	} else if (type & 1) {	/* small constant */
-		zbyte bvalue;
 
-		CODE_BYTE(bvalue)
-		value = bvalue;
+/*
+ * take_branch
+ *
+ * Leave the instruction through a branch whose condition is flag.
+ *
+ */
+static void take_branch(const insn_t *in, bool flag)
+{
+	if (!flag == !(in->flags & IF_ON_TRUE)) {
+		if (in->target > 1)
+			SET_PC(in->target)
+		else
+			ret((zword) in->target);
 	} else
-		CODE_WORD(value)	/* large constant */
-	zargs[zargc++] = value;
-} /* load_operand */
+		SET_PC(in->next)
+} /* take_branch */
 
 
 /*
- * load_all_operands
+ * run_insn
  *
- * Given the operand specifier byte, load all (up to four) operands
- * for a VAR or EXT opcode.
+ * Run one record. Return TRUE if the instruction has put the PC where
+ * the story goes on, FALSE if it simply falls through to in->next and
+ * has left the PC alone.
  *
  */
-static void load_all_operands(zbyte specifier)
+static bool run_insn(const insn_t *in)
 {
+	zword *ref;
+	zword a, b;
 	int i;
 
-	for (i = 6; i >= 0; i -= 2) {
-		zbyte type = (specifier >> i) & 0x03;
+	/* Fetch the operands in order, as the interpreter does */
+	if (in->flags & IF_ZARGS) {
+		for (i = 0; i < in->argc; i++) {
+			if (in->vars & (1 << i))
+				zargs[i] = get_var((zbyte) in->args[i]);
+			else
+				zargs[i] = in->args[i];
+		}
+		zargc = in->argc;
+		a = zargs[0];
+		b = zargs[1];
+	} else {
+		a = (in->vars & 1) ? get_var((zbyte) in->args[0]) : in->args[0];
+		b = (in->vars & 2) ? get_var((zbyte) in->args[1]) : in->args[1];
+	}
 
-		if (type == 3)
-			break;
-		load_operand(type);
+	switch (in->op) {
+	case I_ADD:
+		set_var(in->store, (zword) ((short) a + (short) b));
+		return FALSE;
+	case I_SUB:
+		set_var(in->store, (zword) ((short) a - (short) b));
+		return FALSE;
+	case I_MUL:
+		set_var(in->store, (zword) ((short) a * (short) b));
+		return FALSE;
+	case I_AND:
+		set_var(in->store, (zword) (a & b));
+		return FALSE;
+	case I_OR:
+		set_var(in->store, (zword) (a | b));
+		return FALSE;
+	case I_LOADW: {
+		zword addr = a + 2 * b;
+		zword value;
+
+		LOW_WORD(addr, value)
+		set_var(in->store, value);
+		return FALSE;
 	}
-} /* load_all_operands */
+	case I_LOADB: {
+		zword addr = a + b;
+		zbyte value;
+
+		LOW_BYTE(addr, value)
+		set_var(in->store, value);
+		return FALSE;
+	}
+	case I_STOREW:
+		storew((zword) (a + 2 * b), zargs[2]);
+		return FALSE;
+	case I_STOREB:
+		storeb((zword) (a + b), (zbyte) zargs[2]);
+		return FALSE;
+	case I_JE:
+		take_branch(in, in->argc > 1 && (a == b ||
+			(in->argc > 2 && (a == zargs[2] ||
+			(in->argc > 3 && a == zargs[3])))));
+		return TRUE;
+	case I_JL:
+		take_branch(in, (short) a < (short) b);
+		return TRUE;
+	case I_JG:
+		take_branch(in, (short) a > (short) b);
+		return TRUE;
+	case I_JZ:
+		take_branch(in, a == 0);
+		return TRUE;
+	case I_TEST:
+		take_branch(in, (a & b) == b);
+		return TRUE;
+	case I_INC_CHK:
+		take_branch(in, (short) adjust_var((zbyte) a, 1) > (short) b);
+		return TRUE;
+	case I_DEC_CHK:
+		take_branch(in, (short) adjust_var((zbyte) a, -1) < (short) b);
+		return TRUE;
+	case I_INC:
+		adjust_var((zbyte) a, 1);
+		return FALSE;
+	case I_DEC:
+		adjust_var((zbyte) a, -1);
+		return FALSE;
+	case I_LOAD:
+		ref = var_ref((zbyte) a);
+		set_var(in->store, ref ? *ref : get_var((zbyte) a));
+		return FALSE;
+	case I_STORE:
+		ref = var_ref((zbyte) a);
+		if (ref != NULL)
+			*ref = b;
+		else
+			set_var((zbyte) a, b);
+		return FALSE;
+	case I_PUSH:
+		*--sp = a;
+		return FALSE;
+	case I_PULL:
+		b = *sp++;
+		ref = var_ref((zbyte) a);
+		if (ref != NULL)
+			*ref = b;
+		else
+			set_var((zbyte) a, b);
+		return FALSE;
+	case I_POP:
+		sp++;
+		return FALSE;
+	case I_JUMP:
+		SET_PC(in->target)
+		return TRUE;
+	case I_RET:
+		ret(a);
+		return TRUE;
+	case I_RTRUE:
+		ret(1);
+		return TRUE;
+	case I_RFALSE:
+		ret(0);
+		return TRUE;
+	case I_RET_POPPED:
+		ret(*sp++);
+		return TRUE;
+	case I_CALL_S:
+	case I_CALL_N:
+		SET_PC(in->end)
+		if (a != 0)
+			call(a, zargc - 1, zargs + 1, in->op == I_CALL_S ? 0 : 1);
+		else if (in->op == I_CALL_S)
+			store(0);
+		return TRUE;
+	default:
+		/* The handler finds its store and branch bytes or its
+		   string at the PC as usual, and moves the PC past them */
+		SET_PC(in->end)
+		in->handler();
+		return TRUE;
+	}
+} /* run_insn */
 
 
 /*
- * interpret
+ * run_block
  *
- * Z-code interpreter main loop
+ * Run a block from its first record until control leaves it. A cold
+ * record is a block of one.
  *
  */
-void interpret(void)
+static void run_block(const insn_t *in)
 {
-	/* If we got a save file on the command line, use it now. */
-	if (f_setup.restore_mode == 1) {
-		z_restore();
-		f_setup.restore_mode = 0;
+	for (;; in++) {
+		insn_executed++;
+		if (run_insn(in)) {
+			/* A handler that falls through has left the PC at
+			   the next record; stop if it also became due to run
+			   an interrupt routine or ran one itself, which may
+			   have reused this record */
+			if (finished != 0 || in->op != I_HANDLER
+			    || (in->flags & (IF_CONTROL | IF_LAST)))
+				return;
+		} else if (in->flags & IF_LAST) {
+			SET_PC(in->next)
+			return;
+		}
 	}
+} /* run_block */
 
-	/* If we're supposed to start a transcript from the start. */
-#ifndef NO_SCRIPT	
-	if (f_setup.script_now == 1)
-		script_open(TRUE);
-#endif	
 
+/*
+ * interpret_cached
+ *
+ * Main loop running pre-decoded records.
+ *
+ */
+static void interpret_cached(void)
+{
+	insn_t scratch;
+
+	do {
+		const insn_t *block;
+		insn_t *insn;
+		long pc;
+
+		GET_PC(pc)
+		if (pc >= z_header.dynamic_size) {
+			if (hot_blocks > 0 && (block = hot_block(pc)) != NULL) {
+				run_block(block);
+				goto next;
+			}
+			insn = &insn_cache[INSN_HASH(pc)];
+			if (insn->pc != pc) {
+				decode_record(pc, insn);
+				insn->flags |= IF_LAST;
+			}
+		} else {
+			insn = &scratch;
+			decode_record(pc, insn);
+			insn->flags |= IF_LAST;
+		}
+
+		cold_executed++;
+		run_block(insn);
+		if (hot_enabled && (insn->flags & IF_CONTROL)) {
+			long to;
+
+			/* A backward jump is most likely a loop */
+			GET_PC(to)
+			if (to < pc && to >= z_header.dynamic_size)
+				hot_count(to);
+		}
+next:
+#if defined(DJGPP) && !defined(NO_SOUND)
+		if (end_of_sound_flag)
+			end_of_sound();
+#endif
+
+		os_tick();
+	} while (finished == 0);
+} /* interpret_cached */
+
+
+/*
+ * insn_report
+ *
+ * Tell how much of the story ran from hot blocks, if asked to.
+ *
+ */
+void insn_report(void)
+{
+	unsigned long hot = insn_executed - cold_executed;
+
+	if (getenv("FROTZ_INSN_STATS") == NULL || insn_executed == 0)
+		return;
+
+	fprintf(stderr, "Instructions: %lu of %lu from hot blocks (%lu%%), "
+		"%d blocks, %d records\n", hot, insn_executed,
+		(unsigned long) (hot * 100.0 / insn_executed),
+		hot_blocks, hot_used);
+} /* insn_report */
+
+#endif /* INSN_CACHE */
+
+
+#if !defined(INSN_CACHE) && !defined(THREADED_DISPATCH)
+/*
+ * interpret_plain
+ *
+ * Plain version of the main loop, decoding every instruction afresh.
+ *
+ */
+static void interpret_plain(void)
+{
 	do {
 		zbyte opcode;
+#ifdef AOT_STORY
+		aot_block_t block = aot_lookup();
+
+		/* Translated code runs a whole basic block at a time */
+		if (block != NULL) {
+			block();
+			os_tick();
+			continue;
+		}
+#endif
+#ifdef BLOCK_JIT
+		jit_block_t jit = jit_lookup();
+
+		/* Compiled code also runs a whole basic block at a time */
+		if (jit != NULL) {
+			jit();
+			os_tick();
+			continue;
+		}
+#endif
 
 /* FIXME may be able to do this without demacroing */
 #ifdef TOPS20
@@ -272,11 +1721,22 @@ void interpret(void)
 		CODE_BYTE(opcode)
 #endif
 		zargc = 0;
+#ifdef OPCODE_PROFILE
+		count_opcode(opcode);
+#endif
 
 		if (opcode < 0x80) {	/* 2OP opcodes */
-			load_operand((zbyte) (opcode & 0x40) ? 2 : 1);
-			load_operand((zbyte) (opcode & 0x20) ? 2 : 1);
-			var_opcodes[opcode & 0x1f] ();
+			zbyte b1;
+			zbyte b2;
+			zword a;
+			zword b;
+
+			/* Both operands are one byte; only the kinds differ */
+			CODE_BYTE(b1)
+			CODE_BYTE(b2)
+			a = (opcode & 0x40) ? fetch_variable(b1) : b1;
+			b = (opcode & 0x20) ? fetch_variable(b2) : b2;
+			run_2op(opcode, a, b);
 		} else if (opcode < 0xb0) {	/* 1OP opcodes */
 			load_operand((zbyte) (opcode >> 4));
 			op1_opcodes[opcode & 0x0f] ();
@@ -304,49 +1764,197 @@ void interpret(void)
 
 		os_tick();
 	} while (finished == 0);
+} /* interpret_plain */
+#endif
+
+
+/*
+ * start_interrupts
+ *
+ * Push a frame for each interrupt routine that became due during the
+ * last instruction, so the main loop carries on inside the routine.
+ * The routines run in the order they became due, so the oldest gets
+ * the innermost frame and goes to the top of the interrupt stack.
+ * Return FALSE if the main loop stopped for good instead.
+ *
+ */
+static bool start_interrupts(void)
+{
+	interrupt_t *i, *j;
+	interrupt_t swap;
+
+	if (finished != FINISHED_INTERRUPT)
+		return FALSE;
+	finished = 0;
+
+	i = interrupts + interrupt_count - interrupts_pending;
+	for (j = interrupts + interrupt_count - 1; i < j; i++, j--) {
+		swap = *i;
+		*i = *j;
+		*j = swap;
+	}
+	for (i = interrupts + interrupt_count - interrupts_pending;
+	     i < interrupts + interrupt_count; i++) {
+		call(i->routine, 0, 0, 2);
+		i->depth = frame_count;
+	}
+	interrupts_pending = 0;
+	return TRUE;
+} /* start_interrupts */
+
+
+/*
+ * interpret_loop
+ *
+ * Run the main loop, starting interrupt routines as they fall due,
+ * until it stops for good or a nested interrupt routine returns.
+ *
+ */
+static void interpret_loop(void)
+{
+	do {
+#if defined(INSN_CACHE)
+		interpret_cached();
+#elif defined(THREADED_DISPATCH)
+		interpret_threaded();
+#else
+		interpret_plain();
+#endif
+	} while (start_interrupts());
+} /* interpret_loop */
+
+
+/*
+ * interpret
+ *
+ * Z-code interpreter main loop
+ *
+ */
+void interpret(void)
+{
+	/* If we got a save file on the command line, use it now. */
+	if (f_setup.restore_mode == 1) {
+		z_restore();
+		f_setup.restore_mode = 0;
+	}
+
+	/* If we're supposed to start a transcript from the start. */
+#ifndef NO_SCRIPT	
+	if (f_setup.script_now == 1)
+		script_open(TRUE);
+#endif	
 
-	finished--;
+	interpret_loop();
 } /* interpret */
 
 
+#if ROUTINE_CACHE_SIZE
+/*
+ * routine_header
+ *
+ * Return the cached header of a routine, reading it into the cache
+ * first if need be. Return NULL for anything call() has to complain
+ * about or that lies in dynamic memory, and let call() handle it the
+ * long way.
+ *
+ */
+static const routine_t *routine_header(zword routine)
+{
+	routine_t *r = &routine_cache[routine & (ROUTINE_CACHE_SIZE - 1)];
+	zbyte huge *p;
+	long pc;
+	int i;
+
+	if (r->routine == routine && r->pc != 0)
+		return r;
+
+	pc = ((long)routine << z_variant.packed_shift) + z_variant.routine_offset;
+	if (pc < z_header.dynamic_size || pc >= story_size)
+		return NULL;
+
+	p = zmp + pc;
+	if (p[0] > 15)
+		return NULL;
+	r->count = p[0];
+	p++;
+
+	if (z_variant.local_defaults) {
+		if (pc + 1 + 2 * r->count > story_size)
+			return NULL;
+		for (i = 0; i < r->count; i++, p += 2)
+			r->defaults[i] = ((zword) p[0] << 8) | p[1];
+	} else {
+		for (i = 0; i < r->count; i++)
+			r->defaults[i] = 0;
+	}
+
+	r->routine = routine;
+	r->pc = p - zmp;
+	return r;
+} /* routine_header */
+#endif
+
+
 /*
  * call
  *
- * Call a subroutine. Save PC and FP then load new PC and initialise
- * new stack frame. Note that the caller may legally provide less or
- * more arguments than the function actually has. The call type "ct"
- * can be 0 (z_call_s), 1 (z_call_n) or 2 (direct call).
+ * Call a subroutine. Save PC and FP in a new frame record, then load
+ * new PC and push the local variables on the stack. Note that the
+ * caller may legally provide less or more arguments than the function
+ * actually has. The call type "ct" can be 0 (z_call_s), 1 (z_call_n)
+ * or 2 (interrupt routine, see interrupt_call).
  *
  */
 void call(zword routine, int argc, zword * args, int ct)
 {
+#if ROUTINE_CACHE_SIZE
+	const routine_t *r;
+#endif
+	frame_t *f;
 	long pc;
 	zword value;
 	zbyte count;
 	int i;
 
-	if (sp - stack < 4)
+#ifdef VENEER_ACCEL
+	if (accel_call(routine, argc, args, ct))
+		return;
+#endif
+#ifdef VERIFY_STORY
+	verify_call(routine);
+#endif
+
+	if (frame_count >= FRAME_COUNT)
 		runtime_error(ERR_STK_OVF);
 
+	f = &frames[frame_count++];
 	GET_PC(pc)
-	* --sp = (zword) (pc >> 9);
-	*--sp = (zword) (pc & 0x1ff);
-	*--sp = (zword) (fp - stack - 1);
-	*--sp = (zword) (argc | (ct << 12));
+	f->pc = pc;
+	f->fp = fp;
+	f->argc = argc;
+	f->type = ct;
 
 	fp = sp;
-	frame_count++;
+
+#if ROUTINE_CACHE_SIZE
+	r = routine_header(routine);
+	if (r != NULL) {
+		/* Initialise local variables from the cached header */
+		count = r->count;
+		if (sp - stack < count)
+			runtime_error(ERR_STK_OVF);
+
+		f->count = count;
+		for (i = 0; i < count; i++)
+			*--sp = (argc-- > 0) ? args[i] : r->defaults[i];
+		SET_PC(r->pc)
+		goto done;
+	}
+#endif
 
 	/* Calculate byte address of routine */
 
-	if (z_header.version <= V3)
-		pc = (long)routine << 1;
-	else if (z_header.version <= V5)
-		pc = (long)routine << 2;
-	else if (z_header.version <= V7)
-		pc = ((long)routine << 2) + ((long)z_header.functions_offset << 3);
-	else			/* z_header.version == V8 */
-		pc = (long)routine << 3;
+	pc = ((long)routine << z_variant.packed_shift) + z_variant.routine_offset;
 
 	if (pc >= story_size)
 		runtime_error(ERR_ILL_CALL_ADDR);
@@ -360,55 +1968,84 @@ void call(zword routine, int argc, zword * args, int ct)
 	if (sp - stack < count)
 		runtime_error(ERR_STK_OVF);
 
-	fp[0] |= (zword) count << 8;	 /* Save local var count for Quetzal. */
-	value = 0;
-	for (i = 0; i < count; i++) {
-		if (z_header.version <= V4)	  /* V1 to V4 games provide default */
-			CODE_WORD(value)  /* values for all local variables */
+	f->count = count;	/* Save local var count for Quetzal. */
+	if (z_variant.local_defaults) {
+		/* V1 to V4 games provide default values for all locals */
+		for (i = 0; i < count; i++) {
+			CODE_WORD(value)
 			*--sp = (zword) ((argc-- > 0) ? args[i] : value);
+		}
+	} else {
+		for (i = 0; i < count; i++)
+			*--sp = (zword) ((argc-- > 0) ? args[i] : 0);
 	}
 
-	/* Start main loop for direct calls */
-	if (ct == 2)
-		interpret();
+#if ROUTINE_CACHE_SIZE
+done:
+#endif
+#ifdef INSN_CACHE
+	hot_enter();
+#endif
+#ifdef BLOCK_JIT
+	jit_enter();
+#endif
 } /* call */
 
 
 /*
- * ret
+ * leave
  *
- * Return from the current subroutine and restore the previous stack
- * frame. The result may be stored (0), thrown away (1) or pushed on
- * the stack (2). In the latter case a direct call has been finished
- * and we must exit the interpreter loop.
+ * Restore the previous stack frame and hand it the result, as ret()
+ * does, but without checking the stack first.
  *
  */
-void ret(zword value)
+static void leave(zword value)
 {
-	long pc;
+	frame_t *f;
 	int ct;
 
-	if (sp > fp)
-		runtime_error(ERR_STK_UNDF);
-
 	sp = fp;
 
-	ct = *sp++ >> 12;
-	frame_count--;
-	fp = stack + 1 + *sp++;
-	pc = *sp++;
-	pc = ((long)*sp++ << 9) | pc;
+#ifdef VENEER_ACCEL
+	accel_check(value);
+#endif
+	f = &frames[--frame_count];
+	ct = f->type;
+	fp = f->fp;
 
-	SET_PC(pc)
+	SET_PC(f->pc)
 	/* Handle resulting value */
-	if (ct == 0)
+	if (ct == 0) {
 		store(value);
+#if FUSION_SET & FUSE_RET_POPPED
+		/* Returning into "call -> sp; ret_popped" returns again */
+		if (*pcp == 0xb8) {
+			pcp++;
+			ret(*sp++);
+			return;
+		}
+#endif
+	}
+	/* Hand the result of an interrupt routine to its continuation */
 	if (ct == 2)
-		*--sp = value;
+		end_interrupt(value);
+} /* leave */
 
-	/* Stop main loop for direct calls */
-	if (ct == 2)
-		finished++;
+
+/*
+ * ret
+ *
+ * Return from the current subroutine and restore the previous stack
+ * frame. The result may be stored (0), thrown away (1) or handed to
+ * the continuation of an interrupt routine (2).
+ *
+ */
+void ret(zword value)
+{
+	if (sp > fp || frame_count == 0)
+		runtime_error(ERR_STK_UNDF);
+
+	leave(value);
 } /* ret */
 
 /*
@@ -493,59 +2130,137 @@ void store(zword value)
 	else if (variable < 16)
 		*(fp - variable) = value;
 	else {
-		zword addr = z_header.globals + 2 * (variable - 16);
-		SET_WORD(addr, value)
+		SET_GLOBAL(variable, value)
 	}
 } /* store */
 
 
 /*
- * direct_call
+ * interrupt_call
  *
- * Call the interpreter loop directly. This is necessary when
+ * Run an interrupt routine. This is necessary when
  *
  * - a sound effect has been finished
  * - a read instruction has timed out
  * - a newline countdown has hit zero
  *
- * The interpreter returns the result value on the stack.
+ * The routine does not run in a nested interpreter loop. It starts
+ * in the main loop once the current instruction is over, and its
+ * result goes to the continuation "resume" (if any), with the operands
+ * of the interrupted instruction restored. An instruction that wants
+ * the result must return at once and finish its work in "resume".
+ * Output that cannot stop halfway uses interrupt_run() instead.
  *
  */
-int direct_call(zword addr)
+void interrupt_call(zword routine, void (*resume) (zword))
 {
-	zword saved_zargs[8];
-	int saved_zargc;
-	int i;
-#ifdef TOPS20
-	short sv;
-#endif
+	interrupt_t *i;
+	int n;
+
+	/* Calls to address 0 do nothing */
+	if (routine == 0)
+		return;
+
+	if (interrupt_count == INTERRUPT_DEPTH)
+		runtime_error(ERR_STK_OVF);
+
+	/* Save operands and operand count */
+	i = &interrupts[interrupt_count++];
+	i->routine = routine;
+	i->resume = resume;
+	for (n = 0; n < 8; n++)
+		i->zargs[n] = zargs[n];
+	i->zargc = zargc;
+	i->depth = 0;
+	i->nested = FALSE;
+
+	/* Stop the main loop after this instruction */
+	interrupts_pending++;
+	if (finished == 0)
+		finished = FINISHED_INTERRUPT;
+} /* interrupt_call */
+
+
+/*
+ * interrupt_run
+ *
+ * Run an interrupt routine to its end in a nested main loop, for the
+ * newline countdown, which falls due in the middle of printing. Its
+ * result is thrown away. Nesting is bounded by INTERRUPT_DEPTH, and
+ * interrupts still pending for the current instruction wait until it
+ * is over. The main loop stops after the current instruction, since
+ * the nested one may have reused its decoded records.
+ *
+ */
+void interrupt_run(zword routine)
+{
+	interrupt_t *i;
+	int pending = interrupts_pending;
+	int n;
 
-	/* Calls to address 0 return false */
-	if (addr == 0)
-		return 0;
+	/* Calls to address 0 do nothing */
+	if (routine == 0)
+		return;
+
+	if (interrupt_count == INTERRUPT_DEPTH)
+		runtime_error(ERR_STK_OVF);
 
 	/* Save operands and operand count */
-	for (i = 0; i < 8; i++)
-		saved_zargs[i] = zargs[i];
-	saved_zargc = zargc;
+	i = &interrupts[interrupt_count++];
+	i->routine = routine;
+	i->resume = NULL;
+	for (n = 0; n < 8; n++)
+		i->zargs[n] = zargs[n];
+	i->zargc = zargc;
+	i->nested = TRUE;
+
+	interrupts_pending = 0;
+	finished = 0;
+	call(routine, 0, 0, 2);
+	i->depth = frame_count;
+	interpret_loop();
+
+	/* Leave a quit alone; otherwise stop after this instruction */
+	if (finished == FINISHED_RETURN) {
+		interrupts_pending = pending;
+		finished = FINISHED_INTERRUPT;
+	}
+} /* interrupt_run */
 
-	/* Call routine directly */
-	call(addr, 0, 0, 2);
+
+/*
+ * end_interrupt
+ *
+ * An interrupt routine has returned; pass its result on. Nothing can
+ * be pending at this point, since pending routines are started at the
+ * end of every instruction.
+ *
+ */
+static void end_interrupt(zword value)
+{
+	interrupt_t *i;
+	int n;
+
+	/* Forget interrupts whose frames were thrown away */
+	while (interrupt_count > 0
+	       && interrupts[interrupt_count - 1].depth > frame_count + 1)
+		interrupt_count--;
+	if (interrupt_count == 0
+	    || interrupts[interrupt_count - 1].depth != frame_count + 1)
+		return;
 
 	/* Restore operands and operand count */
-	for (i = 0; i < 8; i++)
-		zargs[i] = saved_zargs[i];
-	zargc = saved_zargc;
+	i = &interrupts[--interrupt_count];
+	for (n = 0; n < 8; n++)
+		zargs[n] = i->zargs[n];
+	zargc = i->zargc;
 
-	/* Resulting value lies on top of the stack */
-#ifdef TOPS20
-	sv = s16(*sp);
-	sp += 1;
-	return (((zword) sv) & 0xffff);
-#else
-	return (short)*sp++;
-#endif
-} /* direct_call */
+	if (i->nested) {
+		if (finished != FINISHED_QUIT)
+			finished = FINISHED_RETURN;
+	} else if (i->resume != NULL)
+		i->resume(value);
+} /* end_interrupt */
 
 
 /*
@@ -615,7 +2330,7 @@ void z_throw(void)
 
 	/* Unwind the stack a frame at a time. */
 	for (; frame_count > zargs[1]; --frame_count)
-		fp = stack + 1 + fp[1];
+		fp = frames[frame_count - 1].fp;
 
 #ifdef TOPS20
 	ret ((zargs[0]) & 0xffff);
@@ -678,15 +2393,15 @@ void z_call_s(void)
 void z_check_arg_count(void)
 {
 #ifdef TOPS20
-	if (fp == stack + STACK_SIZE)
+	if (frame_count == 0)
 		branch (((zargs[0]) & 0xffff) == 0);
 	else
-		branch (((zargs[0]) & 0xffff) <= (*fp & 0xff));
+		branch (((zargs[0]) & 0xffff) <= frames[frame_count - 1].argc);
 #else
-	if (fp == stack + STACK_SIZE)
+	if (frame_count == 0)
 		branch(zargs[0] == 0);
 	else
-		branch(zargs[0] <= (*fp & 0xff));
+		branch(zargs[0] <= frames[frame_count - 1].argc);
 #endif
 } /* z_check_arg_count */
 
@@ -738,7 +2453,7 @@ void z_nop(void)
  */
 void z_quit(void)
 {
-	finished = 9999;
+	finished = FINISHED_QUIT;
 } /* z_quit */
 
 
@@ -792,3 +2507,61 @@ void z_rtrue(void)
 {
 	ret(1);
 } /* z_rtrue */
+
+
+#ifdef VERIFY_STORY
+/*
+ * Handlers for stories that verify_story() has checked.  Verified code
+ * never pops below its own frame and only jumps to instructions inside
+ * its routine, so these leave out the stack and address checks.
+ *
+ */
+static void z_ret_trusted(void)
+{
+	leave(zargs[0]);
+} /* z_ret_trusted */
+
+
+static void z_ret_popped_trusted(void)
+{
+	leave(*sp++);
+} /* z_ret_popped_trusted */
+
+
+static void z_rfalse_trusted(void)
+{
+	leave(0);
+} /* z_rfalse_trusted */
+
+
+static void z_rtrue_trusted(void)
+{
+	leave(1);
+} /* z_rtrue_trusted */
+
+
+static void z_jump_trusted(void)
+{
+	long pc;
+
+	GET_PC(pc)
+	pc += (short)zargs[0] - 2;
+	SET_PC(pc)
+} /* z_jump_trusted */
+
+
+/*
+ * set_trusted_handlers
+ *
+ * Switch between the trusted handlers and the usual checked ones.
+ *
+ */
+void set_trusted_handlers(bool trusted)
+{
+	op0_opcodes[0x00] = trusted ? z_rtrue_trusted : z_rtrue;
+	op0_opcodes[0x01] = trusted ? z_rfalse_trusted : z_rfalse;
+	op0_opcodes[0x08] = trusted ? z_ret_popped_trusted : z_ret_popped;
+	op1_opcodes[0x0b] = trusted ? z_ret_trusted : z_ret;
+	op1_opcodes[0x0c] = trusted ? z_jump_trusted : z_jump;
+} /* set_trusted_handlers */
+#endif /* VERIFY_STORY */
@@ -38,14 +38,33 @@
 
 #endif
 
-#define get_c fgetc
-#define put_c fputc
+extern long cmem_diff (const zbyte *, const zbyte *, zword, zbyte *);
 
 /*
- * This is used only by save_quetzal. It probably should be allocated
- * dynamically rather than statically.
+ * Saved games are built and taken apart in memory, so a file is
+ * written or read in one go and servers can keep saves anywhere.  The
+ * original dynamic memory, which `CMem' chunks are relative to, is
+ * read from the story file once and kept.
  */
-static zword frames[STACK_SIZE / 4 + 1];
+static zbyte *pristine = NULL;
+
+/*
+ * A save file being read.
+ */
+typedef struct {
+	const zbyte *data;
+	zlong size;
+	zlong pos;
+} reader_t;
+
+/*
+ * A save file being written, in a block that grows as needed.
+ */
+typedef struct {
+	zbyte *data;
+	zlong size;
+	zlong room;
+} writer_t;
 
 /*
  * ID types.
@@ -77,74 +96,144 @@ static zword frames[STACK_SIZE / 4 + 1];
 /*
  * Macros used to write the files.
  */
-#define write_byte(fp,b) (put_c (b, fp) != EOF)
-#define write_bytx(fp,b) write_byte (fp, (b) & 0xFF)
-#define write_word(fp,w) \
-	(write_bytx (fp, (w) >>  8) && write_bytx (fp, (w)))
-#define write_long(fp,l) \
-	(write_bytx (fp, (l) >> 24) && write_bytx (fp, (l) >> 16) && \
-	write_bytx (fp, (l) >>  8) && write_bytx (fp, (l)))
-#define write_chnk(fp,id,len) \
-	(write_long (fp, (id))      && write_long (fp, (len)))
-#define write_run(fp,run) \
-	(write_byte (fp, 0)         && write_byte (fp, (run)))
-
-
-/* Read one word from file; return TRUE if OK. */
-static bool read_word(FILE * f, zword * result)
+#define write_byte(w,b) (reserve (w, 1) && ((w)->data[(w)->size++] = (b), TRUE))
+#define write_bytx(w,b) write_byte (w, (b) & 0xFF)
+#define write_word(w,x) \
+	(write_bytx (w, (x) >>  8) && write_bytx (w, (x)))
+#define write_long(w,l) \
+	(write_bytx (w, (l) >> 24) && write_bytx (w, (l) >> 16) && \
+	write_bytx (w, (l) >>  8) && write_bytx (w, (l)))
+#define write_chnk(w,id,len) \
+	(write_long (w, (id))      && write_long (w, (len)))
+
+
+/*
+ * load_pristine
+ *
+ * Read the original dynamic memory from the story file, unless it has
+ * been read already.  Return FALSE if it cannot be read.
+ *
+ */
+static bool load_pristine(FILE * stf)
 {
-	int a, b;
+	if (pristine != NULL)
+		return TRUE;
+	if ((pristine = malloc(z_header.dynamic_size)) == NULL)
+		return FALSE;
+	(void)os_storyfile_seek(stf, 0, SEEK_SET);
+	if (fread(pristine, 1, z_header.dynamic_size, stf)
+	    != z_header.dynamic_size) {
+		free(pristine);
+		pristine = NULL;
+		return FALSE;
+	}
+	return TRUE;
+} /* load_pristine */
 
-	if ((a = get_c(f)) == EOF)
+
+/*
+ * reserve
+ *
+ * Make room for count more bytes in a save file being written.
+ * Return FALSE if there is no memory for them.
+ *
+ */
+static bool reserve(writer_t * w, zlong count)
+{
+	zlong room = w->room ? w->room : 1024;
+	zbyte *data;
+
+	if (w->size + count <= w->room)
+		return TRUE;
+	while (room < w->size + count)
+		room *= 2;
+	if ((data = realloc(w->data, room)) == NULL)
 		return FALSE;
-	if ((b = get_c(f)) == EOF)
+	w->data = data;
+	w->room = room;
+	return TRUE;
+} /* reserve */
+
+
+/*
+ * patch_long
+ *
+ * Fill in a long written earlier as a place holder.
+ *
+ */
+static void patch_long(writer_t * w, zlong pos, zlong l)
+{
+	w->data[pos] = (zbyte) (l >> 24);
+	w->data[pos + 1] = (zbyte) (l >> 16);
+	w->data[pos + 2] = (zbyte) (l >> 8);
+	w->data[pos + 3] = (zbyte) l;
+} /* patch_long */
+
+
+/* Read one byte from a save file; return EOF at its end. */
+static int get_c(reader_t * r)
+{
+	return r->pos < r->size ? r->data[r->pos++] : EOF;
+} /* get_c */
+
+
+/* Skip count bytes of a save file. */
+static void skip_bytes(reader_t * r, zlong count)
+{
+	r->pos = (count < r->size - r->pos) ? r->pos + count : r->size;
+} /* skip_bytes */
+
+
+/* Read one word from a save file; return TRUE if OK. */
+static bool read_word(reader_t * r, zword * result)
+{
+	if (r->size - r->pos < 2)
 		return FALSE;
 
-	*result = ((zword) a << 8) | (zword) b;
+	*result = ((zword) r->data[r->pos] << 8) | (zword) r->data[r->pos + 1];
+	r->pos += 2;
 	return TRUE;
 } /* read_word */
 
 
-/* Read one long from file; return TRUE if OK. */
-static bool read_long(FILE * f, zlong * result)
+/* Read one long from a save file; return TRUE if OK. */
+static bool read_long(reader_t * r, zlong * result)
 {
-	int a, b, c, d;
+	const zbyte *p = r->data + r->pos;
 
-	if ((a = get_c(f)) == EOF)
-		return FALSE;
-	if ((b = get_c(f)) == EOF)
-		return FALSE;
-	if ((c = get_c(f)) == EOF)
+	if (r->size - r->pos < 4)
 		return FALSE;
-	if ((d = get_c(f)) == EOF)
-		return FALSE;
-
-	/*
-	 * When optimization is turned on in TurboC, the next to most
-	 * significant byte seems to leak into the least significant byte.
-	 * Use a mask to prevent this from happening.
-	 * There's no harm in letting all ports see this.
-	 */
-	*result = ((zlong) a << 24) | (0x00ff0000UL &((zlong) b << 16)) |
-	    ((zlong) c << 8) | (zlong) d;
 
+	*result = ((zlong) p[0] << 24) | ((zlong) p[1] << 16) |
+	    ((zlong) p[2] << 8) | (zlong) p[3];
+	r->pos += 4;
 	return TRUE;
 } /* read_long */
 
 
 /*
- * Restore a saved game using Quetzal format. Return 2 if OK, 0 if an error
- * occurred before any damage was done, -1 on a fatal error.
+ * Restore a saved game using Quetzal format from size bytes at data,
+ * taking the original memory from the story file stf. Return 2 if OK,
+ * 0 if an error occurred before any damage was done, -1 on a fatal
+ * error. Only memory, the stack and the PC are restored; callers
+ * outside fastmem.c want restore_game_mem, which does the rest.
  */
-zword restore_quetzal(FILE * svf, FILE * stf)
+zword restore_quetzal_mem(const zbyte * data, long size, FILE * stf)
 {
+	reader_t file;
+	reader_t *svf = &file;
 	zlong ifzslen, currlen, tmpl;
 	zlong pc;
 	zword i, tmpw;
 	zword fatal = 0;	/* Set to -1 when errors must be fatal. */
 	zbyte skip, progress = GOT_NONE;
+	frame_t *f;
 	int x, y;
 
+	file.data = data;
+	file.size = size;
+	file.pos = 0;
+
 	/* Check it's really an `IFZS' file. */
 	if (!read_long(svf, &tmpl)
 	    || !read_long(svf, &ifzslen)
@@ -217,8 +306,7 @@ zword restore_quetzal(FILE * svf, FILE * stf)
 			fatal = -1;	/* Setting PC means errors must be fatal. */
 			SET_PC(pc);
 
-			for (i = 13; i < currlen; ++i)
-				(void)get_c(svf);	/* Skip rest of chunk. */
+			skip_bytes(svf, currlen - 13);	/* Skip rest of chunk. */
 			break;
 			/* `Stks' stacks chunk; restoring this is quite complex. ;) */
 		case ID_Stks:
@@ -265,17 +353,18 @@ zword restore_quetzal(FILE * svf, FILE * stf)
 			     currlen > 0; currlen -= 8, ++frame_count) {
 				if (currlen < 8)
 					return fatal;
-				if (sp - stack < 4) {	/* No space for frame. */
+				if (frame_count >= FRAME_COUNT) {	/* No space for frame. */
 					print_string
 					    ("Save-file has too much stack (and I can't cope).\n");
 					return fatal;
 				}
+				f = &frames[frame_count];
 
 				/* Read PC, procedure flag and formal param count. */
 				if (!read_long(svf, &tmpl))
 					return fatal;
 				y = (int)(tmpl & 0x0F);	/* Number of formals. */
-				tmpw = y << 8;
+				f->count = y;
 
 				/* Read result variable. */
 				if ((x = get_c(svf)) == EOF)
@@ -283,10 +372,10 @@ zword restore_quetzal(FILE * svf, FILE * stf)
 
 				/* Check the procedure flag... */
 				if (tmpl & 0x10) {
-					tmpw |= 0x1000;	/* It's a procedure. */
+					f->type = 1;	/* It's a procedure. */
 					tmpl >>= 8;	/* Shift to get PC value. */
 				} else {
-					/* Functions have type 0, so no need to or anything. */
+					f->type = 0;	/* It's a function. */
 					tmpl >>= 8;	/* Shift to get PC value. */
 					--tmpl;	/* Point at result byte. */
 					/* Sanity check on result variable... */
@@ -296,9 +385,8 @@ zword restore_quetzal(FILE * svf, FILE * stf)
 						return fatal;
 					}
 				}
-				*--sp = (zword) (tmpl >> 9);	/* High part of PC */
-				*--sp = (zword) (tmpl & 0x1FF);	/* Low part of PC */
-				*--sp = (zword) (fp - stack - 1);	/* FP */
+				f->pc = tmpl;
+				f->fp = fp;
 
 				/* Read and process argument mask. */
 				if ((x = get_c(svf)) == EOF)
@@ -312,7 +400,7 @@ zword restore_quetzal(FILE * svf, FILE * stf)
 					    ("Save-file uses incomplete argument lists (which I can't handle)\n");
 					return fatal;
 				}
-				*--sp = tmpw | i;
+				f->argc = i;
 				fp = sp;	/* FP for next frame. */
 
 				/* Read amount of eval stack used. */
@@ -338,7 +426,8 @@ zword restore_quetzal(FILE * svf, FILE * stf)
 			/* `CMem' compressed memory chunk; uncompress it. */
 		case ID_CMem:
 			if (!(progress & GOT_MEMORY)) {	/* Don't complain if two. */
-				(void)os_storyfile_seek(stf, 0, SEEK_SET);
+				if (!load_pristine(stf))
+					return fatal;
 				i = 0;	/* Bytes written to data area. */
 				for (; currlen > 0; --currlen) {
 					if ((x = get_c(svf)) == EOF)
@@ -348,61 +437,52 @@ zword restore_quetzal(FILE * svf, FILE * stf)
 						if (currlen < 2) {
 							print_string
 							    ("File contains bogus `CMem' chunk.\n");
-							for (; currlen > 0;
-							     --currlen)
-								(void)get_c(svf);	/* Skip rest. */
+							skip_bytes(svf, currlen - 1);	/* Skip rest. */
 							currlen = 1;
 							i = 0xFFFF;
 							break;	/* Keep going; may be a `UMem' too. */
 						}
-						/* Copy story file to memory during the run. */
+						/* Copy the original to memory during the run. */
 						--currlen;
 						if ((x = get_c(svf)) == EOF)
 							return fatal;
-						for (;
-						     x >= 0
-						     && i < z_header.dynamic_size;
-						     --x, ++i)
-							if ((y =
-							     get_c(stf)) == EOF)
-								return fatal;
-							else
-								zmp[i] =
-								    (zbyte) y;
+						if (x >= z_header.dynamic_size - i)
+							x = z_header.dynamic_size - i - 1;
+						memmove(zmp + i, pristine + i, x + 1);
+						i += x + 1;
 					} else {	/* Not a run. */
-					if ((y = get_c(stf)) == EOF)
-						return fatal;
-					zmp[i] = (zbyte) (x ^ y);
+					if (i < z_header.dynamic_size)
+						zmp[i] = (zbyte) (x ^ pristine[i]);
 					++i;
 					}
 					/* Make sure we don't load too much. */
 					if (i > z_header.dynamic_size) {
 						print_string
 						    ("warning: `CMem' chunk too long!\n");
-						for (; currlen > 1; --currlen)
-							(void)get_c(svf);	/* Skip rest. */
+						skip_bytes(svf, currlen - 1);	/* Skip rest. */
+						currlen = 1;
 						break;	/* Keep going; there may be a `UMem' too. */
 					}
 				}
 				/* If chunk is short, assume a run. */
-				for (; i < z_header.dynamic_size; ++i)
-					if ((y = get_c(stf)) == EOF)
-						return fatal;
-					else
-						zmp[i] = (zbyte) y;
+				if (i < z_header.dynamic_size)
+					memmove(zmp + i, pristine + i,
+						z_header.dynamic_size - i);
 				if (currlen == 0)
 					progress |= GOT_MEMORY;	/* Only if succeeded. */
 				break;
 			}
 			/* Already GOT_MEMORY */
-			(void)fseek(svf, currlen, SEEK_CUR);	/* Skip chunk. */
+			skip_bytes(svf, currlen);	/* Skip chunk. */
 			break;
 			/* `UMem' uncompressed memory chunk; load it. */
 		case ID_UMem:
 			if (!(progress & GOT_MEMORY)) {	/* Don't complain if two. */
 				/* Must be exactly the right size. */
 				if (currlen == z_header.dynamic_size) {
-					if (fread(zmp, currlen, 1, svf) == 1) {
+					if (svf->size - svf->pos >= currlen) {
+						memmove(zmp, svf->data + svf->pos, currlen);
+						svf->pos += currlen;
 						progress |= GOT_MEMORY;	/* Only on success. */
 						break;
 					}
@@ -412,11 +492,11 @@ zword restore_quetzal(FILE * svf, FILE * stf)
 					    ("`UMem' chunk wrong size!\n");
 			}
 			/* Already GOT_MEMORY */
-			(void)fseek(svf, currlen, SEEK_CUR);	/* Skip chunk. */
+			skip_bytes(svf, currlen);	/* Skip chunk. */
 			break;
 			/* Unrecognised chunk type; skip it. */
 		default:
-			(void)fseek(svf, currlen, SEEK_CUR);	/* Skip chunk. */
+			skip_bytes(svf, currlen);	/* Skip chunk. */
 			break;
 		}
 		if (skip)
@@ -437,138 +517,143 @@ zword restore_quetzal(FILE * svf, FILE * stf)
 		    ("error: no valid memory (`CMem' or `UMem') chunk in file.\n");
 
 	return (progress == GOT_ALL ? 2 : fatal);
+} /* restore_quetzal_mem */
+
+
+/*
+ * Restore a saved game using Quetzal format from the file svf, read
+ * in one go. Return as restore_quetzal_mem.
+ */
+zword restore_quetzal(FILE * svf, FILE * stf)
+{
+	zbyte *data;
+	long size;
+	zword success;
+
+	if (fseek(svf, 0, SEEK_END) != 0 || (size = ftell(svf)) < 0
+	    || fseek(svf, 0, SEEK_SET) != 0)
+		return 0;
+	if ((data = malloc(size ? size : 1)) == NULL)
+		return 0;
+	if (fread(data, 1, size, svf) != (size_t) size) {
+		free(data);
+		return 0;
+	}
+	success = restore_quetzal_mem(data, size, stf);
+	free(data);
+	return success;
 } /* restore_quetzal */
 
 
 /*
- * Save a game using Quetzal format. Return 1 if OK, 0 if failed.
+ * Save a game using Quetzal format into a new block of memory, taking
+ * the original memory from the story file stf. On success set *data
+ * to the block, which the caller frees, and *size to its length, and
+ * return 1; otherwise return 0.
  */
-zword save_quetzal(FILE * svf, FILE * stf)
+zword save_quetzal_mem(zbyte ** data, long *size, FILE * stf)
 {
+	writer_t file = { NULL, 0, 0 };
+	writer_t *svf = &file;
 	zlong ifzslen = 0, cmemlen = 0, stkslen = 0;
 	zlong pc;
-	zword i, j, n;
-	zword nvars, nargs, nstk, *p;
+	zword i, j;
+	zword nvars, nargs, nstk, *p, *base;
 	zbyte var;
-	long cmempos, stkspos;
-	int c;
+	zlong cmempos, stkspos;
+
+	/* Room for everything but a long stack, so it seldom grows. */
+	if (!load_pristine(stf)
+	    || !reserve(svf, 64 + ((zlong) z_header.dynamic_size * 3) / 2
+		+ 2 * (STACK_SIZE - (sp - stack))))
+		goto failed;
 
 	/* Write `IFZS' header. */
 	if (!write_chnk(svf, ID_FORM, 0))
-		return 0;
+		goto failed;
 	if (!write_long(svf, ID_IFZS))
-		return 0;
+		goto failed;
 
 	/* Write `IFhd' chunk. */
 	GET_PC(pc);
 	if (!write_chnk(svf, ID_IFhd, 13))
-		return 0;
+		goto failed;
 	if (!write_word(svf, z_header.release))
-		return 0;
+		goto failed;
 	for (i = H_SERIAL; i < H_SERIAL + 6; ++i)
 		if (!write_byte(svf, zmp[i]))
-			return 0;
+			goto failed;
 	if (!write_word(svf, z_header.checksum))
-		return 0;
+		goto failed;
 	if (!write_long(svf, pc << 8))	/* Includes pad. */
-		return 0;
+		goto failed;
 
-	/* Write `CMem' chunk. */
-	if ((cmempos = ftell(svf)) < 0)
-		return 0;
+	/* Write `CMem' chunk, comparing memory with the original in one go. */
+	cmempos = svf->size;
 	if (!write_chnk(svf, ID_CMem, 0))
-		return 0;
-	(void)os_storyfile_seek(stf, 0, SEEK_SET);
-	/* j holds current run length. */
-	for (i = 0, j = 0, cmemlen = 0; i < z_header.dynamic_size; ++i) {
-		if ((c = get_c(stf)) == EOF)
-			return 0;
-		c ^= (int)zmp[i];
-		if (c == 0)
-			++j;	/* It's a run of equal bytes. */
-		else {
-			/* Write out any run there may be. */
-			if (j > 0) {
-				for (; j > 0x100; j -= 0x100) {
-					if (!write_run(svf, 0xFF))
-						return 0;
-					cmemlen += 2;
-				}
-				if (!write_run(svf, j - 1))
-					return 0;
-				cmemlen += 2;
-				j = 0;
-			}
-			/* Any runs are now written. Write this (nonzero) byte. */
-			if (!write_byte(svf, (zbyte) c))
-				return 0;
-			++cmemlen;
-		}
-	}
+		goto failed;
+	if (!reserve(svf, ((zlong) z_header.dynamic_size * 3) / 2 + 2))
+		goto failed;
+	cmemlen = cmem_diff(zmp, pristine, z_header.dynamic_size,
+		svf->data + svf->size);
+	svf->size += cmemlen;
 
 	/*
-	 * Reached end of dynamic memory. We ignore any unwritten run there may be
-	 * at this point.
+	 * Reached end of dynamic memory. Any run there may be at this
+	 * point was left out.
 	 */
 	if (cmemlen & 1)	/* Chunk length must be even. */
 		if (!write_byte(svf, 0))
-			return 0;
+			goto failed;
 
-	/* Write `Stks' chunk. You are not expected to understand this. ;) */
-	if ((stkspos = ftell(svf)) < 0)
-		return 0;
+	/* Write `Stks' chunk, straight from the frame records. */
+	stkspos = svf->size;
 	if (!write_chnk(svf, ID_Stks, 0))
-		return 0;
-
-	/*
-	 * We construct a list of frame indices, most recent first, in `frames'.
-	 * These indices are the offsets into the `stack' array of the word before
-	 * the first word pushed in each frame.
-	 */
-	frames[0] = sp - stack;	/* The frame we'd get by doing a call now. */
-	for (i = fp - stack + 4, n = 0; i < STACK_SIZE + 4;
-	     i = stack[i - 3] + 5)
-		frames[++n] = i;
+		goto failed;
 
 	/*
 	 * All versions other than V6 can use evaluation stack outside a function
 	 * context. We write a faked stack frame (most fields zero) to cater for
 	 * this.
 	 */
+	base = (frame_count > 1) ? frames[1].fp : (frame_count ? fp : sp);
 	if (z_header.version != V6) {
 		for (i = 0; i < 6; ++i)
 			if (!write_byte(svf, 0))
-				return 0;
-		nstk = STACK_SIZE - frames[n];
+				goto failed;
+		nstk = stack + STACK_SIZE - base;
 		if (!write_word(svf, nstk))
-			return 0;
-		for (j = STACK_SIZE - 1; j >= frames[n]; --j)
-			if (!write_word(svf, stack[j]))
-				return 0;
+			goto failed;
+		for (p = stack + STACK_SIZE - 1; p >= base; --p)
+			if (!write_word(svf, *p))
+				goto failed;
 		stkslen = 8 + 2 * nstk;
 	}
 
-	/* Write out the rest of the stack frames. */
-	for (i = n; i > 0; --i) {
-		p = stack + frames[i] - 4;	/* Points to call frame. */
-		nvars = (p[0] & 0x0F00) >> 8;
-		nargs = p[0] & 0x00FF;
-		nstk = frames[i] - frames[i - 1] - nvars - 4;
-		pc = ((zlong) p[3] << 9) | p[2];
-
-		switch (p[0] & 0xF000) {	/* Check type of call. */
-		case 0x0000:	/* Function. */
+	/* Write out the rest of the stack frames, oldest first. */
+	for (i = 0; i < frame_count; ++i) {
+		/* The frame runs from its own fp down to the next one's. */
+		p = (i + 1 < frame_count) ? frames[i + 1].fp : fp;
+		base = (i + 2 < frame_count) ? frames[i + 2].fp :
+		    (i + 1 < frame_count) ? fp : sp;
+		nvars = frames[i].count;
+		nargs = frames[i].argc;
+		nstk = p - base - nvars;
+		pc = frames[i].pc;
+
+		switch (frames[i].type) {	/* Check type of call. */
+		case 0:		/* Function. */
 			var = zmp[pc];
 			pc = ((pc + 1) << 8) | nvars;
 			break;
-		case 0x1000:	/* Procedure. */
+		case 1:		/* Procedure. */
 			var = 0;
 			pc = (pc << 8) | 0x10 | nvars;	/* Set procedure flag. */
 			break;
-			/* case 0x2000: */
+			/* case 2: */
 		default:
 			runtime_error(ERR_SAVE_IN_INTER);
-			return 0;
+			goto failed;
 		}
 		if (nargs != 0)
 			nargs = (1 << nargs) - 1;	/* Make args into bitmap. */
@@ -578,12 +663,12 @@ zword save_quetzal(FILE * svf, FILE * stf)
 		    || !write_byte(svf, var)
 		    || !write_byte(svf, nargs)
 		    || !write_word(svf, nstk))
-			return 0;
+			goto failed;
 
 		/* Write the variables and eval stack. */
 		for (j = 0, --p; j < nvars + nstk; ++j, --p)
 			if (!write_word(svf, *p))
-				return 0;
+				goto failed;
 
 		/* Calculate length written thus far. */
 		stkslen += 8 + 2 * (nvars + nstk);
@@ -592,16 +677,34 @@ zword save_quetzal(FILE * svf, FILE * stf)
 	ifzslen = 3 * 8 + 4 + 14 + cmemlen + stkslen;
 	if (cmemlen & 1)
 		++ifzslen;
-	(void)fseek(svf, 4, SEEK_SET);
-	if (!write_long(svf, ifzslen))
-		return 0;
-	(void)fseek(svf, cmempos + 4, SEEK_SET);
-	if (!write_long(svf, cmemlen))
-		return 0;
-	(void)fseek(svf, stkspos + 4, SEEK_SET);
-	if (!write_long(svf, stkslen))
-		return 0;
+	patch_long(svf, 4, ifzslen);
+	patch_long(svf, cmempos + 4, cmemlen);
+	patch_long(svf, stkspos + 4, stkslen);
 
 	/* After all that, still nothing went wrong! */
+	*data = svf->data;
+	*size = svf->size;
 	return 1;
+
+failed:
+	free(svf->data);
+	return 0;
+} /* save_quetzal_mem */
+
+
+/*
+ * Save a game using Quetzal format to the file svf in one write.
+ * Return 1 if OK, 0 if failed.
+ */
+zword save_quetzal(FILE * svf, FILE * stf)
+{
+	zbyte *data;
+	long size;
+	bool ok;
+
+	if (!save_quetzal_mem(&data, &size, stf))
+		return 0;
+	ok = fwrite(data, 1, size, svf) == (size_t) size;
+	free(data);
+	return ok ? 1 : 0;
 } /* save_quetzal */
@@ -139,8 +139,22 @@ void memory_word(const zchar * s)
 	LOW_WORD(addr, size)
 	addr += 2;
 
-	while ((c = *s++) != 0)
-		storeb((zword) (addr + (size++)), translate_to_zscii(c));
+	/* Translate the string a chunk at a time and store each in one go */
+	while (*s != 0) {
+		zbyte chunk[64];
+		zword count = 0;
+		zword i;
+
+		while (count < sizeof(chunk) && (c = *s) != 0) {
+			chunk[count++] = translate_to_zscii(c);
+			s++;
+		}
+		if (!store_block((zword) (addr + size), chunk, count)) {
+			for (i = 0; i < count; i++)
+				storeb((zword) (addr + size + i), chunk[i]);
+		}
+		size += count;
+	}
 
 	storew(redirect[depth].table, size);
 } /* memory_word */
@@ -22,7 +22,7 @@
 
 extern void set_header_extension(int, zword);
 
-extern int direct_call(zword);
+extern void interrupt_run(zword);
 
 static struct {
 	enum story story_id;
@@ -46,6 +46,7 @@ static int font_width = 1;
 static bool input_redraw = FALSE;
 static bool more_prompts = TRUE;
 static bool discarding = FALSE;
+static bool late_countdown = FALSE;
 static bool cursor = TRUE;
 
 static int input_window = 0;
@@ -249,7 +250,7 @@ static void countdown(void)
 {
 	if (cwp->nl_countdown != 0) {
 		if (--cwp->nl_countdown == 0)
-			direct_call(cwp->nl_routine);
+			interrupt_run(cwp->nl_routine);
 	}
 } /* countdown */
 
@@ -269,8 +270,7 @@ void screen_new_line(void)
 		return;
 
 	/* Handle newline interrupts at the start (for most cases) */
-	if (z_header.interpreter_number != INTERP_MSDOS || story_id != ZORK_ZERO
-	    || z_header.release != 393)
+	if (!late_countdown)
 		countdown();
 
 	/* Check whether the last input line gets destroyed */
@@ -329,8 +329,7 @@ void screen_new_line(void)
 	}
 
 	/* Handle newline interrupts at the end for Zork Zero under DOS */
-	if (z_header.interpreter_number == INTERP_MSDOS && story_id == ZORK_ZERO
-	    && z_header.release == 393)
+	if (late_countdown)
 		countdown();
 } /* screen_new_line */
 
@@ -812,6 +811,10 @@ void restart_screen(void)
 
 	cursor = TRUE;
 
+	/* Zork Zero under DOS expects newline interrupts after the line */
+	late_countdown = (z_header.interpreter_number == INTERP_MSDOS
+	    && story_id == ZORK_ZERO && z_header.release == 393);
+
 	/* Initialise window properties */
 	mwin = 1;
 	for (cwp = wp; cwp < wp + 8; cwp++) {
@@ -29,6 +29,7 @@ typedef struct frotz_setup_struct {
 	int piracy;
 	int tandy;
 	int undo_slots;
+	long undo_size;		/* bytes for the undo store, all told */
 	int expand_abbreviations;
 	int script_cols;
 	int script_now;
@@ -112,4 +113,41 @@ typedef struct zcode_header_struct {
 } z_header_t;
 extern z_header_t z_header;
 
+/*** Version-dependent constants, chosen once by init_memory() ***/
+enum z_family {
+	FAMILY_V1_3,
+	FAMILY_V4_5,
+	FAMILY_V6_7,
+	FAMILY_V8
+};
+
+typedef struct zcode_variant_struct {
+	zbyte family;		/* one of enum z_family */
+	zbyte packed_shift;	/* packed to byte address: 1, 2 or 3 */
+	long routine_offset;	/* added to unpacked routines (V6-7) */
+	long string_offset;	/* added to unpacked strings (V6-7) */
+	bool local_defaults;	/* routine headers carry initial locals */
+
+	zlong object_base;	/* address of object 1 */
+	zword max_object;
+	zbyte object_size;
+	zbyte object_parent;
+	zbyte object_sibling;
+	zbyte object_child;
+	zbyte object_properties;
+	zbyte max_attribute;
+
+	zbyte prop_id_mask;	/* 0x1f or 0x3f */
+	zbyte prop_size_shift;	/* size field of a short property */
+	zbyte prop_long_flag;	/* second size byte follows (V4+) */
+	zbyte prop_word_mask;	/* clear when a property is byte sized */
+
+	zbyte text_resolution;	/* dictionary word length in words */
+	zbyte abbrev_zchars;	/* highest abbreviation Z-char, 0 in V1 */
+	bool shift_lock;	/* Z-chars 4 and 5 lock the alphabet (V1-2) */
+
+	bool lax_objects;	/* objects past dynamic memory read as 0 */
+} z_variant_t;
+extern z_variant_t z_variant;
+
 #endif
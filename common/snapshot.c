@@ -0,0 +1,353 @@
+/* snapshot.c - Copy-on-write snapshots of the game state
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Built with -DSNAPSHOTS, the game state can be saved under a name
+ * and brought back any number of times, for programs that search a
+ * tree of game states.  A snapshot holds dynamic memory as a table of
+ * shared, reference-counted pages of DIRTY_SHIFT bits, together with
+ * the stack, the call frames and the PC.
+ *
+ * zmp itself stays one flat block, so reads cost nothing extra.  The
+ * interpreter keeps a table of the pages zmp last agreed with, and
+ * the write barrier (MARK_DIRTY) marks the pages written since with
+ * DIRTY_SNAP.  Taking a snapshot copies only the marked pages and
+ * shares the rest with earlier snapshots; restoring one copies only
+ * the pages that differ from it.  Either way the cost follows the
+ * pages that changed, not the size of dynamic memory.
+ *
+ * Snapshots are taken and restored while the story waits for input,
+ * and a snapshot can only be restored at the same input instruction
+ * it was taken at.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "frotz.h"
+
+#ifdef SNAPSHOTS
+
+extern void restart_header (void);
+
+#define PAGE_SIZE (1 << DIRTY_SHIFT)
+#define SNAPSHOT_BUCKETS 64
+
+typedef struct page_struct page_t;
+struct page_struct {
+	page_t *next;		/* in the free list */
+	long refs;
+	zbyte data[PAGE_SIZE];
+};
+
+typedef struct snapshot_struct snapshot_t;
+struct snapshot_struct {
+	snapshot_t *next;	/* in its hash bucket */
+	char *name;
+	page_t **pages;
+	zword *stack_data;
+	frame_t *frame_data;
+	long pc;
+	zword stack_size;
+	zword frame_offset;
+	zword frame_count;
+};
+
+static page_t *live[DIRTY_PAGES];
+static page_t *free_pages = NULL;
+static snapshot_t *buckets[SNAPSHOT_BUCKETS];
+
+
+/*
+ * page_count
+ *
+ * Return the number of pages in dynamic memory.
+ *
+ */
+static zword page_count(void)
+{
+	return ((zlong) z_header.dynamic_size + PAGE_SIZE - 1) >> DIRTY_SHIFT;
+} /* page_count */
+
+
+/*
+ * page_bytes
+ *
+ * Return the number of bytes of dynamic memory in a page; only the
+ * last one may be short.
+ *
+ */
+static zword page_bytes(zword page)
+{
+	zlong left = z_header.dynamic_size - ((zlong) page << DIRTY_SHIFT);
+
+	return left < PAGE_SIZE ? left : PAGE_SIZE;
+} /* page_bytes */
+
+
+/*
+ * page_copy
+ *
+ * Return a new page holding the current contents of a page of zmp,
+ * or NULL if there is no memory for it.
+ *
+ */
+static page_t *page_copy(zword page)
+{
+	page_t *p = free_pages;
+
+	if (p != NULL)
+		free_pages = p->next;
+	else if ((p = malloc(sizeof(page_t))) == NULL)
+		return NULL;
+
+	p->refs = 1;
+	memmove(p->data, zmp + ((zlong) page << DIRTY_SHIFT), page_bytes(page));
+	return p;
+} /* page_copy */
+
+
+/*
+ * page_release
+ *
+ * Drop a reference to a page, keeping it for reuse once unused.
+ *
+ */
+static void page_release(page_t *p)
+{
+	if (--p->refs == 0) {
+		p->next = free_pages;
+		free_pages = p;
+	}
+} /* page_release */
+
+
+/*
+ * find_snapshot
+ *
+ * Return the link that points to the snapshot of a name, or to the
+ * end of its bucket if there is none.
+ *
+ */
+static snapshot_t **find_snapshot(const char *name)
+{
+	snapshot_t **link;
+	unsigned long h = 0;
+	const char *c;
+
+	for (c = name; *c; c++)
+		h = h * 31 + (unsigned char) *c;
+
+	link = &buckets[h % SNAPSHOT_BUCKETS];
+	while (*link != NULL && strcmp((*link)->name, name) != 0)
+		link = &(*link)->next;
+	return link;
+} /* find_snapshot */
+
+
+/*
+ * free_snapshot
+ *
+ * Release the pages of a snapshot and free it.
+ *
+ */
+static void free_snapshot(snapshot_t *s)
+{
+	zword page;
+
+	for (page = 0; page < page_count(); page++)
+		page_release(s->pages[page]);
+	free(s);
+} /* free_snapshot */
+
+
+/*
+ * snapshot_take
+ *
+ * Save the game state under a name, replacing any snapshot already
+ * of that name.  Return FALSE if there is no memory for it.
+ *
+ */
+bool snapshot_take(const char *name)
+{
+	snapshot_t **link;
+	snapshot_t *s;
+	page_t *p;
+	zword pages = page_count();
+	zword stack_size = stack + STACK_SIZE - sp;
+	zword page;
+	long pc;
+
+	/* Bring the live table up to date with zmp */
+	for (page = 0; page < pages; page++) {
+		if (live[page] == NULL || (dirty_pages[page] & DIRTY_SNAP)) {
+			if ((p = page_copy(page)) == NULL)
+				return FALSE;
+			if (live[page] != NULL)
+				page_release(live[page]);
+			live[page] = p;
+			dirty_pages[page] &= ~DIRTY_SNAP;
+		}
+	}
+
+	s = malloc(sizeof(snapshot_t) + pages * sizeof(page_t *)
+		+ stack_size * sizeof(*sp) + frame_count * sizeof(*frames)
+		+ strlen(name) + 1);
+	if (s == NULL)
+		return FALSE;
+	s->pages = (page_t **) (s + 1);
+	s->frame_data = (frame_t *) (s->pages + pages);
+	s->stack_data = (zword *) (s->frame_data + frame_count);
+	s->name = (char *) (s->stack_data + stack_size);
+
+	for (page = 0; page < pages; page++) {
+		s->pages[page] = live[page];
+		live[page]->refs++;
+	}
+	memmove(s->frame_data, frames, frame_count * sizeof(*frames));
+	memmove(s->stack_data, sp, stack_size * sizeof(*sp));
+	strcpy(s->name, name);
+	GET_PC(pc);
+	s->pc = pc;
+	s->stack_size = stack_size;
+	s->frame_offset = fp - stack;
+	s->frame_count = frame_count;
+
+	link = find_snapshot(name);
+	if (*link != NULL) {
+		s->next = (*link)->next;
+		free_snapshot(*link);
+	} else
+		s->next = NULL;
+	*link = s;
+	return TRUE;
+} /* snapshot_take */
+
+
+/*
+ * snapshot_restore
+ *
+ * Bring back the game state saved under a name, which stays saved.
+ * Return FALSE if there is no such snapshot, or if it was taken at
+ * another instruction: the caller is in the middle of an input
+ * instruction, which goes on to store its result with its own
+ * operands, so those have to be the snapshot's too.
+ *
+ */
+bool snapshot_restore(const char *name)
+{
+	snapshot_t *s = *find_snapshot(name);
+	page_t *p;
+	zword page;
+	long pc;
+
+	GET_PC(pc)
+	if (s == NULL || s->pc != pc)
+		return FALSE;
+
+	for (page = 0; page < page_count(); page++) {
+		p = s->pages[page];
+		if ((dirty_pages[page] & DIRTY_SNAP) || live[page] != p) {
+			memmove(zmp + ((zlong) page << DIRTY_SHIFT), p->data,
+				page_bytes(page));
+			p->refs++;
+			if (live[page] != NULL)
+				page_release(live[page]);
+			live[page] = p;
+			dirty_pages[page] = DIRTY_ALL & ~DIRTY_SNAP;
+		}
+	}
+
+	SET_PC(s->pc);
+	sp = stack + STACK_SIZE - s->stack_size;
+	fp = stack + s->frame_offset;
+	frame_count = s->frame_count;
+	memmove(sp, s->stack_data, s->stack_size * sizeof(*sp));
+	memmove(frames, s->frame_data, frame_count * sizeof(*frames));
+
+	restart_header();
+	load_globals();
+	flush_prop_cache();
+	return TRUE;
+} /* snapshot_restore */
+
+
+/*
+ * snapshot_pc
+ *
+ * Return the PC a snapshot was taken at, or -1 if there is none of
+ * that name.
+ *
+ */
+long snapshot_pc(const char *name)
+{
+	snapshot_t *s = *find_snapshot(name);
+
+	return s != NULL ? s->pc : -1;
+} /* snapshot_pc */
+
+
+/*
+ * snapshot_drop
+ *
+ * Forget the snapshot of a name, if there is one.
+ *
+ */
+void snapshot_drop(const char *name)
+{
+	snapshot_t **link = find_snapshot(name);
+	snapshot_t *s = *link;
+
+	if (s != NULL) {
+		*link = s->next;
+		free_snapshot(s);
+	}
+} /* snapshot_drop */
+
+
+/*
+ * snapshot_reset
+ *
+ * Forget every snapshot and free all pages, as when the story is
+ * unloaded.
+ *
+ */
+void snapshot_reset(void)
+{
+	snapshot_t *s;
+	page_t *p;
+	int i;
+
+	for (i = 0; i < SNAPSHOT_BUCKETS; i++) {
+		while ((s = buckets[i]) != NULL) {
+			buckets[i] = s->next;
+			free_snapshot(s);
+		}
+	}
+	for (i = 0; i < DIRTY_PAGES; i++) {
+		if (live[i] != NULL)
+			page_release(live[i]);
+		live[i] = NULL;
+	}
+	while ((p = free_pages) != NULL) {
+		free_pages = p->next;
+		free(p);
+	}
+} /* snapshot_reset */
+#endif /* SNAPSHOTS */
@@ -29,7 +29,7 @@
 #define EFFECT_STOP 3
 #define EFFECT_FINISH_WITH 4
 
-extern int direct_call(zword);
+extern void interrupt_call(zword, void (*)(zword));
 
 #ifndef NO_SOUND
 
@@ -147,7 +147,7 @@ void end_of_sound(void)
 		if (story_id == LURKING_HORROR)
 			start_next_sample();
 
-		direct_call(routine);
+		interrupt_call(routine, NULL);
 	}
 
 } /* end_of_sound */
@@ -0,0 +1,136 @@
+/* statehash.c - 64-bit hash of the game state
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Built with -DSTATE_HASH, state_hash() returns a 64-bit hash of
+ * dynamic memory, the stack, the call frames and the PC, for programs
+ * that need to tell whether they have seen a game state before.
+ *
+ * The hash is a tabulation (Zobrist) hash: the XOR of one key for
+ * every nonzero byte of dynamic memory, every stack entry and every
+ * field of the frames and registers, each key a mix of what the value
+ * is and where it sits.  Equal states hash alike however they were
+ * reached.  Dynamic memory is hashed a page at a time; the write
+ * barrier marks written pages DIRTY_HASH, and only those are hashed
+ * again, so a turn costs what it wrote.  The stack and frames are
+ * small and are folded in on every call, which is meant to be made at
+ * input boundaries.
+ *
+ */
+
+#include "frotz.h"
+
+#ifdef STATE_HASH
+
+#define KEY_STACK	((uint64_t) 1 << 56)
+#define KEY_FRAME_PC	((uint64_t) 2 << 56)
+#define KEY_FRAME	((uint64_t) 3 << 56)
+#define KEY_PC		((uint64_t) 4 << 56)
+#define KEY_REGS	((uint64_t) 5 << 56)
+
+static uint64_t page_hash[DIRTY_PAGES];
+static uint64_t memory_hash = 0;
+static bool hash_ready = FALSE;
+
+
+/*
+ * mix
+ *
+ * Turn a value into a well-spread key (the splitmix64 step).
+ *
+ */
+static uint64_t mix(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+} /* mix */
+
+
+/*
+ * hash_page
+ *
+ * Return the hash of one page of dynamic memory.
+ *
+ */
+static uint64_t hash_page(zword page)
+{
+	zlong addr = (zlong) page << DIRTY_SHIFT;
+	zlong end = addr + (1 << DIRTY_SHIFT);
+	uint64_t h = 0;
+
+	if (end > z_header.dynamic_size)
+		end = z_header.dynamic_size;
+	for (; addr < end; addr++)
+		if (zmp[addr] != 0)
+			h ^= mix(((uint64_t) addr << 8) | zmp[addr]);
+	return h;
+} /* hash_page */
+
+
+/*
+ * state_hash
+ *
+ * Return the hash of the current game state.
+ *
+ */
+uint64_t state_hash(void)
+{
+	zword pages = ((zlong) z_header.dynamic_size + (1 << DIRTY_SHIFT) - 1)
+		>> DIRTY_SHIFT;
+	zword page;
+	zword *p;
+	uint64_t h, old;
+	long pc;
+	int i;
+
+	if (!hash_ready) {
+		for (page = 0; page < pages; page++)
+			dirty_pages[page] |= DIRTY_HASH;
+		hash_ready = TRUE;
+	}
+
+	for (page = 0; page < pages; page++) {
+		if (dirty_pages[page] & DIRTY_HASH) {
+			old = page_hash[page];
+			page_hash[page] = hash_page(page);
+			memory_hash ^= old ^ page_hash[page];
+			dirty_pages[page] &= ~DIRTY_HASH;
+		}
+	}
+
+	h = memory_hash;
+	for (p = sp; p < stack + STACK_SIZE; p++)
+		h ^= mix(KEY_STACK
+			 | ((uint64_t) (stack + STACK_SIZE - p) << 16) | *p);
+	for (i = 0; i < frame_count; i++) {
+		h ^= mix(KEY_FRAME_PC | ((uint64_t) i << 40)
+			 | (zlong) frames[i].pc);
+		h ^= mix(KEY_FRAME | ((uint64_t) i << 40)
+			 | ((uint64_t) (frames[i].fp - stack) << 24)
+			 | ((zlong) frames[i].argc << 16)
+			 | ((zlong) frames[i].type << 8) | frames[i].count);
+	}
+	GET_PC(pc);
+	h ^= mix(KEY_PC | (zlong) pc);
+	h ^= mix(KEY_REGS | ((uint64_t) (fp - stack) << 16) | frame_count);
+	return h;
+} /* state_hash */
+#endif /* STATE_HASH */
@@ -65,8 +65,6 @@ extern zchar replay_read_input(zchar *);
 extern zchar console_read_key(zword);
 extern zchar console_read_input(int, zchar *, zword, bool);
 
-extern int direct_call(zword);
-
 
 /*
  * stream_mssg_on
@@ -243,13 +241,22 @@ void z_input_stream(void)
 /*
  * stream_read_key
  *
- * Read a single keystroke from the current input stream.
+ * Read a single keystroke from the current input stream. Return
+ * ZC_TIME_OUT when the timeout routine has to be run; the caller then
+ * calls again with "timed_out" set to whether the routine returned
+ * true, or to -1 for a new read.
  *
  */
-zchar stream_read_key(zword timeout, zword routine, bool hot_keys)
+zchar stream_read_key(zword timeout, zword routine, bool hot_keys,
+		      int timed_out)
 {
 	zchar key = ZC_BAD;
-	flush_buffer();
+
+	/* Carry on after the timeout routine, or stop if it says so */
+	if (timed_out > 0)
+		return ZC_TIME_OUT;
+	if (timed_out < 0)
+		flush_buffer();
 
 	/* Read key from current input stream */
 continue_input:
@@ -275,9 +282,11 @@ continue_input:
 
 	/* Handle timeouts */
 
-	if (key == ZC_TIME_OUT)
-		if (direct_call (routine) == 0)
+	if (key == ZC_TIME_OUT) {
+		if (routine == 0)
 			goto continue_input;
+		return key;
+	}
 
 	/* Handle hot keys */
 
@@ -297,15 +306,25 @@ continue_input:
 /*
  * stream_read_input
  *
- * Read a line of input from the current input stream.
+ * Read a line of input from the current input stream. Timeouts work
+ * as for stream_read_key; "buf" must keep the input typed so far until
+ * the caller calls again.
  *
  */
 zchar stream_read_input(int max, zchar * buf,
 			zword timeout, zword routine,
-			bool hot_keys, bool no_scripting)
+			bool hot_keys, bool no_scripting, int timed_out)
 {
 	zchar key = ZC_BAD;
 
+	/* Carry on after the timeout routine, or stop if it says so */
+	if (timed_out >= 0) {
+		key = ZC_TIME_OUT;
+		if (timed_out > 0)
+			goto stop_input;
+		goto continue_input;
+	}
+
 	flush_buffer();
 
 #ifndef NO_SCRIPT
@@ -342,9 +361,11 @@ continue_input:
 
 	/* Handle timeouts */
 
-	if (key == ZC_TIME_OUT)
-		if (direct_call (routine) == 0)
+	if (key == ZC_TIME_OUT) {
+		if (routine == 0)
 			goto continue_input;
+		return key;
+	}
 
 	/* Handle hot keys */
 	if (hot_keys && key >= ZC_HKEY_MIN && key <= ZC_HKEY_MAX) {
@@ -353,6 +374,7 @@ continue_input:
 		return ZC_BAD;
 	}
 
+stop_input:
 #ifndef NO_SCRIPT
 	/* Copy input line to transcript file or to the screen */
 	if (ostream_script && enable_scripting && !no_scripting)
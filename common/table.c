@@ -18,6 +18,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <string.h>
 #include "frotz.h"
 
 
@@ -57,12 +58,21 @@ void z_copy_table(void)
 		}
 	}
 #else
-	if (zargs[1] == 0)	/* zero table */
+	if (zargs[1] == 0) {	/* zero table */
+		if (fill_block(zargs[0], 0, size))
+			return;
 		for (i = 0; i < size; i++)
 			storeb((zword) (zargs[0] + i), 0);
 
-	else if ((short)size < 0 || zargs[0] > zargs[1]) { /* copy forwards */
-		for (i = 0; i < (((short)size < 0) ? -(short)size : size); i++) {
+	} else if ((short)size < 0 || zargs[0] > zargs[1]) { /* copy forwards */
+		zword count = ((short)size < 0) ? -(short)size : size;
+
+		/* Copying forwards onto the rest of the table smears it */
+		if ((zargs[0] > zargs[1] || zargs[0] + count <= zargs[1])
+		    && zargs[0] + count <= story_size
+		    && store_block(zargs[1], zmp + zargs[0], count))
+			return;
+		for (i = 0; i < count; i++) {
 			addr = zargs[0] + i;
 			LOW_BYTE(addr, value)
 			    storeb((zword) (zargs[1] + i), value);
@@ -70,6 +80,11 @@ void z_copy_table(void)
 	}
 #endif
 	else {	/* copy backwards */
+#ifndef TOPS20
+		if (zargs[0] + size <= story_size
+		    && store_block(zargs[1], zmp + zargs[0], size))
+			return;
+#endif
 		for (i = size - 1; i >= 0; i--) {
 			addr = zargs[0] + i;
 			LOW_BYTE(addr, value)
@@ -123,6 +138,52 @@ void z_loadw(void)
 } /* z_loadw */
 
 
+#ifndef TOPS20
+/*
+ * scan_words
+ *
+ * Return the index of the first of count big-endian words at p that
+ * equals value, or -1.  The words are compared a machine word's worth
+ * at a time: XOR with the replicated target leaves a zero 16-bit lane
+ * where they match, which the usual carry trick picks up.
+ *
+ */
+static long scan_words(const zbyte *p, zword count, zword value)
+{
+	const unsigned long ones = (unsigned long) -1 / 0xffff;
+	const unsigned long high = ones << 15;
+	zbyte pattern[sizeof(unsigned long)];
+	unsigned long key;
+	unsigned long v;
+	zbyte hi = value >> 8;
+	zbyte lo = value & 0xff;
+	long per = sizeof(unsigned long) / 2;
+	long i;
+
+	for (i = 0; i < per; i++) {
+		pattern[2 * i] = hi;
+		pattern[2 * i + 1] = lo;
+	}
+	memcpy(&key, pattern, sizeof(key));
+
+	/* Skip whole machine words without a match */
+	for (i = 0; i + per <= count; i += per) {
+		memcpy(&v, p + 2 * i, sizeof(v));
+		v ^= key;
+		if ((v - ones) & ~v & high)
+			break;
+	}
+
+	/* Find the match, or check the leftover words */
+	for (; i < count; i++) {
+		if (p[2 * i] == hi && p[2 * i + 1] == lo)
+			return i;
+	}
+	return -1;
+} /* scan_words */
+#endif
+
+
 /*
  * z_scan_table, find and store the address of a target within a table.
  *
@@ -144,6 +205,24 @@ void z_scan_table(void)
 	if (zargc < 4)
 		zargs[3] = 0x82;
 
+#ifndef TOPS20
+	/* Plain word and byte arrays that lie inside the story */
+	if (zargs[3] == 0x82 && addr + 2L * zargs[2] <= story_size) {
+		long n = scan_words(zmp + addr, zargs[2], zargs[0]);
+
+		addr = (n < 0) ? 0 : addr + 2 * n;
+		goto finished;
+	}
+	if (zargs[3] == 0x01 && addr + (long) zargs[2] <= story_size) {
+		const zbyte *p = NULL;
+
+		if (zargs[0] <= 0xff)
+			p = memchr(zmp + addr, zargs[0], zargs[2]);
+		addr = (p == NULL) ? 0 : p - zmp;
+		goto finished;
+	}
+#endif
+
 	/* Scan byte or word array */
 	for (i = 0; i < zargs[2]; i++) {
 		if (zargs[3] & 0x80) {	/* scan word array */
@@ -200,7 +200,7 @@ static zchar alphabet(int set, int index)
  */
 static void load_string(zword addr, zword length)
 {
-	int resolution = (z_header.version <= V3) ? 2 : 3;
+	int resolution = z_variant.text_resolution;
 	int i = 0;
 
 	while (i < 3 * resolution) {
@@ -243,7 +243,7 @@ static void encode_text(int padding)
 	zbyte zchars[12];
 	const zchar *ptr = decoded;
 	zchar c;
-	int resolution = (z_header.version <= V3) ? 2 : 3;
+	int resolution = z_variant.text_resolution;
 	int i = 0;
 
 	/* Expand abbreviations that some old Infocom games lack */
@@ -410,15 +410,8 @@ static void decode_text(enum string_type st, zword z_addr)
 
 	else if (st == HIGH_STRING) {
 
-		if (z_header.version <= V3)
-			byte_addr = (long)addr << 1;
-		else if (z_header.version <= V5)
-			byte_addr = (long)addr << 2;
-		else if (z_header.version <= V7)
-			byte_addr =
-				((long)addr << 2) + ((long)z_header.strings_offset << 3);
-		else		/* (z_header.version == V8) */
-			byte_addr = (long)addr << 3;
+		byte_addr = ((long)addr << z_variant.packed_shift)
+			+ z_variant.string_offset;
 
 		if (byte_addr >= story_size)
 			runtime_error(ERR_ILL_PRINT_ADDR);
@@ -432,11 +425,11 @@ static void decode_text(enum string_type st, zword z_addr)
 	do {
 		int i;
 
-		if (addr > 0xffff)
-			runtime_error(ERR_ILL_PRINT_ADDR);
-
 		/* Fetch the next 16bit word */
 		if (st == LOW_STRING || st == VOCABULARY) {
+			/* Only these can run off the end of low memory */
+			if (addr > 0xffff)
+				runtime_error(ERR_ILL_PRINT_ADDR);
 
 		/* The LOW_WORD() macro for TurboC can't handle a zword
 		   passed as the address because that macro assumes the
@@ -444,8 +437,10 @@ static void decode_text(enum string_type st, zword z_addr)
 		   find a clean way to rewrite that macro.  DG.
 		*/
 #if defined __TURBOC__
-			zword addr_clipped = (zword) addr;
-			LOW_WORD(addr_clipped, code)
+			{
+				zword addr_clipped = (zword) addr;
+				LOW_WORD(addr_clipped, code)
+			}
 #else
 			LOW_WORD(addr, code)
 #endif
@@ -467,24 +462,22 @@ static void decode_text(enum string_type st, zword z_addr)
 			case 0:	/* normal operation */
 				if (shift_state == 2 && c == 6)
 					status = 2;
-				else if (z_header.version == V1 && c == 1)
-					new_line();
-				else if (z_header.version >= V2
-					 && shift_state == 2 && c == 7)
+				else if (c == 1 && z_variant.abbrev_zchars == 0)
+					new_line();	/* V1 only */
+				else if (shift_state == 2 && c == 7
+					 && z_variant.abbrev_zchars != 0)
 					new_line();
 				else if (c >= 6)
 					outchar(alphabet
 						(shift_state, c - 6));
 				else if (c == 0)
 					outchar(' ');
-				else if (z_header.version >= V2 && c == 1)
-					status = 1;
-				else if (z_header.version >= V3 && c <= 3)
+				else if (c <= z_variant.abbrev_zchars)
 					status = 1;
 				else {
 					shift_state =
 					    (shift_lock + (c & 1) + 1) % 3;
-					if (z_header.version <= V2 && c >= 4)
+					if (z_variant.shift_lock && c >= 4)
 						shift_lock = shift_state;
 					break;
 				}
@@ -782,7 +775,7 @@ static zword lookup_text(int padding, zword dct)
 	zword addr;
 	zbyte entry_len;
 	zbyte sep_count;
-	int resolution = (z_header.version <= V3) ? 2 : 3;
+	int resolution = z_variant.text_resolution;
 	int entry_number;
 	int lower, upper;
 	int i;
@@ -0,0 +1,561 @@
+/* undo.c - Undo block store
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * save_undo hands us each undo block as an opaque run of bytes, and
+ * restore_undo asks for them back newest first.  Blocks are kept in
+ * three tiers, oldest to newest:
+ *
+ *   spilled  LZ-packed in a temporary file (only with UNDO_SPILL)
+ *   packed   LZ-packed in the packed arena
+ *   raw      as given, in the raw arena
+ *
+ * The last UNDO_RAW_BLOCKS blocks stay raw, so the undo a player is
+ * most likely to ask for costs no more than it did.  As a block ages
+ * it moves down a tier; when the last tier is full the oldest block
+ * is dropped.  Each tier is a ring, in the arena or in the file: a
+ * block starts where the one before it ends, wrapping round to the
+ * start when there is no room at the end.
+ *
+ * Blocks are kept in order in a ring of headers, so each tier is a
+ * contiguous run of it and its ring ends are found from its first
+ * and last blocks.
+ *
+ * Everything the store allocates comes out of the -U budget: the
+ * headers, both arenas and the one buffer a block is packed into or
+ * unpacked into.  A block too big for the raw arena cannot be saved,
+ * and one that does not fit the packed arena even packed is dropped
+ * with everything older when it ages out of the raw tier.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frotz.h"
+
+extern f_setup_t f_setup;
+
+#define UNDO_ALIGN 8
+
+/* The spill file may grow to this many times the arenas */
+#define UNDO_SPILL_FACTOR 16
+
+typedef struct {
+	long offset;		/* where the block lies in its tier */
+	long size;		/* bytes it takes there */
+	long raw_size;		/* bytes it takes unpacked */
+	bool packed;		/* FALSE if packing did not make it smaller */
+} block_t;
+
+enum { SPILLED, PACKED, RAW, TIERS };
+
+static block_t *blocks = NULL;
+static int slots = 0;
+static int first = 0;		/* index of the oldest block */
+static int count = 0;		/* blocks held */
+static int cursor = 0;		/* blocks up to and including the current one */
+static int tier_count[TIERS];	/* blocks held in each tier */
+static long tier_size[TIERS];	/* capacity of each tier */
+
+static long store_size = 0;	/* bytes allocated for all of the above */
+
+static zbyte huge *raw_arena = NULL;
+static zbyte huge *packed_arena = NULL;
+static zbyte huge *block_buf = NULL;	/* a block packed or unpacked */
+
+#ifdef UNDO_SPILL
+static FILE *spill_fp = NULL;
+static bool spill_failed = FALSE;
+#endif
+
+#define BLOCK(n) (&blocks[(first + (n)) % slots])
+
+
+/*
+ * lz_pack
+ *
+ * LZSS-pack size bytes from src into dst, which must hold
+ * size + size / 8 + 1 bytes.  Each group of up to eight items starts
+ * with a flag byte; a set bit stands for a match, two bytes giving a
+ * 12-bit distance and a length of 3 to 18, and a clear one for a
+ * literal byte.  Return the packed length.
+ *
+ */
+#define LZ_HASH_BITS 12
+#define LZ_WINDOW 4096
+#define LZ_MIN 3
+#define LZ_MAX 18
+#define LZ_HASH(p) \
+	((((p)[0] << 8) ^ ((p)[1] << 4) ^ (p)[2]) & ((1 << LZ_HASH_BITS) - 1))
+
+static long lz_pack(const zbyte huge *src, long size, zbyte huge *dst)
+{
+	static long head[1 << LZ_HASH_BITS];
+	zbyte huge *out = dst;
+	zbyte huge *flags;
+	long i = 0;
+	long match, len, max, k;
+	int bit, h;
+
+	for (h = 0; h < 1 << LZ_HASH_BITS; h++)
+		head[h] = -1;
+
+	while (i < size) {
+		flags = out++;
+		*flags = 0;
+		for (bit = 0; bit < 8 && i < size; bit++) {
+			len = 0;
+			match = -1;
+			if (i + LZ_MIN <= size) {
+				h = LZ_HASH(src + i);
+				match = head[h];
+				head[h] = i;
+				if (match >= 0 && i - match <= LZ_WINDOW) {
+					max = size - i;
+					if (max > LZ_MAX)
+						max = LZ_MAX;
+					while (len < max && src[match + len] == src[i + len])
+						len++;
+				}
+			}
+			if (len >= LZ_MIN) {
+				k = i - match - 1;
+				*flags |= 1 << bit;
+				*out++ = k & 0xff;
+				*out++ = ((k >> 8) << 4) | (len - LZ_MIN);
+				for (k = 1; k < len; k++)
+					if (i + k + LZ_MIN <= size)
+						head[LZ_HASH(src + i + k)] = i + k;
+				i += len;
+			} else
+				*out++ = src[i++];
+		}
+	}
+	return out - dst;
+} /* lz_pack */
+
+
+/*
+ * lz_unpack
+ *
+ * Unpack size bytes of lz_pack output into dst, reading them from src
+ * or, if src is NULL, from the file fp.
+ *
+ */
+#define LZ_BYTE() (src != NULL ? *src++ : (zbyte) getc(fp))
+
+static void lz_unpack(const zbyte huge *src, FILE *fp, long size,
+		      zbyte huge *dst)
+{
+	zbyte flags, lo, hi;
+	long dist;
+	int bit, len;
+
+	while (size > 0) {
+		flags = LZ_BYTE();
+		size--;
+		for (bit = 0; bit < 8 && size > 0; bit++) {
+			if (flags & (1 << bit)) {
+				lo = LZ_BYTE();
+				hi = LZ_BYTE();
+				size -= 2;
+				dist = (lo | ((long) (hi >> 4) << 8)) + 1;
+				len = (hi & 0x0f) + LZ_MIN;
+				while (len--) {
+					*dst = dst[-dist];
+					dst++;
+				}
+			} else {
+				*dst++ = LZ_BYTE();
+				size--;
+			}
+		}
+	}
+} /* lz_unpack */
+
+#undef LZ_BYTE
+
+
+/*
+ * tier_start
+ *
+ * Return the number of blocks older than the first one of a tier.
+ *
+ */
+static int tier_start(int tier)
+{
+	int n = 0;
+
+	while (tier--)
+		n += tier_count[tier];
+	return n;
+} /* tier_start */
+
+
+/*
+ * tier_place
+ *
+ * Find room for size bytes after the newest block of a tier, wrapping
+ * round to the start if there is none at the end.  Return the offset,
+ * or -1 if the older blocks of the tier are in the way.
+ *
+ */
+static long tier_place(int tier, long size)
+{
+	block_t *oldest, *newest;
+	long start, end;
+	int n = tier_start(tier);
+
+	if (tier_count[tier] == 0)
+		return size <= tier_size[tier] ? 0 : -1;
+
+	oldest = BLOCK(n);
+	newest = BLOCK(n + tier_count[tier] - 1);
+	start = newest->offset;
+	end = start + newest->size;
+	if (start >= oldest->offset) {
+		if (end + size <= tier_size[tier])
+			return end;
+		if (size <= oldest->offset)
+			return 0;
+	} else if (end + size <= oldest->offset)
+		return end;
+	return -1;
+} /* tier_place */
+
+
+/*
+ * drop_oldest
+ *
+ * Forget the oldest block.
+ *
+ */
+static void drop_oldest(void)
+{
+	int tier;
+
+	for (tier = 0; tier < TIERS; tier++) {
+		if (tier_count[tier] > 0) {
+			tier_count[tier]--;
+			break;
+		}
+	}
+	first = (first + 1) % slots;
+	count--;
+	if (cursor > 0)
+		cursor--;
+} /* drop_oldest */
+
+
+#ifdef UNDO_SPILL
+/*
+ * spill_oldest
+ *
+ * Move the oldest packed block out to the spill file, opening it on
+ * first use.  Return FALSE if it cannot be written.
+ *
+ */
+static bool spill_oldest(void)
+{
+	block_t *b = BLOCK(tier_count[SPILLED]);
+	long offset;
+
+	if (spill_failed)
+		return FALSE;
+	if (spill_fp == NULL && (spill_fp = tmpfile()) == NULL) {
+		spill_failed = TRUE;
+		return FALSE;
+	}
+
+	while ((offset = tier_place(SPILLED, b->size)) < 0) {
+		if (tier_count[SPILLED] == 0)
+			return FALSE;
+		drop_oldest();
+		b = BLOCK(tier_count[SPILLED]);
+	}
+	if (fseek(spill_fp, offset, SEEK_SET) != 0
+	    || fwrite(packed_arena + b->offset, 1, b->size, spill_fp)
+		!= (size_t) b->size) {
+		spill_failed = TRUE;
+		return FALSE;
+	}
+	b->offset = offset;
+	tier_count[PACKED]--;
+	tier_count[SPILLED]++;
+	return TRUE;
+} /* spill_oldest */
+#endif
+
+
+/*
+ * pack_oldest
+ *
+ * Pack the oldest raw block into the packed arena, making room there
+ * by spilling or dropping older blocks.  If it does not fit even in
+ * an empty arena, drop it instead, along with the older blocks that
+ * would need it to be undone.
+ *
+ */
+static void pack_oldest(void)
+{
+	block_t *b = BLOCK(tier_start(RAW));
+	const zbyte huge *data;
+	long size, offset;
+	int n;
+
+	size = lz_pack(raw_arena + b->offset, b->raw_size, block_buf);
+	b->packed = size < b->raw_size;
+	if (b->packed)
+		data = block_buf;
+	else {
+		data = raw_arena + b->offset;
+		size = b->raw_size;
+	}
+
+	if (size > tier_size[PACKED]) {
+		for (n = tier_start(RAW); n >= 0; n--)
+			drop_oldest();
+		return;
+	}
+
+	while ((offset = tier_place(PACKED, size)) < 0) {
+#ifdef UNDO_SPILL
+		if (spill_oldest())
+			continue;
+#endif
+		drop_oldest();
+	}
+	memmove(packed_arena + offset, data, size);
+	b->offset = offset;
+	b->size = size;
+	tier_count[RAW]--;
+	tier_count[PACKED]++;
+} /* pack_oldest */
+
+
+/*
+ * undo_open
+ *
+ * Set up a store of f_setup.undo_slots blocks, none of which may be
+ * bigger than largest, in undo_size bytes all told.  After the
+ * headers, half the bytes go to the raw arena and the buffer for
+ * packing its blocks, and half to the packed arena.  Return FALSE,
+ * with a warning, if the bytes do not even leave room for the arenas,
+ * or if there is not the memory for the store.
+ *
+ */
+bool undo_open(long undo_size, long largest)
+{
+	long raw_size, packed_size, buf_size, block_max;
+	long headers = f_setup.undo_slots * (long) sizeof(*blocks);
+
+	/* The buffer takes a packed block, an eighth more than raw */
+	raw_size = (((undo_size - headers) / 2) * 8 / 17)
+		& ~(long) (UNDO_ALIGN - 1);
+	block_max = raw_size < largest ? raw_size : largest;
+	buf_size = block_max + block_max / 8 + 1;
+	packed_size = (undo_size - headers - raw_size - buf_size)
+		& ~(long) (UNDO_ALIGN - 1);
+	if (raw_size < UNDO_ALIGN || packed_size < 0) {
+		os_warn("%ld bytes are too few for %d undo slots; undo is off",
+			undo_size, f_setup.undo_slots);
+		return FALSE;
+	}
+
+	slots = f_setup.undo_slots;
+	first = count = cursor = 0;
+	memset(tier_count, 0, sizeof(tier_count));
+	tier_size[RAW] = raw_size;
+	tier_size[PACKED] = packed_size;
+	tier_size[SPILLED] = (raw_size + packed_size) * UNDO_SPILL_FACTOR;
+	store_size = headers + raw_size + packed_size + buf_size;
+
+	blocks = zmalloc(slots * sizeof(*blocks));
+	raw_arena = zmalloc(raw_size);
+	if (packed_size > 0)
+		packed_arena = zmalloc(packed_size);
+	block_buf = zmalloc(buf_size);
+
+	if (blocks == NULL || raw_arena == NULL || block_buf == NULL
+	    || (packed_size > 0 && packed_arena == NULL)) {
+		undo_close();
+		return FALSE;
+	}
+	return TRUE;
+} /* undo_open */
+
+
+/*
+ * undo_close
+ *
+ * Free the store and remove its spill file.
+ *
+ */
+void undo_close(void)
+{
+	if (blocks != NULL) zfree(blocks);
+	if (raw_arena != NULL) zfree(raw_arena);
+	if (packed_arena != NULL) zfree(packed_arena);
+	if (block_buf != NULL) zfree(block_buf);
+	blocks = NULL;
+	raw_arena = packed_arena = block_buf = NULL;
+	slots = first = count = cursor = 0;
+	store_size = 0;
+	memset(tier_count, 0, sizeof(tier_count));
+	memset(tier_size, 0, sizeof(tier_size));
+
+#ifdef UNDO_SPILL
+	if (spill_fp != NULL)
+		fclose(spill_fp);
+	spill_fp = NULL;
+	spill_failed = FALSE;
+#endif
+} /* undo_close */
+
+
+/*
+ * undo_push
+ *
+ * Forget the blocks after the current one and make room for a new
+ * one of size bytes, which becomes the current block.  Return where
+ * to put it, or NULL if it will not fit.
+ *
+ */
+zbyte huge *undo_push(long size)
+{
+	block_t *b;
+	long aligned, offset;
+
+	if (slots == 0)
+		return NULL;
+
+	count = cursor;
+	if (tier_count[SPILLED] > count) {
+		tier_count[SPILLED] = count;
+		tier_count[PACKED] = 0;
+	} else if (tier_count[SPILLED] + tier_count[PACKED] > count)
+		tier_count[PACKED] = count - tier_count[SPILLED];
+	tier_count[RAW] = count - tier_start(RAW);
+
+	if (count == slots)
+		drop_oldest();
+
+	aligned = (size + UNDO_ALIGN - 1) & ~(long) (UNDO_ALIGN - 1);
+	if (aligned > tier_size[RAW]) {
+		while (count > 0)
+			drop_oldest();
+		return NULL;
+	}
+
+	while (tier_count[RAW] >= UNDO_RAW_BLOCKS)
+		pack_oldest();
+	while ((offset = tier_place(RAW, aligned)) < 0)
+		pack_oldest();
+
+	b = BLOCK(count);
+	b->offset = offset;
+	b->size = aligned;
+	b->raw_size = size;
+	b->packed = FALSE;
+	tier_count[RAW]++;
+	cursor = ++count;
+	return raw_arena + offset;
+} /* undo_push */
+
+
+/*
+ * undo_top
+ *
+ * Return the current block, unpacked if need be, or NULL if there is
+ * none.  An unpacked block lasts until the next call.
+ *
+ */
+zbyte huge *undo_top(void)
+{
+	block_t *b;
+	zbyte huge *data;
+	int n = cursor - 1;
+
+	if (cursor == 0)
+		return NULL;
+
+	b = BLOCK(n);
+	if (n >= tier_start(RAW))
+		return raw_arena + b->offset;
+
+	if (n < tier_count[SPILLED]) {
+#ifdef UNDO_SPILL
+		if (fseek(spill_fp, b->offset, SEEK_SET) != 0)
+			return NULL;
+		if (!b->packed) {
+			if (fread(block_buf, 1, b->size, spill_fp)
+			    != (size_t) b->size)
+				return NULL;
+		} else {
+			lz_unpack(NULL, spill_fp, b->size, block_buf);
+			if (ferror(spill_fp) || feof(spill_fp))
+				return NULL;
+		}
+		return block_buf;
+#else
+		return NULL;
+#endif
+	}
+
+	data = packed_arena + b->offset;
+	if (b->packed)
+		lz_unpack(data, NULL, b->size, block_buf);
+	else
+		memmove(block_buf, data, b->size);
+	return block_buf;
+} /* undo_top */
+
+
+/*
+ * undo_pop
+ *
+ * Make the block before the current one current.
+ *
+ */
+void undo_pop(void)
+{
+	if (cursor > 0)
+		cursor--;
+} /* undo_pop */
+
+
+/*
+ * undo_usage
+ *
+ * Report the number of undo blocks held and the bytes they take in
+ * memory, out of the bytes the store has allocated.  Spilled blocks
+ * count towards the first figure but not the others.
+ *
+ */
+void undo_usage(int *blocks_held, long *used, long *size)
+{
+	int n;
+
+	*blocks_held = count;
+	*used = 0;
+	for (n = tier_count[SPILLED]; n < count; n++)
+		*used += BLOCK(n)->size;
+	*size = store_size;
+} /* undo_usage */
@@ -47,13 +47,12 @@ void z_dec(void)
 		sv -= 1;
 		*(fp - z0) = ((zword) (sv & 0xffff));
 	} else {
-		zword addr = z_header.globals + 2 * (z0 - 16);
-		LOW_WORD(addr, value)
+		GET_GLOBAL(z0, value)
 		sv=s16(value);
 		sv--;
 		value = (zword) sv;
 		value &= 0xffff;
-		SET_WORD(addr, value)
+		SET_GLOBAL(z0, value)
 	}
 #else
 	if (zargs[0] == 0)
@@ -61,10 +60,9 @@ void z_dec(void)
 	else if (zargs[0] < 16)
 		(*(fp - zargs[0]))--;
 	else {
-		zword addr = z_header.globals + 2 * (zargs[0] - 16);
-		LOW_WORD(addr, value)
+		GET_GLOBAL(zargs[0], value)
 		value--;
-		SET_WORD(addr, value)
+		SET_GLOBAL(zargs[0], value)
 	}
 #endif
 } /* z_dec */
@@ -103,11 +101,10 @@ void z_dec_chk(void)
 		*(fp - z0) = value;
 	}
 	else {
-		zword addr = z_header.globals + 2 * (z0 - 16);
-		LOW_WORD(addr, value)
+		GET_GLOBAL(z0, value)
 		value--;
 		value &= 0xffff;
-		SET_WORD(addr, value)
+		SET_GLOBAL(z0, value)
 	}
 	sv = s16(value);
 	sz1 = s16(z1);
@@ -118,10 +115,9 @@ void z_dec_chk(void)
 	else if (zargs[0] < 16)
 		value = --(*(fp - zargs[0]));
 	else {
-		zword addr = z_header.globals + 2 * (zargs[0] - 16);
-		LOW_WORD(addr, value)
+		GET_GLOBAL(zargs[0], value)
 		value--;
-		SET_WORD(addr, value)
+		SET_GLOBAL(zargs[0], value)
 	}
 	branch((short)value < (short)zargs[1]);
 #endif
@@ -155,11 +151,10 @@ void z_inc(void)
 		value = (((zword) sv) & 0xffff);
 		*(fp - z0) = value;
 	} else {
-		zword addr = z_header.globals + 2 * (z0 - 16);
-		LOW_WORD(addr, value)
+		GET_GLOBAL(z0, value)
 		value++;
 		value &= 0xffff;
-		SET_WORD(addr, value)
+		SET_GLOBAL(z0, value)
 	}
 #else
 
@@ -168,10 +163,9 @@ void z_inc(void)
 	else if (zargs[0] < 16)
 		(*(fp - zargs[0]))++;
 	else {
-		zword addr = z_header.globals + 2 * (zargs[0] - 16);
-		LOW_WORD(addr, value)
+		GET_GLOBAL(zargs[0], value)
 		    value++;
-		SET_WORD(addr, value)
+		SET_GLOBAL(zargs[0], value)
 	}
 #endif
 } /* z_inc */
@@ -206,11 +200,10 @@ void z_inc_chk(void)
 		value = (((zword) sv) & 0xffff);
 		*(fp - z0) = value;
 	} else {
-		zword addr = z_header.globals + 2 * (z0 - 16);
-		LOW_WORD(addr, value)
+		GET_GLOBAL(z0, value)
 		value++;
 		value &= 0xffff;
-		SET_WORD (addr, value)
+		SET_GLOBAL(z0, value)
 	}
 	sv=s16(value);
 	branch (sv > sz1);
@@ -220,10 +213,9 @@ void z_inc_chk(void)
 	else if (zargs[0] < 16)
 		value = ++(*(fp - zargs[0]));
 	else {
-		zword addr = z_header.globals + 2 * (zargs[0] - 16);
-		LOW_WORD(addr, value)
+		GET_GLOBAL(zargs[0], value)
 		value++;
-		SET_WORD(addr, value)
+		SET_GLOBAL(zargs[0], value)
 	}
 	branch((short)value > (short)zargs[1]);
 #endif
@@ -252,8 +244,7 @@ void z_load(void)
 	else if (z0 < 16)
 		value = *(fp - z0);
 	else {
-		zword addr = z_header.globals + 2 * (z0 - 16);
-		LOW_WORD (addr, value)
+		GET_GLOBAL(z0, value)
 	}
 	store(value & 0xffff);
 #else
@@ -262,8 +253,7 @@ void z_load(void)
 	else if (zargs[0] < 16)
 		value = *(fp - zargs[0]);
 	else {
-		zword addr = z_header.globals + 2 * (zargs[0] - 16);
-		LOW_WORD(addr, value)
+		GET_GLOBAL(zargs[0], value)
 	}
 	store(value);
 #endif
@@ -327,8 +317,7 @@ void z_pull(void)
 		else if (zargs[0] < 16)
 			*(fp - zargs[0]) = value;
 		else {
-			zword addr = z_header.globals + 2 * (zargs[0] - 16);
-			SET_WORD(addr, value)
+			SET_GLOBAL(zargs[0], value)
 		}
 	} else {		/* it's V6, but is there a user stack? */
 		if (zargc == 1) {	/* it's a user stack */
@@ -398,7 +387,6 @@ void z_store(void)
 	else if (zargs[0] < 16)
 		*(fp - zargs[0]) = value;
 	else {
-		zword addr = z_header.globals + 2 * (zargs[0] - 16);
-		SET_WORD(addr, value)
+		SET_GLOBAL(zargs[0], value)
 	}
 } /* z_store */
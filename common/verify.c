@@ -0,0 +1,389 @@
+/* verify.c - Load-time check of a story's code
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Built with -DVERIFY_STORY, the story's code is checked before it
+ * runs.  Starting from the initial PC, every routine that can be
+ * reached through a call to a constant address is walked instruction
+ * by instruction along every branch.  A routine passes when
+ *
+ * - its header and code lie in static memory,
+ * - every opcode is legal for the story's version,
+ * - every local variable it names, directly, as a store target or
+ *   through a constant indirect variable operand, is one it has,
+ * - every branch and jump lands inside the routine,
+ * - every inline string ends inside the story, and
+ * - no path pops the stack below the routine's own frame, counting
+ *   the items a V6 pop_stack drops, which must be a constant.
+ *
+ * The start code of a V1-5 story is checked the same way, except that
+ * it has no frame to return to, so it must not return at all.
+ *
+ * If everything reachable passes, set_trusted_handlers() installs
+ * return and jump handlers without the stack and address checks.
+ * Routines that are only reached through a variable (property
+ * routines, interrupts and so on) are checked by verify_call() the
+ * first time they are called.  The first routine that fails, and any
+ * restore from a file (whose frames may belong to routines not yet
+ * seen), puts the usual handlers back for good.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "frotz.h"
+
+#ifdef VERIFY_STORY
+
+#ifdef TOPS20
+#error "VERIFY_STORY assumes 16-bit words"
+#endif
+
+#define VERIFY_SPAN	0x4000	/* longest routine, in bytes */
+#define VERIFY_WORK	1024	/* instructions waiting to be checked */
+#define VERIFY_QUEUE	2048	/* routines waiting to be checked */
+#define NO_DEPTH	0x7fff
+
+extern void (*op0_opcodes[]) (void);
+extern void (*op1_opcodes[]) (void);
+extern void (*var_opcodes[]) (void);
+extern void (*ext_opcodes[]) (void);
+
+static bool trusted = FALSE;
+
+static zbyte seen[0x10000 / 8];	/* one bit per packed routine address */
+static zword queue[VERIFY_QUEUE];
+static int queued;
+
+static short *depth = NULL;	/* stack depth at each byte of a routine */
+static long work[VERIFY_WORK];
+
+#define SEEN(r)		(seen[(r) >> 3] & (1 << ((r) & 7)))
+#define MARK(r)		(seen[(r) >> 3] |= (1 << ((r) & 7)))
+
+
+/*
+ * local_ok
+ *
+ * Check a variable number against the routine's locals.
+ *
+ */
+static bool local_ok(zword var, int locals)
+{
+	return var == 0 || var > 15 || var <= locals;
+} /* local_ok */
+
+
+/*
+ * enqueue
+ *
+ * Remember a routine called from verified code.
+ *
+ */
+static bool enqueue(zword routine)
+{
+	if (routine == 0 || SEEN(routine))
+		return TRUE;
+	if (queued == VERIFY_QUEUE)
+		return FALSE;
+	MARK(routine);
+	queue[queued++] = routine;
+	return TRUE;
+} /* enqueue */
+
+
+/*
+ * reach
+ *
+ * Record the stack depth on arrival at an instruction, and queue it
+ * for checking if this is the first or shallowest way there.
+ *
+ */
+static bool reach(long start, long pc, int d, int *pending)
+{
+	if (pc < start || pc >= start + VERIFY_SPAN || pc >= story_size)
+		return FALSE;
+	if (depth[pc - start] <= d)
+		return TRUE;
+	if (*pending == VERIFY_WORK)
+		return FALSE;
+	depth[pc - start] = d;
+	work[(*pending)++] = pc;
+	return TRUE;
+} /* reach */
+
+
+/*
+ * check_insn
+ *
+ * Check the instruction at pc, reached with the stack d words deep,
+ * and pass the depth on to wherever it goes next. The code runs in a
+ * routine's frame unless it is the start code of a V1-5 story.
+ *
+ */
+static bool check_insn(long start, long pc, int locals, bool frame,
+		       int *pending)
+{
+	zinsn_t in;
+	int class, num, count, i;
+	int d = depth[pc - start];
+
+	if (pc + 24 > story_size || !decode_insn(pc, &in))
+		return FALSE;
+	class = in.class;
+	num = in.num;
+	count = in.argc;
+
+	/* 2OP:0x00 is the table's illegal-opcode handler */
+	switch (class) {
+	case C_2OP:
+		if (var_opcodes[num] == var_opcodes[0x00])
+			return FALSE;
+		break;
+	case C_1OP:
+		if (op1_opcodes[num] == var_opcodes[0x00])
+			return FALSE;
+		break;
+	case C_0OP:
+		if (op0_opcodes[num] == var_opcodes[0x00])
+			return FALSE;
+		break;
+	case C_VAR:
+		if (var_opcodes[0x20 + num] == var_opcodes[0x00])
+			return FALSE;
+		break;
+	default:
+		if (z_header.version < V5 || num >= 0x1d ||
+		    ext_opcodes[num] == var_opcodes[0x00])
+			return FALSE;
+		break;
+	}
+
+	/* Returns, including branches that return, need a frame */
+	if (!frame) {
+		if ((class == C_1OP && num == 0x0b) ||
+		    (class == C_0OP && (num == 0x00 || num == 0x01 ||
+					num == 0x03 || num == 0x08)))
+			return FALSE;
+		if ((in.flags & ZI_BRANCH) && in.target <= 1)
+			return FALSE;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (i == 0 && (in.flags & ZI_INDIRECT) && in.types[0] != 2) {
+			if (!local_ok(in.args[0], locals))
+				return FALSE;
+		} else if (in.types[i] == 2) {
+			if (!local_ok(in.args[i], locals))
+				return FALSE;
+			if (in.args[i] == 0 && --d < 0)
+				return FALSE;
+		}
+	}
+
+	/* Pops that are not operands */
+	if ((class == C_VAR && num == 0x09 && (z_header.version != V6 || count == 0)) ||
+	    (class == C_0OP && num == 0x08) ||
+	    (class == C_0OP && num == 0x09 && z_header.version <= V4)) {
+		if (--d < 0)
+			return FALSE;
+	}
+	if (class == C_VAR && num == 0x08)
+		d++;
+
+	/* pop_stack drops items from the game stack unless it is given
+	   exactly one user stack; push_stack only works on a user stack */
+	if (class == C_EXT && num == 0x15 && count != 2) {
+		if (count == 0 || in.types[0] == 2 || (d -= in.args[0]) < 0)
+			return FALSE;
+	}
+	if (class == C_EXT && num == 0x18 && count < 2)
+		return FALSE;
+
+	if (in.flags & ZI_STORE) {
+		if (!local_ok(in.store, locals))
+			return FALSE;
+		if (in.store == 0)
+			d++;
+	}
+
+	/* Calls to constant addresses */
+	if ((in.flags & ZI_CALL) && count > 0 && in.types[0] != 2) {
+		if (!enqueue(in.args[0]))
+			return FALSE;
+	}
+
+	if (class == C_1OP && num == 0x0c && in.types[0] == 2)
+		return FALSE;
+	if (in.target > 1 && !reach(start, in.target, d, pending))
+		return FALSE;
+	if (!(in.flags & ZI_TERMINAL) && !reach(start, in.next, d, pending))
+		return FALSE;
+	return TRUE;
+} /* check_insn */
+
+
+/*
+ * check_code
+ *
+ * Check the code whose first instruction is at pc, in a routine's
+ * frame or not.
+ *
+ */
+static bool check_code(long pc, int locals, bool frame)
+{
+	int pending = 0;
+	long i;
+
+	if (pc < z_header.dynamic_size || pc >= story_size)
+		return FALSE;
+
+	for (i = 0; i < VERIFY_SPAN; i++)
+		depth[i] = NO_DEPTH;
+	if (!reach(pc, pc, 0, &pending))
+		return FALSE;
+
+	while (pending > 0) {
+		long at = work[--pending];
+
+		if (!check_insn(pc, at, locals, frame, &pending))
+			return FALSE;
+	}
+	return TRUE;
+} /* check_code */
+
+
+/*
+ * check_routine
+ *
+ * Check a routine, given its packed address.
+ *
+ */
+static bool check_routine(zword routine)
+{
+	long pc;
+	int locals;
+
+	pc = ((long) routine << z_variant.packed_shift) +
+		z_variant.routine_offset;
+	if (pc < z_header.dynamic_size || pc >= story_size)
+		return FALSE;
+
+	locals = zmp[pc++];
+	if (locals > 15)
+		return FALSE;
+	if (z_variant.local_defaults)
+		pc += 2 * locals;
+	return check_code(pc, locals, TRUE);
+} /* check_routine */
+
+
+/*
+ * drain
+ *
+ * Check every queued routine, and whatever they call in turn.
+ *
+ */
+static bool drain(void)
+{
+	while (queued > 0) {
+		if (!check_routine(queue[--queued]))
+			return FALSE;
+	}
+	return TRUE;
+} /* drain */
+
+
+/*
+ * distrust
+ *
+ * Go back to the checked handlers for the rest of the session.
+ *
+ */
+static void distrust(void)
+{
+	if (trusted)
+		set_trusted_handlers(FALSE);
+	trusted = FALSE;
+} /* distrust */
+
+
+/*
+ * verify_story
+ *
+ * Check everything reachable from the start of the story and switch
+ * to the trusted handlers if it all passes.
+ *
+ */
+void verify_story(void)
+{
+	bool ok;
+
+	trusted = FALSE;
+	if (depth == NULL)
+		depth = malloc(VERIFY_SPAN * sizeof(*depth));
+	if (depth == NULL)
+		return;
+
+	memset(seen, 0, sizeof(seen));
+	queued = 0;
+
+	if (z_header.version == V6)
+		ok = enqueue(z_header.start_pc);
+	else
+		ok = check_code(z_header.start_pc, 0, FALSE);
+	if (!ok || !drain())
+		return;
+
+	trusted = TRUE;
+	set_trusted_handlers(TRUE);
+} /* verify_story */
+
+
+/*
+ * verify_call
+ *
+ * Called by call() for every routine while the story is trusted.
+ * Check a routine the load-time walk did not reach before it runs.
+ *
+ */
+void verify_call(zword routine)
+{
+	if (!trusted || SEEN(routine))
+		return;
+
+	queued = 0;
+	if (!enqueue(routine) || !drain())
+		distrust();
+} /* verify_call */
+
+
+/*
+ * verify_restored
+ *
+ * A restored game may be in the middle of routines that have not
+ * been checked, so stop trusting the story.
+ *
+ */
+void verify_restored(void)
+{
+	distrust();
+} /* verify_restored */
+
+#endif /* VERIFY_STORY */
@@ -46,7 +46,7 @@ Syntax: dfrotz [options] story-file [blorb file]\n\
   -m   turn off MORE prompts      \t -w # screen width\n\
   -n <file> set transcript filename\t -x   expand abbreviations g/x/z\n\
   -p   plain ASCII output only    \t -Z # error checking (see below)\n\
-  -P   alter piracy opcode\n"
+  -P   alter piracy opcode        \t -U # bytes for undo states\n"
 
 #define INFO2 "\
 Error checking: 0 none, 1 first only (default), 2 all, 3 exit after any error.\n\
@@ -81,7 +81,7 @@ void os_process_arguments(int argc, char *argv[])
 	quiet_mode = FALSE;
 	/* Parse the options */
 	do {
-		c = zgetopt(argc, argv, "aAf:h:iI:L:mn:oOpPqr:R:s:S:tTu:vw:xZ:");
+		c = zgetopt(argc, argv, "aAf:h:iI:L:mn:oOpPqr:R:s:S:tTu:U:vw:xZ:");
 		switch(c) {
 		case 'a':
 			f_setup.attribute_assignment = 1;
@@ -165,6 +165,9 @@ void os_process_arguments(int argc, char *argv[])
 		case 'u':
 			f_setup.undo_slots = atoi(zoptarg);
 			break;
+		case 'U':
+			f_setup.undo_size = atol(zoptarg);
+			break;
 		case 'v':
 			print_version();
 			os_quit(EXIT_SUCCESS);
@@ -32,6 +32,12 @@ static char runtime_usage[] =
 	"    \\help    Show this message.\n"
 	"    \\set     Show the current values of runtime settings.\n"
 	"    \\s       Show the current contents of the whole screen.\n"
+	"    \\undo    Show how much memory the undo states take.\n"
+#ifdef SNAPSHOTS
+	"    \\take N  Save the game state as snapshot N.\n"
+	"    \\back N  Go back to snapshot N, which stays saved.\n"
+	"    \\drop N  Forget snapshot N.\n"
+#endif
 	"    \\d       Discard the part of the input before the cursor.\n"
 	"    \\wN      Advance clock N/10 seconds, possibly causing the current\n"
 	"                and subsequent inputs to timeout.\n"
@@ -54,6 +60,9 @@ static char runtime_usage[] =
 	"    \\lt      Toggle display of the line type identification chars.\n"
 	"    \\vb      Toggle visual bell.\n"
 	"    \\pb      Toggle display of picture outline boxes.\n"
+#ifdef STATE_HASH
+	"    \\hs      Toggle display of the state hash before each input.\n"
+#endif
 	"    (Toggle commands can be followed by a 1 or 0 to set value ON or OFF.)\n"
 	"  Character Escapes:\n"
 	"    \\\\  backslash    \\#  backspace    \\[  escape    \\_  return\n"
@@ -73,6 +82,9 @@ static char runtime_usage[] =
 ;
 
 static float speed = 1;
+#ifdef STATE_HASH
+static bool show_state_hash = FALSE;
+#endif
 
 enum input_type {
 	INPUT_CHAR,
@@ -212,11 +224,20 @@ bool dumb_handle_setting(const char *setting, bool show_cursor, bool startup)
 	} else if (!strncmp(setting, "mp", 2)) {
 		toggle(&do_more_prompts, setting[2]);
 		printf("More prompts %s\n", do_more_prompts ? "ON" : "OFF");
+#ifdef STATE_HASH
+	} else if (!strncmp(setting, "hs", 2)) {
+		toggle(&show_state_hash, setting[2]);
+		printf("State hash %s\n", show_state_hash ? "ON" : "OFF");
+#endif
 	} else {
 		if (!strcmp(setting, "set")) {
 			printf("Speed Factor %g\n", speed);
 			printf("More Prompts %s\n",
 				do_more_prompts ? "ON" : "OFF");
+#ifdef STATE_HASH
+			printf("State Hash %s\n",
+				show_state_hash ? "ON" : "OFF");
+#endif
 		}
 		return dumb_output_handle_setting(setting, show_cursor, startup);
 	}
@@ -232,7 +253,7 @@ static bool dumb_read_line(char *s, char *prompt, bool show_cursor,
 			   int timeout, enum input_type type,
 			   zchar *continued_line_chars)
 {
-	time_t start_time;
+	time_t start_time = 0;
 
 	if (timeout) {
 		if (time_ahead >= timeout) {
@@ -245,6 +266,11 @@ static bool dumb_read_line(char *s, char *prompt, bool show_cursor,
 	time_ahead = 0;
 
 	dumb_show_screen(show_cursor);
+#ifdef STATE_HASH
+	if (show_state_hash)
+		printf("DUMB-FROTZ: state %016llx\n",
+			(unsigned long long) state_hash());
+#endif
 	for (;;) {
 		char *command;
 		if (prompt)
@@ -326,6 +352,38 @@ static bool dumb_read_line(char *s, char *prompt, bool show_cursor,
 			}
 		} else if (!strcmp(command, "s")) {
 			dumb_dump_screen();
+		} else if (!strcmp(command, "undo")) {
+			int count;
+			long used, size;
+
+			undo_usage(&count, &used, &size);
+			printf("DUMB-FROTZ: %d undo states in %ld of %ld bytes\n",
+				count, used, size);
+#ifdef SNAPSHOTS
+		} else if (prompt && (!strncmp(command, "take ", 5)
+				|| !strncmp(command, "back ", 5))) {
+			/* Only the story's own input is a safe place */
+			fprintf(stderr, "DUMB-FROTZ: not at a story prompt\n");
+		} else if (!strncmp(command, "take ", 5)) {
+			if (snapshot_take(command + 5))
+				printf("DUMB-FROTZ: took snapshot %s\n", command + 5);
+			else
+				fprintf(stderr, "DUMB-FROTZ: no memory for snapshot %s\n", command + 5);
+		} else if (!strncmp(command, "back ", 5)) {
+			long pc;
+
+			GET_PC(pc)
+			if (snapshot_pc(command + 5) == -1)
+				fprintf(stderr, "DUMB-FROTZ: no snapshot %s\n", command + 5);
+			else if (snapshot_pc(command + 5) != pc)
+				/* The read under way would finish with the
+				   wrong operands and store */
+				fprintf(stderr, "DUMB-FROTZ: snapshot %s was taken at another input\n", command + 5);
+			else if (snapshot_restore(command + 5))
+				printf("DUMB-FROTZ: back to snapshot %s\n", command + 5);
+		} else if (!strncmp(command, "drop ", 5)) {
+			snapshot_drop(command + 5);
+#endif
     		} else if (!dumb_handle_setting(command, show_cursor, FALSE)) {
 			fprintf(stderr, "DUMB-FROTZ: unknown command: %s\n", s);
 			fprintf(stderr, "Enter \\help to see the list of commands\n");
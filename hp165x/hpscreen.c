@@ -64,6 +64,7 @@ void hp_clear_window() {
 
 static int current_style = 0;
 static int current_font = 0;
+static bool raw_charset = FALSE;
 
 char latin1_to_ibm[] = {
 	0x20, 0xad, 0xbd, 0x9c, 0xcf, 0xbe, 0xdd, 0xf5,
@@ -174,7 +175,7 @@ void os_set_colour (int newfg, int newbg)
 
 void os_display_char (zchar c)
 {
-	if (story_id == BEYOND_ZORK && !(z_header.flags & GRAPHICS_FLAG)) {
+	if (raw_charset) {
 		putChar(c);
 	} else if (c >= 32 && c <= 126) {
 		putChar(c);
@@ -373,6 +374,7 @@ void hp_init_output(void) {
 	if (story_id == BEYOND_ZORK) {
 		z_header.flags |= GRAPHICS_FLAG; // use font3
 	}
+	raw_charset = story_id == BEYOND_ZORK && !(z_header.flags & GRAPHICS_FLAG);
 	
 	os_erase_area(1, 1, z_header.screen_rows, z_header.screen_cols, -2);
 }	
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Check the native veneer routines against a real Inform game.
+#
+# usage: accelcheck.sh path/to/dfrotz path/to/story.z5 path/to/commands.txt
+#
+# dfrotz must be built with -DVENEER_ACCEL.  The commands are played
+# through the game with FROTZ_ACCEL_VERIFY set, so every native result
+# is compared against the routine it stands for.  The check fails if
+# any result differs, or if no veneer call was checked at all, which
+# means the signatures did not recognise the story's veneer.
+
+if [ $# -ne 3 ]; then
+	echo "usage: $0 dfrotz story commands" >&2
+	exit 2
+fi
+
+report=$(FROTZ_ACCEL_VERIFY=1 "$1" -m -p "$2" < "$3" 2>&1 >/dev/null |
+	grep '^Veneer')
+echo "$report"
+
+summary=$(echo "$report" | grep 'calls checked')
+if [ -z "$summary" ]; then
+	echo "accelcheck: no veneer report; is dfrotz built with -DVENEER_ACCEL?" >&2
+	exit 1
+fi
+checked=$(echo "$summary" | sed 's/.* \([0-9]*\) calls checked.*/\1/')
+mismatches=$(echo "$summary" | sed 's/.* \([0-9]*\) mismatches.*/\1/')
+if [ "$checked" -eq 0 ]; then
+	echo "accelcheck: no veneer calls were checked" >&2
+	exit 1
+fi
+if [ "$mismatches" -ne 0 ]; then
+	echo "accelcheck: $mismatches mismatches" >&2
+	exit 1
+fi
+echo "accelcheck: $checked calls checked, no mismatches"
@@ -0,0 +1,152 @@
+/* diffbench.c - Time the XOR coder on a story and a saved game
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * "make -C tools bench STORY=game.z5 SAVE=game.qzl" builds this twice,
+ * with and without the SSE2 step of next_change, and runs both.  The
+ * dynamic memory of the story is compared with the same memory after
+ * the save's `CMem' chunk is applied, which is the kind of image the
+ * undo and save code see.  The diff lengths printed by the two builds
+ * must agree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../common/memdiff.c"
+
+zbyte dirty_pages[DIRTY_PAGES];
+
+
+/*
+ * load_file
+ *
+ * Read a whole file into a new buffer and return it.
+ *
+ */
+static zbyte *load_file(const char *name, long *size)
+{
+	FILE *fp = fopen(name, "rb");
+	zbyte *data;
+
+	if (fp == NULL || fseek(fp, 0, SEEK_END) != 0
+	    || (*size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0
+	    || (data = malloc(*size + 1)) == NULL
+	    || fread(data, 1, *size, fp) != (size_t) *size) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+	return data;
+} /* load_file */
+
+
+/*
+ * apply_cmem
+ *
+ * Find the `CMem' chunk of a Quetzal file and apply it to mem.
+ *
+ */
+static void apply_cmem(zbyte *mem, zword mem_size, const zbyte *save,
+		       long save_size)
+{
+	long pos = 12;
+
+	while (pos + 8 <= save_size) {
+		long len = ((long) save[pos + 4] << 24) | (save[pos + 5] << 16)
+			| (save[pos + 6] << 8) | save[pos + 7];
+		const zbyte *p = save + pos + 8;
+		const zbyte *end = p + len;
+		unsigned i = 0;
+
+		if (memcmp(save + pos, "CMem", 4) != 0) {
+			pos += 8 + len + (len & 1);
+			continue;
+		}
+		while (p < end && i < mem_size) {
+			if (*p == 0) {
+				if (++p == end)
+					break;
+				i += *p++ + 1;
+			} else
+				mem[i++] ^= *p++;
+		}
+		return;
+	}
+	fprintf(stderr, "diffbench: no CMem chunk\n");
+	exit(EXIT_FAILURE);
+} /* apply_cmem */
+
+
+int main(int argc, char *argv[])
+{
+	zbyte *story, *now, *was, *diff;
+	long story_size, save_size;
+	zbyte *save;
+	zword mem_size;
+	long len = 0;
+	long reps = 200000;
+	clock_t start;
+	double secs;
+	long r;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: diffbench story save\n");
+		return EXIT_FAILURE;
+	}
+	story = load_file(argv[1], &story_size);
+	save = load_file(argv[2], &save_size);
+	mem_size = (story[H_DYNAMIC_SIZE] << 8) | story[H_DYNAMIC_SIZE + 1];
+	if (story_size < mem_size || save_size < 12
+	    || memcmp(save + 8, "IFZS", 4) != 0) {
+		fprintf(stderr, "diffbench: bad story or save\n");
+		return EXIT_FAILURE;
+	}
+	now = malloc(mem_size);
+	was = malloc(mem_size);
+	diff = malloc(mem_size * 3 / 2 + 2);
+	if (now == NULL || was == NULL || diff == NULL)
+		return EXIT_FAILURE;
+	memcpy(now, story, mem_size);
+	apply_cmem(now, mem_size, save, save_size);
+
+#ifdef __SSE2__
+	printf("SSE2 next_change, %u bytes of dynamic memory\n", mem_size);
+#else
+	printf("word next_change, %u bytes of dynamic memory\n", mem_size);
+#endif
+
+	/* Quetzal: compare against the story, nothing is skipped */
+	start = clock();
+	for (r = 0; r < reps; r++)
+		len = cmem_diff(now, story, mem_size, diff);
+	secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+	printf("cmem_diff  %7.3fs  %7.0f MB/s  length %ld\n", secs,
+	    secs > 0 ? reps * (double) mem_size / secs / 1e6 : 0.0, len);
+
+	/* Undo: every page dirty, the reference is copied back each time */
+	start = clock();
+	for (r = 0; r < reps; r++) {
+		memcpy(was, story, mem_size);
+		memset(dirty_pages, DIRTY_UNDO, sizeof(dirty_pages));
+		len = mem_diff(now, was, mem_size, diff);
+	}
+	secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+	printf("mem_diff   %7.3fs  %7.0f MB/s  length %ld\n", secs,
+	    secs > 0 ? reps * (double) mem_size / secs / 1e6 : 0.0, len);
+	return EXIT_SUCCESS;
+} /* main */
@@ -0,0 +1,148 @@
+/* scanbench.c - Time scan_table against the old entry-by-entry loop
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Build on the host with "make -C tools" and run tools/scanbench.  The
+ * real table.c is compiled in, so z_scan_table is timed exactly as the
+ * interpreter runs it; old_scan_table is the loop it replaced.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../common/table.c"
+
+#define STORY_BYTES 0x10000
+#define TABLE 0x4000
+
+zbyte *zmp;
+long story_size;
+zword zargs[8];
+int zargc;
+
+static zword result;
+
+
+/*
+ * Stand-ins for the parts of the interpreter table.c calls
+ *
+ */
+void store(zword value) { result = value; }
+void branch(bool flag) { (void) flag; }
+void storeb(zword addr, zbyte value) { zmp[addr] = value; }
+void storew(zword addr, zword value) { zmp[addr] = hi(value); zmp[addr + 1] = lo(value); }
+bool fill_block(zword addr, zbyte value, zword size) { memset(zmp + addr, value, size); return TRUE; }
+bool store_block(zword addr, const zbyte *src, zword size) { memmove(zmp + addr, src, size); return TRUE; }
+
+
+/*
+ * old_scan_table
+ *
+ * z_scan_table as it was before the bulk paths.
+ *
+ */
+static void old_scan_table(void)
+{
+	zword addr = zargs[1];
+	int i;
+
+	if (zargc < 4)
+		zargs[3] = 0x82;
+
+	for (i = 0; i < zargs[2]; i++) {
+		if (zargs[3] & 0x80) {
+			zword wvalue;
+			LOW_WORD(addr, wvalue)
+			    if (wvalue == zargs[0])
+				goto finished;
+		} else {
+			zbyte bvalue;
+			LOW_BYTE(addr, bvalue)
+			    if (bvalue == zargs[0])
+				goto finished;
+		}
+		addr += zargs[3] & 0x7f;
+	}
+	addr = 0;
+finished:
+	store(addr);
+	branch(addr);
+} /* old_scan_table */
+
+
+/*
+ * run
+ *
+ * Time reps scans of count entries of the given form with both
+ * versions, check they agree, and print one line.
+ *
+ */
+static void run(const char *name, zword target, zword count, zword form, long reps)
+{
+	void (*scan[2])(void) = { old_scan_table, z_scan_table };
+	double secs[2];
+	zword found[2];
+	long r;
+	int v;
+
+	for (v = 0; v < 2; v++) {
+		clock_t start = clock();
+
+		for (r = 0; r < reps; r++) {
+			zargs[0] = target;
+			zargs[1] = TABLE;
+			zargs[2] = count;
+			zargs[3] = form;
+			zargc = 4;
+			scan[v]();
+		}
+		secs[v] = (double) (clock() - start) / CLOCKS_PER_SEC;
+		found[v] = result;
+	}
+	if (found[0] != found[1]) {
+		printf("%-26s MISMATCH old %04x new %04x\n", name, found[0], found[1]);
+		exit(EXIT_FAILURE);
+	}
+	printf("%-26s old %6.3fs  new %6.3fs  x%5.1f\n", name,
+	    secs[0], secs[1], secs[1] > 0 ? secs[0] / secs[1] : 0.0);
+} /* run */
+
+
+int main(void)
+{
+	long i;
+
+	zmp = malloc(STORY_BYTES);
+	if (zmp == NULL)
+		return EXIT_FAILURE;
+	story_size = STORY_BYTES;
+
+	/* Dictionary-like words: no zero bytes, no repeats */
+	srand(1);
+	for (i = 0; i < STORY_BYTES; i++)
+		zmp[i] = 1 + rand() % 0xfe;
+	zmp[TABLE + 2 * 19999] = 0x00;
+	zmp[TABLE + 2 * 19999 + 1] = 0x00;
+
+	run("word, 8 entries, miss", 0x0000, 8, 0x82, 20000000);
+	run("word, 64 entries, miss", 0x0000, 64, 0x82, 4000000);
+	run("word, 20000, hit at end", 0x0000, 20000, 0x82, 20000);
+	run("word, 20000, miss", 0xffff, 20000, 0x82, 20000);
+	run("byte, 20000, miss", 0xff, 20000, 0x01, 20000);
+	run("byte, step 4, miss", 0xff, 10000, 0x04, 20000);
+	return EXIT_SUCCESS;
+} /* main */
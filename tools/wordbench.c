@@ -0,0 +1,266 @@
+/* wordbench.c - Time the text decoder and operand loads
+ *
+ * This file is part of Frotz.
+ *
+ * Frotz is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Frotz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * "make -C tools bench STORY=game.z5" builds this twice, once with the
+ * native word macros of frotz.h and once with -DNO_NATIVE_WORDS, and
+ * runs both over the story.  The real text.c is compiled in, so
+ * decode_text and lookup_text are timed as the interpreter runs them.
+ * The checksums printed by the two builds must agree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../common/text.c"
+
+zbyte *zmp;
+zbyte *pcp;
+long story_size;
+zword zargs[8];
+int zargc;
+f_setup_t f_setup;
+z_header_t z_header;
+z_variant_t z_variant;
+enum story story_id = UNKNOWN;
+zword global_vars[256];
+zbyte dirty_pages[DIRTY_PAGES];
+
+static unsigned long checksum;
+
+
+/*
+ * Stand-ins for the parts of the interpreter text.c calls
+ *
+ */
+void print_char(zchar c) { checksum = checksum * 31 + c; }
+void new_line(void) { checksum = checksum * 31 + '\n'; }
+void store(zword value) { checksum += value; }
+void ret(zword value) { checksum += value; }
+void storeb(zword addr, zbyte value) { zmp[addr] = value; }
+void storew(zword addr, zword value) { SET_WORD(addr, value) }
+zword object_name(zword object) { return 0; }
+zword get_window_font(zword win) { return TEXT_FONT; }
+void _runtime_error(int errnum, bool repeat)
+{
+	fprintf(stderr, "wordbench: runtime error %d\n", errnum);
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * load_story
+ *
+ * Read the story and fill in the header fields and constants the text
+ * code looks at, as init_memory does.  V1-V5 and V8 only.
+ *
+ */
+static void load_story(const char *name)
+{
+	FILE *fp = fopen(name, "rb");
+
+	if (fp == NULL || (zmp = malloc(0x80000)) == NULL) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	story_size = fread(zmp, 1, 0x80000, fp);
+	fclose(fp);
+	if (story_size < 64 || zmp[0] < V1 || zmp[0] > V8
+	    || zmp[0] == V6 || zmp[0] == V7) {
+		fprintf(stderr, "%s: not a V1-V5 or V8 story\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	z_header.version = zmp[H_VERSION];
+	LOW_WORD(H_DICTIONARY, z_header.dictionary)
+	LOW_WORD(H_OBJECTS, z_header.objects)
+	LOW_WORD(H_ABBREVIATIONS, z_header.abbreviations)
+	if (z_header.version >= V5)
+		LOW_WORD(H_ALPHABET, z_header.alphabet)
+
+	z_variant.packed_shift = (z_header.version <= V3) ? 1 :
+		(z_header.version <= V5) ? 2 : 3;
+	z_variant.text_resolution = (z_header.version <= V3) ? 2 : 3;
+	z_variant.abbrev_zchars = (z_header.version == V1) ? 0 :
+		(z_header.version == V2) ? 1 : 3;
+	z_variant.shift_lock = (z_header.version <= V2);
+	z_variant.object_base = z_header.objects +
+		((z_header.version <= V3) ? 62 : 126);
+	z_variant.object_size = (z_header.version <= V3) ? 9 : 14;
+	z_variant.object_properties = (z_header.version <= V3) ? 7 : 12;
+} /* load_story */
+
+
+/*
+ * decode_all
+ *
+ * Decode every abbreviation and every object's short name.
+ *
+ */
+static void decode_all(void)
+{
+	zword first_prop = 0xffff;
+	zword obj_addr;
+	zword addr;
+	int i;
+
+	for (i = 0; i < 96 && z_header.version >= V2; i++) {
+		LOW_WORD(z_header.abbreviations + 2 * i, addr)
+		decode_text(ABBREVIATION, addr);
+	}
+	for (obj_addr = z_variant.object_base;
+	     obj_addr < first_prop && obj_addr + z_variant.object_size < story_size;
+	     obj_addr += z_variant.object_size) {
+		LOW_WORD(obj_addr + z_variant.object_properties, addr)
+		if (addr < first_prop)
+			first_prop = addr;
+		if (zmp[addr] != 0)
+			decode_text(LOW_STRING, (zword) (addr + 1));
+	}
+} /* decode_all */
+
+
+/*
+ * lookup_all
+ *
+ * Decode each dictionary word and look it up again.  encode_text
+ * reads all of decoded[], which load_string leaves zero-filled, so
+ * clear it first.
+ *
+ */
+static void lookup_all(void)
+{
+	zword dct = z_header.dictionary;
+	zword entry_count;
+	zbyte entry_len;
+	zword addr;
+	int i;
+
+	dct += 1 + zmp[dct];
+	entry_len = zmp[dct];
+	LOW_WORD(dct + 1, entry_count)
+	addr = dct + 3;
+	for (i = 0; i < entry_count; i++, addr += entry_len) {
+		memset(decoded, 0, sizeof(decoded));
+		decode_text(VOCABULARY, addr);
+		if (lookup_text(0x05, z_header.dictionary) != addr)
+			checksum++;
+	}
+} /* lookup_all */
+
+
+/*
+ * load_operand
+ *
+ * As in process.c, but locals and the stack are one small array here
+ * since there is no frame to read them from.
+ *
+ */
+static zword frame_vars[16];
+
+static void load_operand(zbyte type)
+{
+	zword value;
+
+	if (type & 2) {
+		zbyte variable;
+
+		CODE_BYTE(variable)
+		if (variable < 16)
+			value = frame_vars[variable];
+		else
+			GET_GLOBAL(variable, value)
+	} else if (type & 1) {
+		zbyte bvalue;
+
+		CODE_BYTE(bvalue)
+		value = bvalue;
+	} else
+		CODE_WORD(value)
+	zargs[zargc++] = value;
+} /* load_operand */
+
+
+/*
+ * load_operands
+ *
+ * Read the story's code as a stream of operands of mixed types, three
+ * or four to an instruction.
+ *
+ */
+static void load_operands(void)
+{
+	static const zbyte types[] = { 0, 2, 1, 0, 2, 0, 1 };
+	zword sum = 0;
+	long end = story_size - 8;
+	int t = 0;
+
+	SET_PC(0x40)
+	while (pcp - zmp < end) {
+		zargc = 0;
+		load_operand(types[t]);
+		load_operand(types[t + 1]);
+		load_operand(types[t + 2]);
+		if (t & 1)
+			load_operand(types[t + 3]);
+		sum += zargs[0] ^ zargs[zargc - 1];
+		t = (t + 1) & 3;
+	}
+	checksum += sum;
+} /* load_operands */
+
+
+/*
+ * run
+ *
+ * Time reps calls of one workload and print one line.
+ *
+ */
+static void run(const char *name, void (*work)(void), long reps)
+{
+	clock_t start;
+	long r;
+
+	checksum = 0;
+	start = clock();
+	for (r = 0; r < reps; r++)
+		work();
+	printf("%-14s %7.3fs  checksum %08lx\n", name,
+	    (double) (clock() - start) / CLOCKS_PER_SEC,
+	    checksum & 0xffffffffUL);
+} /* run */
+
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: wordbench story\n");
+		return EXIT_FAILURE;
+	}
+	load_story(argv[1]);
+
+#ifdef NO_NATIVE_WORDS
+	printf("byte word macros\n");
+#else
+	printf("native word macros\n");
+#endif
+	run("decode_text", decode_all, 10000);
+	run("lookup_text", lookup_all, 2500);
+	run("load_operand", load_operands, 2500);
+	return EXIT_SUCCESS;
+} /* main */
@@ -0,0 +1,549 @@
+# zcompile.py - translate the routines of one story file into C
+#
+# usage: python zcompile.py story.z3 > aot_story.c
+#
+# Routines are found by following call targets from the start PC.  The
+# basic blocks of every routine that lies wholly in static memory become
+# C functions that work on the normal machine state, so the interpreter
+# (common/process.c) can switch to and from them at any block boundary.
+# Anything not understood here, such as computed calls, code in dynamic
+# memory or unusual opcodes, is simply left to the interpreter.
+#
+# Build the result together with the common/ sources and -DAOT_STORY.
+
+import re
+import sys
+
+# Operand types as in the opcode byte and the type specifier bytes
+LARGE, SMALL, VARIABLE, OMITTED = 0, 1, 2, 3
+
+
+class Story:
+    def __init__(self, data):
+        self.data = data
+        self.version = data[0]
+        if self.version < 1 or self.version > 8:
+            raise ValueError("not a Z-code story file")
+        self.release = self.word(0x02)
+        self.start_pc = self.word(0x06)
+        self.dynamic_size = self.word(0x0e)
+        self.serial = data[0x12:0x18]
+        self.checksum = self.word(0x1c)
+        length = self.word(0x1a)
+        if length:
+            length *= 2 if self.version <= 3 else 4 if self.version <= 5 else 8
+            self.size = min(length, len(data))
+        else:
+            self.size = len(data)
+        self.shift = 1 if self.version <= 3 else 3 if self.version == 8 else 2
+        self.routine_offset = 0
+        if self.version in (6, 7):
+            self.routine_offset = self.word(0x28) << 3
+
+    def byte(self, addr):
+        if addr >= self.size:
+            raise IndexError(addr)
+        return self.data[addr]
+
+    def word(self, addr):
+        return (self.data[addr] << 8) | self.data[addr + 1]
+
+    def routine(self, packed):
+        return (packed << self.shift) + self.routine_offset
+
+
+class Insn:
+    pass
+
+
+def opcode_info(story, kind, num):
+    """Return (store, branch, text, control) for an opcode."""
+    v = story.version
+    store = branch = text = control = False
+    if kind == "2OP":
+        store = num in (0x08, 0x09, 0x0f, 0x10, 0x11, 0x12, 0x13,
+                        0x14, 0x15, 0x16, 0x17, 0x18, 0x19)
+        branch = num in (0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x0a)
+        control = num in (0x19, 0x1a, 0x1c)
+        if num == 0 or num > 0x1c:
+            return None
+    elif kind == "1OP":
+        store = num in (0x01, 0x02, 0x03, 0x04, 0x08, 0x0e) or \
+            (num == 0x0f and v <= 4)
+        branch = num in (0x00, 0x01, 0x02)
+        control = num in (0x08, 0x0b, 0x0c) or (num == 0x0f and v >= 5)
+    elif kind == "0OP":
+        store = (num in (0x05, 0x06) and v >= 4) or (num == 0x09 and v >= 5)
+        branch = (num in (0x05, 0x06) and v <= 3) or num in (0x0d, 0x0f)
+        text = num in (0x02, 0x03)
+        control = num in (0x00, 0x01, 0x03, 0x05, 0x06, 0x07, 0x08, 0x0a)
+    elif kind == "VAR":
+        store = num in (0x00, 0x07, 0x0c, 0x16, 0x17, 0x18) or \
+            (num == 0x04 and v >= 5) or (num == 0x09 and v == 6)
+        branch = num in (0x17, 0x1f)
+        control = num in (0x00, 0x04, 0x0c, 0x16, 0x19, 0x1a)
+    else:  # EXT
+        if v < 5 or num >= 0x1d or num in (0x0e, 0x0f):
+            return None
+        store = num in (0x00, 0x01, 0x02, 0x03, 0x04, 0x09, 0x0a,
+                        0x0c, 0x13)
+        branch = num in (0x06, 0x18, 0x1b)
+        control = num in (0x00, 0x01, 0x0a)
+    return store, branch, text, control or branch
+
+
+def types_from(spec):
+    types = []
+    for i in (6, 4, 2, 0):
+        t = (spec >> i) & 3
+        if t == OMITTED:
+            break
+        types.append(t)
+    return types
+
+
+def decode(story, pc):
+    """Decode the instruction at pc, or return None."""
+    op = story.byte(pc)
+    p = pc + 1
+    if op < 0x80:
+        kind, num = "2OP", op & 0x1f
+        types = [VARIABLE if op & 0x40 else SMALL,
+                 VARIABLE if op & 0x20 else SMALL]
+    elif op < 0xb0:
+        kind, num = "1OP", op & 0x0f
+        types = [(op >> 4) & 3]
+    elif op == 0xbe:
+        kind, num = "EXT", story.byte(p)
+        types = types_from(story.byte(p + 1))
+        p += 2
+    elif op < 0xc0:
+        kind, num, types = "0OP", op - 0xb0, []
+    else:
+        kind = "2OP" if op < 0xe0 else "VAR"
+        num = op & 0x1f
+        if op in (0xec, 0xfa):
+            types = types_from(story.byte(p)) + types_from(story.byte(p + 1))
+            p += 2
+        else:
+            types = types_from(story.byte(p))
+            p += 1
+
+    info = opcode_info(story, kind, num)
+    if info is None:
+        return None
+    insn = Insn()
+    insn.pc, insn.kind, insn.num = pc, kind, num
+    insn.store, insn.branch, insn.text, insn.control = info
+    insn.ops = []
+    for t in types:
+        if t == LARGE:
+            insn.ops.append((LARGE, story.word(p)))
+            story.byte(p + 1)
+            p += 2
+        else:
+            insn.ops.append((t, story.byte(p)))
+            p += 1
+    insn.operand_end = p
+    insn.store_var = None
+    if insn.store:
+        insn.store_var = story.byte(p)
+        p += 1
+    insn.target = None
+    if insn.branch:
+        b = story.byte(p)
+        p += 1
+        insn.on_true = bool(b & 0x80)
+        if b & 0x40:
+            offset = b & 0x3f
+        else:
+            offset = ((b & 0x3f) << 8) | story.byte(p)
+            p += 1
+            if offset & 0x2000:
+                offset -= 0x4000
+        insn.offset = offset
+    if insn.text:
+        while not story.byte(p) & 0x80:
+            p += 2
+        story.byte(p + 1)
+        p += 2
+    insn.next = p
+    if insn.branch and insn.offset not in (0, 1):
+        insn.target = p + insn.offset - 2
+    if kind == "1OP" and num == 0x0c:
+        if types[0] == VARIABLE:
+            return None
+        offset = insn.ops[0][1]
+        if offset & 0x8000:
+            offset -= 0x10000
+        insn.target = p + offset - 2
+    return insn
+
+
+# Instructions after which execution never falls through
+def is_terminal(insn):
+    return (insn.kind == "0OP" and insn.num in (0x00, 0x01, 0x03, 0x07,
+                                               0x08, 0x0a)) or \
+        (insn.kind == "1OP" and insn.num in (0x0b, 0x0c)) or \
+        (insn.kind == "2OP" and insn.num == 0x1c)
+
+
+CALLS = {("VAR", 0x00): 0, ("VAR", 0x0c): 0, ("VAR", 0x19): 1,
+         ("VAR", 0x1a): 1, ("2OP", 0x19): 0, ("2OP", 0x1a): 1,
+         ("1OP", 0x08): 0}
+
+
+def call_type(story, insn):
+    if insn.kind == "1OP" and insn.num == 0x0f and story.version >= 5:
+        return 1
+    return CALLS.get((insn.kind, insn.num))
+
+
+class Compiler:
+    def __init__(self, story):
+        self.story = story
+        self.insns = {}
+        self.leaders = set()
+        self.routines = {}
+        self.pending = []
+
+    def static(self, start, end):
+        return start >= self.story.dynamic_size and end <= self.story.size
+
+    def add_routine(self, addr):
+        s = self.story
+        if addr in self.routines or not self.static(addr, addr + 1):
+            return
+        if s.byte(addr) > 15:
+            return
+        self.routines[addr] = None
+        self.pending.append(addr)
+
+    def drain(self):
+        while self.pending:
+            addr = self.pending.pop()
+            count = self.story.byte(addr)
+            code = addr + 1 + (2 * count if self.story.version <= 4 else 0)
+            self.routines[addr] = self.scan(code)
+
+    def scan(self, entry):
+        """Follow the code from entry; return the end of the last
+        instruction found, or None if nothing could be decoded."""
+        work = [entry]
+        end = None
+        while work:
+            pc = work.pop()
+            if pc in self.insns:
+                continue
+            try:
+                insn = decode(self.story, pc)
+            except IndexError:
+                insn = None
+            if insn is None or not self.static(pc, insn.next):
+                continue
+            if insn.target is not None and \
+               not self.static(insn.target, insn.target + 1):
+                continue
+            self.insns[pc] = insn
+            end = max(end or 0, insn.next)
+            if insn.target is not None:
+                self.leaders.add(insn.target)
+                work.append(insn.target)
+            if not is_terminal(insn):
+                if insn.control:
+                    self.leaders.add(insn.next)
+                work.append(insn.next)
+            ct = call_type(self.story, insn)
+            if ct is not None and insn.ops and insn.ops[0][0] != VARIABLE \
+               and insn.ops[0][1] != 0:
+                self.add_routine(self.story.routine(insn.ops[0][1]))
+        if end is not None:
+            self.leaders.add(entry)
+        return end
+
+    def sweep(self):
+        """Routines called only indirectly (from property tables, say)
+        usually sit between the ones already found, so walk the code
+        area routine by routine from the lowest known one."""
+        s = self.story
+        align = 1 << s.shift
+        addr = max(s.word(0x04), s.dynamic_size)
+        addr += (s.routine_offset - addr) % align
+        misses = 0
+        while addr < s.size and misses < 32:
+            self.add_routine(addr)
+            self.drain()
+            end = self.routines.get(addr)
+            if end is None:
+                addr += align
+                misses += 1
+                continue
+            misses = 0
+            addr = end + (s.routine_offset - end) % align
+
+    def run(self):
+        s = self.story
+        if s.version == 6:
+            self.add_routine(s.routine(s.start_pc))
+        else:
+            self.scan(s.start_pc)
+        self.drain()
+        self.sweep()
+        return sorted(pc for pc in self.leaders if pc in self.insns)
+
+
+# C code generation
+
+TEMPS = ["x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "a", "v", "b"]
+
+def var_read(story, var, dest):
+    if var == 0:
+        return ["%s = *sp++;" % dest]
+    if var < 16:
+        return ["%s = *(fp - %d);" % (dest, var)]
+    return ["%s = global_vars[%d];" % (dest, var - 16)]
+
+
+def var_write(story, var, expr):
+    if var == 0:
+        return ["*--sp = (zword) (%s);" % expr]
+    if var < 16:
+        return ["*(fp - %d) = (zword) (%s);" % (var, expr)]
+    return ["v = (zword) (%s);" % expr, "SET_GLOBAL(%d, v)" % var]
+
+
+def operands(story, insn):
+    """Fetch the operands in order; return (lines, expressions)."""
+    lines, exprs = [], []
+    for i, (t, value) in enumerate(insn.ops):
+        if t == VARIABLE:
+            lines += var_read(story, value, "x%d" % i)
+            exprs.append("x%d" % i)
+        else:
+            exprs.append("0x%x" % value)
+    return lines, exprs
+
+
+def goto(story, target):
+    return ["SET_PC(0x%xL)" % target]
+
+
+def branch_lines(story, insn, cond):
+    if not insn.on_true:
+        cond = "!(%s)" % cond
+    if insn.offset in (0, 1):
+        taken = ["ret(%d);" % insn.offset]
+    else:
+        taken = goto(story, insn.target)
+    return (["if (%s) {" % cond] + ["\t" + l for l in taken] +
+            ["} else"] + ["\t" + l for l in goto(story, insn.next)] +
+            ["return;"])
+
+
+def indirect(insn):
+    """Variable number of an inc/dec/load/store/pull, if constant."""
+    t, value = insn.ops[0]
+    return None if t == VARIABLE else value & 0xff if t == SMALL else None
+
+
+def modify(story, var, op, keep=True):
+    """Apply op ("++" or "--") to a variable in place, value in v."""
+    if var < 16:
+        ref = "*sp" if var == 0 else "*(fp - %d)" % var
+        return ["v = %s(%s);" % (op, ref) if keep else "(%s)%s;" % (ref, op)]
+    return ["v = global_vars[%d];" % (var - 16), "v%s;" % op,
+            "SET_GLOBAL(%d, v)" % var]
+
+
+def translate(story, insn):
+    """Return (lines, ends_block) for one instruction."""
+    lines, x = operands(story, insn)
+    k, n, v = insn.kind, insn.num, story.version
+
+    def store(expr):
+        return var_write(story, insn.store_var, expr)
+
+    # Arithmetic, logic and memory access
+    simple = {("2OP", 0x08): "%s | %s", ("2OP", 0x09): "%s & %s",
+              ("2OP", 0x14): "(short) %s + (short) %s",
+              ("2OP", 0x15): "(short) %s - (short) %s",
+              ("2OP", 0x16): "(short) %s * (short) %s"}
+    if (k, n) in simple and len(x) == 2:
+        return lines + store(simple[(k, n)] % tuple(x)), False
+    if k == "2OP" and n == 0x0f and len(x) == 2:
+        return lines + ["a = (zword) (%s + 2 * %s);" % tuple(x),
+                        "LOW_WORD(a, v)"] + store("v"), False
+    if k == "2OP" and n == 0x10 and len(x) == 2:
+        return lines + ["a = (zword) (%s + %s);" % tuple(x),
+                        "LOW_BYTE(a, b)"] + store("b"), False
+    if k == "VAR" and n == 0x01 and len(x) == 3:
+        return lines + ["storew((zword) (%s + 2 * %s), %s);" %
+                        tuple(x)], False
+    if k == "VAR" and n == 0x02 and len(x) == 3:
+        return lines + ["storeb((zword) (%s + %s), (zbyte) %s);" %
+                        tuple(x)], False
+    if k == "1OP" and n == 0x0f and v <= 4:
+        return lines + store("~%s" % x[0]), False
+    if k == "VAR" and n == 0x18 and len(x) == 1:
+        return lines + store("~%s" % x[0]), False
+
+    # Branches
+    if k == "2OP" and n == 0x01 and len(x) >= 1:
+        cond = " || ".join("%s == %s" % (x[0], o) for o in x[1:]) or "0"
+        return lines + branch_lines(story, insn, cond), True
+    if k == "2OP" and n in (0x02, 0x03) and len(x) == 2:
+        rel = "<" if n == 0x02 else ">"
+        return lines + branch_lines(
+            story, insn, "(short) %s %s (short) %s" % (x[0], rel, x[1])), True
+    if k == "2OP" and n == 0x07 and len(x) == 2:
+        return lines + branch_lines(
+            story, insn, "(%s & %s) == %s" % (x[0], x[1], x[1])), True
+    if k == "1OP" and n == 0x00:
+        return lines + branch_lines(story, insn, "%s == 0" % x[0]), True
+
+    # Variables by number
+    var = indirect(insn) if insn.ops else None
+    if var is not None:
+        if k == "2OP" and n in (0x04, 0x05) and len(x) == 2:
+            op, rel = ("--", "<") if n == 0x04 else ("++", ">")
+            return lines + modify(story, var, op) + branch_lines(
+                story, insn, "(short) v %s (short) %s" % (rel, x[1])), True
+        if k == "1OP" and n in (0x05, 0x06):
+            return lines + modify(story, var, "++" if n == 5 else "--",
+                                  False), False
+        if k == "1OP" and n == 0x0e:
+            if var == 0:
+                lines.append("v = *sp;")
+            else:
+                lines += var_read(story, var, "v")
+            return lines + store("v"), False
+        if k == "2OP" and n == 0x0d and len(x) == 2:
+            if var == 0:
+                return lines + ["*sp = %s;" % x[1]], False
+            return lines + var_write(story, var, x[1]), False
+        if k == "VAR" and n == 0x09 and v != 6 and len(x) == 1:
+            lines.append("v = *sp++;")
+            if var == 0:
+                return lines + ["*sp = v;"], False
+            return lines + var_write(story, var, "v"), False
+    if k == "VAR" and n == 0x08 and len(x) == 1:
+        return lines + ["*--sp = %s;" % x[0]], False
+    if k == "0OP" and n == 0x09 and v <= 4:
+        return ["sp++;"], False
+    if k == "0OP" and n == 0x04:
+        return [], False
+
+    # Control transfers
+    if k == "1OP" and n == 0x0c:
+        return goto(story, insn.target) + ["return;"], True
+    if k == "1OP" and n == 0x0b:
+        return lines + ["ret(%s);" % x[0], "return;"], True
+    if k == "0OP" and n in (0x00, 0x01):
+        return ["ret(%d);" % (1 - n), "return;"], True
+    if k == "0OP" and n == 0x08:
+        return ["ret(*sp++);", "return;"], True
+    ct = call_type(story, insn)
+    if ct is not None and insn.ops and insn.ops[0][0] != VARIABLE:
+        resume = insn.operand_end
+        if insn.ops[0][1] == 0:
+            lines += ["(void) %s;" % a for a in x[1:] if a.startswith("x")]
+            if ct == 0:
+                return lines + store("0"), False
+            return lines, False
+        args = x[1:]
+        if args:
+            lines.append("zword args[%d];" % len(args))
+            lines += ["args[%d] = %s;" % (i, a) for i, a in enumerate(args)]
+        lines += goto(story, resume)
+        lines.append("call(0x%x, %d, %s, %d);" %
+                     (insn.ops[0][1], len(args), "args" if args else "0", ct))
+        return lines + ["return;"], True
+
+    # Everything else goes through the opcode handler.  It finds its
+    # store and branch bytes or its inline string at the PC as usual.
+    lines.append("zargc = %d;" % len(x))
+    lines += ["zargs[%d] = %s;" % (i, e) for i, e in enumerate(x)]
+    lines += goto(story, insn.operand_end)
+    if k == "2OP":
+        lines.append("var_opcodes[0x%02x]();" % n)
+    elif k == "1OP":
+        lines.append("op1_opcodes[0x%02x]();" % n)
+    elif k == "0OP":
+        lines.append("op0_opcodes[0x%02x]();" % n)
+    elif k == "VAR":
+        lines.append("var_opcodes[0x%02x]();" % (0x20 + n))
+    else:
+        lines.append("ext_opcodes[0x%02x]();" % n)
+    if insn.control:
+        return lines + ["return;"], True
+    # Interrupt routines (timed input, end of sound) start as soon as
+    # the handler is done, so the block stops there.
+    return lines + ["if (interrupts_pending)", "\treturn;"], False
+
+
+def emit(story, insns, leaders, out):
+    w = out.write
+    w("/* Generated by zcompile.py from release %d, serial %s.\n"
+      " * Do not edit; rebuild it from the story file instead.\n */\n\n"
+      % (story.release, story.serial.decode("ascii", "replace")))
+    w('#include "frotz.h"\n\n')
+    w("extern void (*op0_opcodes[])(void);\n")
+    w("extern void (*op1_opcodes[])(void);\n")
+    w("extern void (*var_opcodes[])(void);\n")
+    w("extern void (*ext_opcodes[])(void);\n")
+    w("extern void call(zword, int, zword *, int);\n")
+    w("extern int interrupts_pending;\n\n")
+    w("const zword aot_release = %d;\n" % story.release)
+    w("const zbyte aot_serial[6] = { %s };\n" %
+      ", ".join("0x%02x" % c for c in story.serial))
+    w("const zword aot_checksum = 0x%04x;\n" % story.checksum)
+
+    leader_set = set(leaders)
+    for pc in leaders:
+        body = []
+        addr = pc
+        while True:
+            insn = insns[addr]
+            lines, ends = translate(story, insn)
+            body.append("/* %05x */" % addr)
+            body += lines
+            if ends:
+                break
+            addr = insn.next
+            if addr in leader_set or addr not in insns:
+                body += goto(story, addr)
+                break
+        text = "\n".join(body)
+        temps = [t for t in TEMPS if re.search(r"\b%s\b" % t, text)]
+        w("\nstatic void aot_%05x(void)\n{\n" % pc)
+        for t in temps:
+            w("\t%s %s;\n" % ("zbyte" if t == "b" else "zword", t))
+        if temps:
+            w("\n")
+        for line in body:
+            w("\t" + line + "\n")
+        w("}\n")
+
+    w("\nconst aot_entry_t aot_blocks[] = {\n")
+    for pc in leaders:
+        w("\t{ 0x%05xL, aot_%05x },\n" % (pc, pc))
+    w("};\n\nconst int aot_block_count = %d;\n" % len(leaders))
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write("usage: zcompile.py story-file > aot_story.c\n")
+        sys.exit(1)
+    with open(sys.argv[1], "rb") as f:
+        story = Story(f.read())
+    compiler = Compiler(story)
+    leaders = compiler.run()
+    emit(story, compiler.insns, leaders, sys.stdout)
+    sys.stderr.write("%d routines, %d instructions, %d blocks\n" %
+                     (len([a for a, end in compiler.routines.items()
+                           if end is not None]), len(compiler.insns),
+                      len(leaders)))
+
+
+if __name__ == "__main__":
+    main()